@@ -0,0 +1,170 @@
+/* arena.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The job arena. Everything a job allocates for paths, strings and scratch
+ * space comes out of 64 KB blocks owned by the job: allocating is a bump
+ * of a pointer, nothing is freed piece by piece, and the whole lot goes in
+ * one step when the job ends. Short-lived allocations (a message, a buffer
+ * for one file) take a mark first and release back to it, so that a job
+ * working through any number of files stays the same size. Each job has
+ * its own arena, so jobs never wait on each other to allocate.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_HEADER_SIZE \
+  ((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static unsigned char * block_data(arena_block_t * block)
+{
+  return (unsigned char *)block + ARENA_HEADER_SIZE;
+}
+
+/* Start a new block with room for at least size bytes. */
+static arena_block_t * new_block(arena_t * arena, size_t size)
+{
+  arena_block_t * block;
+
+  if (size <= ARENA_BLOCK_SIZE && arena->spare != NULL)
+  {
+    block = arena->spare;
+    arena->spare = NULL;
+  } else {
+    size_t room = max(size, ARENA_BLOCK_SIZE);
+    if (room > SIZE_MAX - ARENA_HEADER_SIZE)
+    {
+      return NULL;
+    }
+    block = (arena_block_t *)malloc(ARENA_HEADER_SIZE + room);
+    if (block == NULL)
+    {
+      return NULL;
+    }
+    block->size = room;
+  }
+  block->used = 0;
+  block->previous = arena->block;
+  arena->block = block;
+  return block;
+}
+
+void * arena_alloc(arena_t * arena, size_t size)
+{
+  arena_block_t * block = arena->block;
+  size_t offset;
+
+  if (size > SIZE_MAX - ARENA_ALIGNMENT)
+  {
+    return NULL;
+  }
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  offset = block == NULL ? 0 : block->used;
+  if (block == NULL || block->size - offset < size)
+  {
+    block = new_block(arena, size);
+    if (block == NULL)
+    {
+      return NULL;
+    }
+    offset = 0;
+  }
+  block->used = offset + size;
+  return block_data(block) + offset;
+}
+
+void * arena_calloc(arena_t * arena, size_t count, size_t size)
+{
+  void * memory;
+
+  if (size != 0 && count > SIZE_MAX / size)
+  {
+    return NULL;
+  }
+  memory = arena_alloc(arena, count * size);
+  if (memory != NULL)
+  {
+    memset(memory, 0, count * size);
+  }
+  return memory;
+}
+
+/* A UTF-8 copy of a wide string, as libSoX wants its paths. */
+char * arena_utf8(arena_t * arena, PCWSTR text)
+{
+  int length = WideCharToMultiByte(CP_UTF8, 0, text, -1, NULL, 0, NULL, NULL);
+  char * buffer;
+
+  if (length == 0)
+  {
+    return NULL;
+  }
+  buffer = (char *)arena_alloc(arena, (size_t)length);
+  if (buffer == NULL
+      || WideCharToMultiByte(CP_UTF8, 0, text, -1, buffer, length, NULL, NULL) == 0)
+  {
+    return NULL;
+  }
+  return buffer;
+}
+
+/* A wide copy of a string, for showing it in a window. */
+PWSTR arena_wide(arena_t * arena, char const * text)
+{
+  int length = MultiByteToWideChar(CP_UTF8, 0, text, -1, NULL, 0);
+  PWSTR buffer;
+
+  if (length == 0)
+  {
+    return NULL;
+  }
+  buffer = (PWSTR)arena_alloc(arena, (size_t)length * sizeof(WCHAR));
+  if (buffer == NULL || MultiByteToWideChar(CP_UTF8, 0, text, -1, buffer, length) == 0)
+  {
+    return NULL;
+  }
+  return buffer;
+}
+
+arena_mark_t arena_mark(arena_t const * arena)
+{
+  arena_mark_t mark;
+
+  mark.block = arena->block;
+  mark.used = arena->block == NULL ? 0 : arena->block->used;
+  return mark;
+}
+
+void arena_release(arena_t * arena, arena_mark_t mark)
+{
+  while (arena->block != mark.block)
+  {
+    arena_block_t * block = arena->block;
+
+    arena->block = block->previous;
+    /* Keep one standard block back, so a loop that allocates across a
+     * block boundary doesn't go to malloc() every time round. */
+    if (arena->spare == NULL && block->size == ARENA_BLOCK_SIZE)
+    {
+      arena->spare = block;
+    } else {
+      free(block);
+    }
+  }
+  if (arena->block != NULL)
+  {
+    arena->block->used = mark.used;
+  }
+}
+
+void arena_free(arena_t * arena)
+{
+  arena_mark_t start = {NULL, 0};
+
+  arena_release(arena, start);
+  free(arena->spare);
+  arena->spare = NULL;
+}
@@ -0,0 +1,40 @@
+/* arena.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the job arena, a bump allocator
+ * for the paths, strings and scratch buffers a job needs.
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <windows.h>
+
+#define ARENA_BLOCK_SIZE ((size_t)64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block_t {
+  struct arena_block_t * previous;
+  size_t size;              /* Bytes of room after the header */
+  size_t used;
+} arena_block_t;
+
+typedef struct {
+  arena_block_t * block;    /* The block being filled */
+  arena_block_t * spare;    /* A released block, kept for reuse */
+} arena_t;
+
+/* A point to release back to, discarding everything allocated since. */
+typedef struct {
+  arena_block_t * block;
+  size_t used;
+} arena_mark_t;
+
+void * arena_alloc(arena_t * arena, size_t size);
+void * arena_calloc(arena_t * arena, size_t count, size_t size);
+char * arena_utf8(arena_t * arena, PCWSTR text);
+PWSTR arena_wide(arena_t * arena, char const * text);
+arena_mark_t arena_mark(arena_t const * arena);
+void arena_release(arena_t * arena, arena_mark_t mark);
+void arena_free(arena_t * arena);
@@ -0,0 +1,318 @@
+/* async-io.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Overlapped I/O for the raw WAV paths: writing tracks into the output,
+ * moving tracks along it, and reading it back. wav_read_at() and
+ * wav_write_at() wait for each request before making the next, which
+ * leaves a fast disk idle most of the time; here up to AIO_DEPTH requests
+ * are in flight, each in its own slot with its own event and buffer.
+ *
+ * The slots are used in turn, as a ring, and a slot is only reused once
+ * its last request has finished, so requests complete in the order they
+ * were made as far as the caller can tell. Built without OVERLAPPED_IO
+ * (or if the events cannot be had), each request is just done there and
+ * then with wav_read_at() or wav_write_at().
+ *
+ */
+
+#include "wt.h"
+#include <string.h>
+
+static int slot_issue(aio_t * aio, aio_slot_t * slot, aio_state_t state)
+{
+  BOOL issued;
+
+  slot->state = state;
+  if (!aio->overlapped)
+  {
+    if ((state == AIO_READING ? wav_read_at(aio->file, slot->offset, slot->buffer, slot->length)
+          : wav_write_at(aio->file, slot->offset, slot->buffer, slot->length)) != SOX_SUCCESS)
+    {
+      aio->failed = 1;
+    }
+    return aio->failed ? SOX_EOF : SOX_SUCCESS;
+  }
+  slot->overlapped.Offset = (DWORD)slot->offset;
+  slot->overlapped.OffsetHigh = (DWORD)(slot->offset >> 32);
+  slot->overlapped.Internal = slot->overlapped.InternalHigh = 0;
+  ResetEvent(slot->overlapped.hEvent);
+  issued = state == AIO_READING
+    ? ReadFile(aio->file, slot->buffer, (DWORD)slot->length, NULL, &slot->overlapped)
+    : WriteFile(aio->file, slot->buffer, (DWORD)slot->length, NULL, &slot->overlapped);
+  if (!issued && GetLastError() != ERROR_IO_PENDING)
+  {
+    slot->state = AIO_IDLE;
+    aio->failed = 1;
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Wait for the slot's request, if it has one, to finish. */
+static int slot_wait(aio_t * aio, aio_slot_t * slot)
+{
+  DWORD transferred = 0;
+
+  if (slot->state != AIO_IDLE && aio->overlapped
+      && (!GetOverlappedResult(aio->file, &slot->overlapped, &transferred, TRUE)
+          || transferred != slot->length))
+  {
+    aio->failed = 1;
+  }
+  slot->state = AIO_IDLE;
+  return aio->failed ? SOX_EOF : SOX_SUCCESS;
+}
+
+static int wait_all(aio_t * aio)
+{
+  size_t i;
+
+  for (i = 0; i < aio->depth; ++i)
+  {
+    slot_wait(aio, &aio->slots[i]);
+  }
+  return aio->failed ? SOX_EOF : SOX_SUCCESS;
+}
+
+/*
+ * Get ready to do I/O on a file from wav_open_raw() or wav_create_raw()
+ *
+ * The buffers are allocated once, here, and used for every request: as
+ * many as the job's budget allows, up to AIO_DEPTH. While requests are in
+ * flight, the file should not be used any other way; see aio_flush().
+ */
+int aio_open(aio_t * aio, HANDLE file, budget_account_t * account)
+{
+  size_t i, granted;
+
+  memset(aio, 0, sizeof(*aio));
+  aio->file = file;
+  aio->overlapped = OVERLAPPED_IO;
+  aio->account = account;
+  granted = budget_charge(account, AIO_DEPTH * AIO_BLOCK_BYTES, AIO_MIN_DEPTH * AIO_BLOCK_BYTES);
+  aio->depth = granted / AIO_BLOCK_BYTES;
+  budget_release(account, granted % AIO_BLOCK_BYTES);
+  aio->buffers = (unsigned char *)VirtualAlloc(NULL, aio->depth * AIO_BLOCK_BYTES,
+    MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (aio->buffers == NULL)
+  {
+    budget_release(account, aio->depth * AIO_BLOCK_BYTES);
+    aio->depth = 0;
+    aio->failed = 1;
+    return SOX_EOF;
+  }
+  for (i = 0; i < aio->depth; ++i)
+  {
+    aio->slots[i].buffer = aio->buffers + i * AIO_BLOCK_BYTES;
+    if (aio->overlapped)
+    {
+      aio->slots[i].overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+      if (aio->slots[i].overlapped.hEvent == NULL)
+      {
+        aio->overlapped = 0;
+      }
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+/* Finish everything still in flight, and let go of the slots. Returns
+ * SOX_EOF if any request failed. */
+int aio_close(aio_t * aio)
+{
+  size_t i;
+  int result = aio_flush(aio);
+
+  for (i = 0; i < aio->depth; ++i)
+  {
+    if (aio->slots[i].overlapped.hEvent != NULL)
+    {
+      CloseHandle(aio->slots[i].overlapped.hEvent);
+      aio->slots[i].overlapped.hEvent = NULL;
+    }
+  }
+  if (aio->buffers != NULL)
+  {
+    VirtualFree(aio->buffers, 0, MEM_RELEASE);
+    aio->buffers = NULL;
+    budget_release(aio->account, aio->depth * AIO_BLOCK_BYTES);
+  }
+  return result;
+}
+
+/* Where aio_append() writes next. */
+void aio_seek(aio_t * aio, uint64_t position)
+{
+  aio_flush(aio);
+  aio->position = position;
+}
+
+/* Write bytes at the current position, in blocks of AIO_BLOCK_BYTES.
+ * A failure may only show up in a later call, or in aio_flush(). */
+int aio_append(aio_t * aio, void const * bytes, size_t length)
+{
+  unsigned char const * p = (unsigned char const *)bytes;
+
+  while (length > 0 && !aio->failed)
+  {
+    aio_slot_t * slot = &aio->slots[aio->next];
+    size_t n;
+
+    if (aio->fill == 0 && slot_wait(aio, slot) != SOX_SUCCESS)
+    {
+      break;
+    }
+    n = min(length, AIO_BLOCK_BYTES - aio->fill);
+    memcpy(slot->buffer + aio->fill, p, n);
+    aio->fill += n;
+    p += n;
+    length -= n;
+    if (aio->fill == AIO_BLOCK_BYTES)
+    {
+      slot->offset = aio->position;
+      slot->length = aio->fill;
+      aio->position += aio->fill;
+      aio->fill = 0;
+      aio->next = (aio->next + 1) % aio->depth;
+      slot_issue(aio, slot, AIO_WRITING);
+    }
+  }
+  return aio->failed ? SOX_EOF : SOX_SUCCESS;
+}
+
+/* Write out any part block, and wait until everything has finished. */
+int aio_flush(aio_t * aio)
+{
+  if (aio->fill > 0 && !aio->failed)
+  {
+    aio_slot_t * slot = &aio->slots[aio->next];
+
+    slot->offset = aio->position;
+    slot->length = aio->fill;
+    aio->position += aio->fill;
+    aio->next = (aio->next + 1) % aio->depth;
+    slot_issue(aio, slot, AIO_WRITING);
+  }
+  aio->fill = 0;
+  aio->scan_offset = aio->scan_end = 0;
+  return wait_all(aio);
+}
+
+/* Block k of a move: where it starts within the range (see aio_move()). */
+static uint64_t move_block(uint64_t k, uint64_t from, uint64_t to, uint64_t length)
+{
+  uint64_t start = k * AIO_BLOCK_BYTES;
+
+  if (to > from)
+  {
+    uint64_t block_length = min((uint64_t)AIO_BLOCK_BYTES, length - start);
+    return length - start - block_length;
+  }
+  return start;
+}
+
+/*
+ * Like memmove(), but for a region of the file
+ *
+ * The blocks go in the order memmove() would take bytes: from the front
+ * when moving towards the start of the file, and from the back when moving
+ * towards the end, since then the range written over is the one still to
+ * be read. Blocks are read up to half the depth ahead of the one being
+ * written. Each block is written to the side away from the blocks still to
+ * be read, so no write can land on anything a read in flight has yet to
+ * get.
+ */
+int aio_move(aio_t * aio, uint64_t from, uint64_t to, uint64_t length)
+{
+  uint64_t blocks = (length + AIO_BLOCK_BYTES - 1) / AIO_BLOCK_BYTES, k;
+  uint64_t lag = aio->depth / 2;
+
+  if (from == to || length == 0)
+  {
+    return SOX_SUCCESS;
+  }
+  if (aio_flush(aio) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  for (k = 0; k < blocks + lag && !aio->failed; ++k)
+  {
+    if (k < blocks)
+    {
+      aio_slot_t * slot = &aio->slots[k % aio->depth];
+      uint64_t start = move_block(k, from, to, length);
+
+      if (slot_wait(aio, slot) != SOX_SUCCESS)
+      {
+        break;
+      }
+      slot->offset = from + start;
+      slot->length = (size_t)min((uint64_t)AIO_BLOCK_BYTES, length - start);
+      slot_issue(aio, slot, AIO_READING);
+    }
+    if (k >= lag)
+    {
+      aio_slot_t * slot = &aio->slots[(k - lag) % aio->depth];
+
+      if (slot_wait(aio, slot) != SOX_SUCCESS)
+      {
+        break;
+      }
+      slot->offset += to - from;
+      slot_issue(aio, slot, AIO_WRITING);
+    }
+  }
+  return wait_all(aio);
+}
+
+/* Start reading a region of the file, for aio_next() to hand back. */
+int aio_scan(aio_t * aio, uint64_t offset, uint64_t length)
+{
+  size_t i;
+
+  if (aio_flush(aio) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  aio->scan_offset = offset;
+  aio->scan_end = offset + length;
+  aio->next = 0;
+  for (i = 0; i < aio->depth && aio->scan_offset < aio->scan_end; ++i)
+  {
+    aio_slot_t * slot = &aio->slots[i];
+
+    slot->offset = aio->scan_offset;
+    slot->length = (size_t)min((uint64_t)AIO_BLOCK_BYTES, aio->scan_end - aio->scan_offset);
+    aio->scan_offset += slot->length;
+    slot_issue(aio, slot, AIO_READING);
+  }
+  return aio->failed ? SOX_EOF : SOX_SUCCESS;
+}
+
+/* The next block of the region being scanned, in order. Its data stays
+ * put until the next call. Returns 0 at the end, or on failure. */
+size_t aio_next(aio_t * aio, unsigned char const ** data)
+{
+  aio_slot_t * slot = &aio->slots[aio->next];
+  size_t previous = (aio->next + aio->depth - 1) % aio->depth;
+
+  /* The block handed out last time is done with; read another into it. */
+  if (aio->slots[previous].state == AIO_IDLE && aio->slots[previous].length > 0
+      && aio->scan_offset < aio->scan_end && !aio->failed)
+  {
+    aio_slot_t * last = &aio->slots[previous];
+
+    last->offset = aio->scan_offset;
+    last->length = (size_t)min((uint64_t)AIO_BLOCK_BYTES, aio->scan_end - aio->scan_offset);
+    aio->scan_offset += last->length;
+    slot_issue(aio, last, AIO_READING);
+  }
+  if (slot->state != AIO_READING || slot_wait(aio, slot) != SOX_SUCCESS)
+  {
+    return 0;
+  }
+  aio->next = (aio->next + 1) % aio->depth;
+  *data = slot->buffer;
+  return slot->length;
+}
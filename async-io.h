@@ -0,0 +1,55 @@
+/* async-io.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for overlapped file I/O, which keeps
+ * several reads and writes of a raw WAV file in flight at once.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "budget.h"
+
+#define AIO_DEPTH 16                        /* Requests in flight, at most... */
+#define AIO_MIN_DEPTH 2                     /* ...and at least, when memory is short */
+#define AIO_BLOCK_BYTES ((size_t)256 * 1024) /* Bytes per request */
+
+typedef enum {
+  AIO_IDLE,
+  AIO_READING,
+  AIO_WRITING
+} aio_state_t;
+
+/* One request, with its own event and its own block of the buffers. */
+typedef struct {
+  OVERLAPPED overlapped;
+  unsigned char * buffer;
+  uint64_t offset;
+  size_t length;
+  aio_state_t state;
+} aio_slot_t;
+
+typedef struct {
+  HANDLE file;              /* From wav_open_raw() or wav_create_raw() */
+  int overlapped;           /* Whether requests run in the background, or one at a time */
+  aio_slot_t slots[AIO_DEPTH];
+  size_t depth;             /* Slots in use, as the budget allows */
+  unsigned char * buffers;  /* Allocated once, for every request... */
+  budget_account_t * account; /* ...and charged to this */
+  size_t next;              /* The slot to fill or issue next */
+  size_t fill;              /* aio_append(): bytes in that slot so far... */
+  uint64_t position;        /* ...and where they go */
+  uint64_t scan_offset, scan_end; /* aio_scan(): what is still to be read */
+  int failed;
+} aio_t;
+
+int aio_open(aio_t * aio, HANDLE file, budget_account_t * account);
+int aio_close(aio_t * aio);
+void aio_seek(aio_t * aio, uint64_t position);
+int aio_append(aio_t * aio, void const * bytes, size_t length);
+int aio_flush(aio_t * aio);
+int aio_move(aio_t * aio, uint64_t from, uint64_t to, uint64_t length);
+int aio_scan(aio_t * aio, uint64_t offset, uint64_t length);
+size_t aio_next(aio_t * aio, unsigned char const ** data);
@@ -0,0 +1,219 @@
+/* automation.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Per-track gain and fades, applied to each block on its way into the
+ * output rather than as sox passes of their own. splice-automation.txt, in
+ * the folder with the tracks, has a line for each track that needs any:
+ *
+ *   03 The Great Gate.wav: gain -1.5, in 0.5, out 00:04 cosine
+ *
+ * The gain is in dB; fades are durations as parse_duration() takes them,
+ * with an optional curve (linear, sine or cosine). Only the frames under a
+ * fade cost more than a multiply, and a track with no gain costs nothing.
+ *
+ */
+
+#include "wt.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PI 3.14159265358979323846
+
+/* The fade's gain at x, from 0 (silent) to 1 (full). */
+static double curve_at(automation_curve_t curve, double x)
+{
+  switch (curve)
+  {
+  case CURVE_SINE:
+    return sin(x * PI / 2);
+  case CURVE_COSINE:
+    return (1 - cos(x * PI)) / 2;
+  default:
+    return x;
+  }
+}
+
+static int parse_curve(char const * text, automation_curve_t * curve)
+{
+  if (*text == '\0' || strcmp(text, "linear") == 0)
+  {
+    *curve = CURVE_LINEAR;
+  }
+  else if (strcmp(text, "sine") == 0)
+  {
+    *curve = CURVE_SINE;
+  }
+  else if (strcmp(text, "cosine") == 0)
+  {
+    *curve = CURVE_COSINE;
+  } else {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* A fade clause's length and curve, e.g. "0.5" or "00:04 cosine". */
+static int parse_fade(char * text, sox_rate_t rate, uint64_t * frames,
+  automation_curve_t * curve)
+{
+  char * curve_name = strchr(text, ' ');
+
+  if (curve_name != NULL)
+  {
+    *curve_name++ = '\0';
+    curve_name += strspn(curve_name, " ");
+  }
+  if (parse_duration(text, rate, frames) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  return parse_curve(curve_name != NULL ? curve_name : "", curve);
+}
+
+/* Read a track's automation, the part of its line after the colon. */
+int automation_parse(char const * text, sox_rate_t rate, automation_t * automation)
+{
+  char clause[100];
+  size_t length;
+
+  memset(automation, 0, sizeof(*automation));
+  automation->gain = 1;
+  while (*(text += strspn(text, " \t")) != '\0')
+  {
+    length = strcspn(text, ",");
+    if (length >= sizeof(clause))
+    {
+      return SOX_EOF;
+    }
+    memcpy(clause, text, length);
+    while (length > 0 && strchr(" \t\r\n", clause[length - 1]) != NULL)
+    {
+      --length;
+    }
+    clause[length] = '\0';
+    text += strcspn(text, ",");
+    text += (*text == ',');
+    if (strncmp(clause, "gain ", 5) == 0)
+    {
+      char * end;
+      double db = strtod(clause + 5, &end);
+      if (end == clause + 5 || *end != '\0')
+      {
+        return SOX_EOF;
+      }
+      automation->gain = pow(10, db / 20);
+    }
+    else if (strncmp(clause, "in ", 3) == 0)
+    {
+      if (parse_fade(clause + 3, rate, &automation->fade_in, &automation->in_curve)
+          != SOX_SUCCESS)
+      {
+        return SOX_EOF;
+      }
+    }
+    else if (strncmp(clause, "out ", 4) == 0)
+    {
+      if (parse_fade(clause + 4, rate, &automation->fade_out, &automation->out_curve)
+          != SOX_SUCCESS)
+      {
+        return SOX_EOF;
+      }
+    }
+    else if (clause[0] != '\0')
+    {
+      return SOX_EOF;
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+/* A hash of what the automation does, for the manifest: 0 if nothing, so
+ * that a track spliced before there was any needs no rewriting. */
+uint64_t automation_key(automation_t const * automation)
+{
+  uint64_t key;
+
+  if (automation == NULL
+      || (automation->gain == 1 && automation->fade_in == 0 && automation->fade_out == 0))
+  {
+    return 0;
+  }
+  key = fingerprint_bytes(FINGERPRINT_SEED, &automation->gain, sizeof(automation->gain));
+  key = fingerprint_bytes(key, &automation->fade_in, sizeof(automation->fade_in));
+  key = fingerprint_bytes(key, &automation->fade_out, sizeof(automation->fade_out));
+  key = fingerprint_bytes(key, &automation->in_curve, sizeof(automation->in_curve));
+  key = fingerprint_bytes(key, &automation->out_curve, sizeof(automation->out_curve));
+  return key ? key : 1;
+}
+
+/* The gain at a frame of the track. The fade out needs the track's length;
+ * where that is unknown (0), there is none. */
+static double gain_at(automation_t const * automation, uint64_t frame, uint64_t track_frames)
+{
+  double gain = automation->gain;
+
+  if (frame < automation->fade_in)
+  {
+    gain *= curve_at(automation->in_curve, (double)frame / automation->fade_in);
+  }
+  if (track_frames > 0 && automation->fade_out > 0
+      && frame + automation->fade_out >= track_frames)
+  {
+    uint64_t left = frame < track_frames ? track_frames - frame : 0;
+    gain *= curve_at(automation->out_curve, (double)left / automation->fade_out);
+  }
+  return gain;
+}
+
+/* Apply the automation to a block of frames, frame `frame` of the track
+ * being the first. Between the fades a plain gain is enough; under them,
+ * the curve is followed in short straight pieces. */
+void automation_apply(automation_t const * automation, native_kernels_t const * kernels,
+  void * data, size_t frames, unsigned channels, uint64_t frame, uint64_t track_frames)
+{
+  unsigned char * bytes = (unsigned char *)data;
+  size_t frame_bytes = (size_t)channels * kernels->sample_bytes;
+  uint64_t out_start = UINT64_MAX;
+
+  if (automation_key(automation) == 0)
+  {
+    return;
+  }
+  if (track_frames > 0 && automation->fade_out > 0)
+  {
+    out_start = track_frames > automation->fade_out ? track_frames - automation->fade_out : 0;
+  }
+  while (frames > 0)
+  {
+    size_t n;
+
+    if (frame >= automation->fade_in && frame < out_start)
+    {
+      n = (size_t)min(frames, out_start - frame);
+      if (automation->gain != 1)
+      {
+        kernels->gain(bytes, n * channels, automation->gain);
+      }
+    } else {
+      double from, to;
+      n = (size_t)min(frames, AUTOMATION_SEGMENT_FRAMES - frame % AUTOMATION_SEGMENT_FRAMES);
+      /* (A piece must not straddle where a fade starts or ends.) */
+      if (frame < automation->fade_in)
+      {
+        n = (size_t)min(n, automation->fade_in - frame);
+      }
+      if (frame < out_start)
+      {
+        n = (size_t)min(n, out_start - frame);
+      }
+      from = gain_at(automation, frame, track_frames);
+      to = gain_at(automation, frame + n, track_frames);
+      kernels->fade(bytes, n, channels, from, (to - from) / n);
+    }
+    bytes += n * frame_bytes;
+    frame += n;
+    frames -= n;
+  }
+}
@@ -0,0 +1,35 @@
+/* automation.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for per-track automation: a gain
+ * trim, and fades in and out, applied as the tracks are spliced.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+#include "native-pcm.h"
+
+#define AUTOMATION_FILENAME "splice-automation.txt"
+#define AUTOMATION_SEGMENT_FRAMES 64 /* Curves are followed in straight pieces this long */
+
+typedef enum {
+  CURVE_LINEAR,
+  CURVE_SINE,               /* Quarter sine: equal power, for fades into other sound */
+  CURVE_COSINE              /* Raised cosine: an S-curve, gentle at both ends */
+} automation_curve_t;
+
+/* What is done to one track. A track with none has gain 1 and no fades. */
+typedef struct {
+  double gain;              /* Linear, throughout the track */
+  uint64_t fade_in;         /* Frames, from the start... */
+  uint64_t fade_out;        /* ...and to the end */
+  automation_curve_t in_curve, out_curve;
+} automation_t;
+
+int automation_parse(char const * text, sox_rate_t rate, automation_t * automation);
+uint64_t automation_key(automation_t const * automation);
+void automation_apply(automation_t const * automation, native_kernels_t const * kernels,
+  void * data, size_t frames, unsigned channels, uint64_t frame, uint64_t track_frames);
@@ -0,0 +1,518 @@
+/* bench.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * A microbenchmark for the kernels the samples go through on their way to
+ * the output: the block copy, widening and packing, fingerprints and
+ * checksums, peak and threshold reductions, gains, fades and crossfades,
+ * and dither. Each version of each kernel (the plain one, the vector ones
+ * this CPU can run, and the mono and stereo ones stamped out for each
+ * sample format) is timed over a run that stays in the cache and one that
+ * has to come from memory, and reported in GB/s of input and TSC cycles per
+ * sample. Before it is timed, each version is checked against the plain
+ * one, so a kernel that is fast but wrong shows up as well.
+ *
+ * It is a console program of its own: make -f Makefile_bench.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BENCH_CACHE_SAMPLES ((size_t)8 * 1024)          /* 32 KB decoded: stays in L1/L2 */
+#define BENCH_MEMORY_SAMPLES ((size_t)8 * 1024 * 1024)  /* 32 MB decoded: well past the caches */
+#define BENCH_MIN_SECONDS 0.2   /* Each kernel is repeated for at least this long... */
+#define BENCH_MIN_RUNS 3        /* ...and this many times, and the best run reported */
+
+typedef struct {
+  native_format_t format;
+  char const * name;
+  sox_encoding_t encoding;
+  unsigned bits;
+} bench_format_t;
+
+static bench_format_t const formats[] = {
+  { NATIVE_S16, "s16", SOX_ENCODING_SIGN2, 16 },
+  { NATIVE_S24, "s24", SOX_ENCODING_SIGN2, 24 },
+  { NATIVE_S32, "s32", SOX_ENCODING_SIGN2, 32 },
+  { NATIVE_F32, "f32", SOX_ENCODING_FLOAT, 32 }
+};
+
+/* Everything a kernel is run on, and the version of it being run. */
+typedef struct {
+  bench_format_t const * format;
+  native_kernels_t const * kernels;
+  void const * variant;             /* A checksum_variant_t, dither_variant_t... */
+  unsigned channels;
+  size_t count;                     /* Samples in the run */
+  unsigned char * native;           /* The samples as stored in the format... */
+  unsigned char * work;             /* ...a copy, for the kernels that work in place... */
+  sox_sample_t * samples;           /* ...and as decoded */
+  sox_sample_t * widened;           /* What the kernels produce */
+  unsigned char * packed;
+  dither_t * dither;
+  envelope_t envelope;
+  uint64_t results;                 /* Summed, so that nothing can be skipped */
+  int failures;
+} bench_t;
+
+static int cpu_has(char const * feature)
+{
+  __builtin_cpu_init();
+  if (feature == NULL)
+  {
+    return 1;
+  }
+  if (strcmp(feature, "sse2") == 0)
+  {
+    return __builtin_cpu_supports("sse2");
+  }
+  if (strcmp(feature, "sse4.1") == 0)
+  {
+    return __builtin_cpu_supports("sse4.1");
+  }
+  if (strcmp(feature, "sse4.2") == 0)
+  {
+    return __builtin_cpu_supports("sse4.2");
+  }
+  if (strcmp(feature, "avx2") == 0)
+  {
+    return __builtin_cpu_supports("avx2");
+  }
+  return 0;
+}
+
+static double seconds_now(void)
+{
+  LARGE_INTEGER counter, frequency;
+
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+static size_t native_bytes(bench_t const * bench)
+{
+  return bench->count * (bench->format->bits / 8);
+}
+
+/* The kernels, each run once over bench->count samples. Those that work
+ * in place are given gains that keep the samples about where they were,
+ * however often they are run: -1, or fades that hardly fade. */
+static void run_copy(bench_t * bench)
+{
+  memcpy(bench->work, bench->native, native_bytes(bench));
+}
+
+static void run_widen(bench_t * bench)
+{
+  bench->kernels->widen(bench->native, bench->count, bench->widened);
+}
+
+static void run_pack(bench_t * bench)
+{
+  sox_uint64_t clips = 0;
+
+  bench->results += wav_pack_samples(bench->samples, bench->count, bench->format->encoding,
+    bench->format->bits, bench->packed, &clips);
+}
+
+static void run_fingerprint(bench_t * bench)
+{
+  bench->results += bench->kernels->fingerprint(FINGERPRINT_SEED, bench->native, bench->count);
+}
+
+static void run_extremes(bench_t * bench)
+{
+  sox_sample_t min[NATIVE_MAX_CHANNELS], max[NATIVE_MAX_CHANNELS];
+  unsigned c;
+
+  for (c = 0; c < bench->channels; ++c)
+  {
+    min[c] = SOX_SAMPLE_MAX;
+    max[c] = SOX_SAMPLE_MIN;
+  }
+  bench->kernels->extremes(bench->native, bench->count, bench->channels, 0, min, max);
+  bench->results += (uint32_t)max[0] - (uint32_t)min[0];
+}
+
+static void run_gain(bench_t * bench)
+{
+  bench->kernels->gain(bench->work, bench->count, -1);
+}
+
+static void run_fade(bench_t * bench)
+{
+  size_t frames = bench->count / bench->channels;
+
+  bench->kernels->fade(bench->work, frames, bench->channels, 1, -0.001 / frames);
+}
+
+static void run_mix(bench_t * bench)
+{
+  size_t frames = bench->count / bench->channels;
+
+  bench->kernels->mix(bench->work, bench->native, frames, bench->channels, 0, 1.0 / frames);
+}
+
+static void run_checksum(bench_t * bench)
+{
+  checksum_variant_t const * variant = (checksum_variant_t const *)bench->variant;
+
+  bench->results += variant->block(0, bench->native, native_bytes(bench));
+}
+
+static void run_dither(bench_t * bench)
+{
+  dither_variant_t const * variant = (dither_variant_t const *)bench->variant;
+
+  bench->results += variant->block(bench->dither, bench->samples, bench->count, bench->packed);
+}
+
+static void run_reduce(bench_t * bench)
+{
+  peak_variant_t const * variant = (peak_variant_t const *)bench->variant;
+  sox_sample_t min[2] = { SOX_SAMPLE_MAX, SOX_SAMPLE_MAX };
+  sox_sample_t max[2] = { SOX_SAMPLE_MIN, SOX_SAMPLE_MIN };
+
+  variant->reduce(bench->samples, bench->count, bench->channels, 0, min, max);
+  bench->results += (uint32_t)max[0] - (uint32_t)min[0];
+}
+
+static void run_find_sound(bench_t * bench)
+{
+  uint64_t start, end;
+
+  envelope_find_sound(&bench->envelope, 0.5, ENVELOPE_BLOCK_FRAMES, &start, &end);
+  bench->results += start + end;
+}
+
+/* Time run() over runs of `count` samples, and report its best. Over the
+ * cache-sized run, each timing covers enough calls to fill the larger. */
+static void time_kernel(bench_t * bench, char const * kernel, char const * variant,
+  size_t count, size_t input_bytes, int in_place, void (* run)(bench_t *), char const * check)
+{
+  size_t calls = BENCH_MEMORY_SAMPLES / count, i;
+  double best_seconds = 0, total = 0;
+  uint64_t best_cycles = 0;
+  unsigned runs;
+  char channels[8] = "-";
+
+  bench->count = count;
+  for (runs = 0; runs < BENCH_MIN_RUNS || total < BENCH_MIN_SECONDS; ++runs)
+  {
+    double seconds;
+    uint64_t cycles;
+
+    if (in_place)
+    {
+      memcpy(bench->work, bench->native, native_bytes(bench));
+    }
+    seconds = seconds_now();
+    cycles = __rdtsc();
+    for (i = 0; i < calls; ++i)
+    {
+      run(bench);
+    }
+    cycles = __rdtsc() - cycles;
+    seconds = seconds_now() - seconds;
+    total += seconds;
+    if (runs == 0 || seconds < best_seconds)
+    {
+      best_seconds = seconds;
+    }
+    if (runs == 0 || cycles < best_cycles)
+    {
+      best_cycles = cycles;
+    }
+  }
+  if (bench->channels > 0)
+  {
+    sprintf(channels, "%u", bench->channels);
+  }
+  printf("%-12s %-4s %-3s %-7s %-7s %9.2f %9.3f  %s\n", kernel,
+    bench->format != NULL ? bench->format->name : "-", channels, variant,
+    count == BENCH_CACHE_SAMPLES ? "cache" : "memory",
+    (double)input_bytes * calls / best_seconds / 1e9,
+    (double)best_cycles / calls / count, check);
+}
+
+/* Over both sizes of run. */
+static void time_both(bench_t * bench, char const * kernel, char const * variant,
+  size_t bytes_per_sample, int in_place, void (* run)(bench_t *), char const * check)
+{
+  time_kernel(bench, kernel, variant, BENCH_CACHE_SAMPLES,
+    BENCH_CACHE_SAMPLES * bytes_per_sample, in_place, run, check);
+  time_kernel(bench, kernel, variant, BENCH_MEMORY_SAMPLES,
+    BENCH_MEMORY_SAMPLES * bytes_per_sample, in_place, run, check);
+}
+
+static char const * checked(bench_t * bench, int same)
+{
+  if (!same)
+  {
+    bench->failures++;
+    return "MISMATCH";
+  }
+  return "ok";
+}
+
+/* Store the test signal in the format, as the WAV writer would. */
+static void store_format(bench_t * bench, bench_format_t const * format)
+{
+  sox_uint64_t clips = 0;
+
+  bench->format = format;
+  wav_pack_samples(bench->samples, BENCH_MEMORY_SAMPLES, format->encoding, format->bits,
+    bench->native, &clips);
+}
+
+/* The kernels that go at the samples' own width. */
+static void bench_native(bench_t * bench, bench_format_t const * format)
+{
+  native_kernels_t const * reference = native_reference_kernels(format->format);
+  size_t sample_bytes = format->bits / 8;
+  size_t const n = BENCH_CACHE_SAMPLES;
+  size_t bytes = n * sample_bytes;
+  unsigned char * expected = bench->packed + BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t) / 2;
+  sox_uint64_t clips = 0;
+  unsigned channels;
+  size_t i;
+  int same;
+
+  store_format(bench, format);
+  bench->channels = 0;
+  bench->kernels = reference;
+  bench->count = n;
+  time_both(bench, "copy", "memcpy", sample_bytes, 0, run_copy, "-");
+  /* Packing what was widened and widening it again should change nothing,
+   * but for the bits libSoX rounds away when it writes floats. */
+  reference->widen(bench->native, n, bench->widened);
+  wav_pack_samples(bench->widened, n, format->encoding, format->bits, bench->packed, &clips);
+  reference->widen(bench->packed, n, bench->widened + n);
+  for (i = 0, same = 1; i < n; ++i)
+  {
+    int64_t error = (int64_t)bench->widened[n + i] - bench->widened[i];
+    same &= format->format == NATIVE_F32 ? error >= -64 && error <= 64 : error == 0;
+  }
+  time_both(bench, "widen", "scalar", sample_bytes, 0, run_widen, checked(bench, same));
+  time_both(bench, "pack", "scalar", sizeof(sox_sample_t), 0, run_pack, checked(bench, same));
+  same = reference->fingerprint(FINGERPRINT_SEED, bench->native, n)
+    == fingerprint_samples(FINGERPRINT_SEED, bench->widened, n);
+  time_both(bench, "fingerprint", "scalar", sample_bytes, 0, run_fingerprint,
+    checked(bench, same));
+  /* (There is only the one gain kernel for each format.) */
+  time_both(bench, "gain", "scalar", sample_bytes, 1, run_gain, "-");
+
+  for (channels = 1; channels <= 2; ++channels)
+  {
+    native_kernels_t const * kernels = native_kernels(format->format, channels);
+    char const * name = channels == 1 ? "mono" : "stereo";
+    sox_sample_t min[2][2], max[2][2];
+    size_t frames = n / channels;
+    unsigned c;
+
+    bench->channels = channels;
+    for (c = 0; c < channels; ++c)
+    {
+      min[0][c] = min[1][c] = SOX_SAMPLE_MAX;
+      max[0][c] = max[1][c] = SOX_SAMPLE_MIN;
+    }
+    kernels->extremes(bench->native, n, channels, 0, min[0], max[0]);
+    reference->extremes(bench->native, n, channels, 0, min[1], max[1]);
+    same = memcmp(min[0], min[1], channels * sizeof(sox_sample_t)) == 0
+      && memcmp(max[0], max[1], channels * sizeof(sox_sample_t)) == 0;
+    bench->kernels = reference;
+    time_both(bench, "extremes", "any", sample_bytes, 0, run_extremes, "-");
+    bench->kernels = kernels;
+    time_both(bench, "extremes", name, sample_bytes, 0, run_extremes, checked(bench, same));
+
+    memcpy(bench->work, bench->native, bytes);
+    memcpy(expected, bench->native, bytes);
+    kernels->fade(bench->work, frames, channels, 1, -0.5 / frames);
+    reference->fade(expected, frames, channels, 1, -0.5 / frames);
+    same = memcmp(bench->work, expected, bytes) == 0;
+    bench->kernels = reference;
+    time_both(bench, "fade", "any", sample_bytes, 1, run_fade, "-");
+    bench->kernels = kernels;
+    time_both(bench, "fade", name, sample_bytes, 1, run_fade, checked(bench, same));
+
+    memcpy(bench->work, bench->native + bytes, bytes);
+    memcpy(expected, bench->native + bytes, bytes);
+    kernels->mix(bench->work, bench->native, frames, channels, 0, 1.0 / frames);
+    reference->mix(expected, bench->native, frames, channels, 0, 1.0 / frames);
+    same = memcmp(bench->work, expected, bytes) == 0;
+    bench->kernels = reference;
+    time_both(bench, "mix", "any", 2 * sample_bytes, 1, run_mix, "-");
+    bench->kernels = kernels;
+    time_both(bench, "mix", name, 2 * sample_bytes, 1, run_mix, checked(bench, same));
+  }
+}
+
+/* The kernels with vector versions, which go at the decoded samples (or,
+ * for the checksum, at their bytes). */
+static void bench_variants(bench_t * bench)
+{
+  size_t const n = BENCH_CACHE_SAMPLES;
+  unsigned char * expected = bench->packed + BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t) / 2;
+  checksum_variant_t const * checksum;
+  dither_variant_t const * dither;
+  peak_variant_t const * peak;
+  uint32_t expected_checksum = 0;
+  unsigned channels;
+
+  store_format(bench, &formats[NATIVE_S24]);
+  bench->channels = 0;
+  bench->count = n;
+  for (checksum = checksum_variants; checksum->name != NULL; ++checksum)
+  {
+    uint32_t crc;
+
+    if (!cpu_has(checksum->feature))
+    {
+      printf("%-12s %-4s %-3s %-7s (not on this CPU)\n", "checksum", "s24", "-", checksum->name);
+      continue;
+    }
+    crc = checksum->block(0, bench->native, n * 3);
+    if (checksum == checksum_variants)
+    {
+      expected_checksum = crc;
+    }
+    bench->variant = checksum;
+    time_both(bench, "checksum", checksum->name, 3, 0, run_checksum,
+      checked(bench, crc == expected_checksum));
+  }
+
+  bench->format = NULL;
+  for (dither = dither_variants; dither->name != NULL; ++dither)
+  {
+    size_t done;
+
+    if (!cpu_has(dither->feature))
+    {
+      printf("%-12s %-4s %-3s %-7s (not on this CPU)\n", "dither", "-", "-", dither->name);
+      continue;
+    }
+    bench->dither = dither_create(DITHER_TPDF, 2, 44100);
+    done = dither->block(bench->dither, bench->samples, n, bench->packed);
+    if (dither == dither_variants)
+    {
+      memcpy(expected, bench->packed, n * 2);
+    }
+    bench->variant = dither;
+    time_both(bench, "dither", dither->name, sizeof(sox_sample_t), 0, run_dither,
+      checked(bench, done == n && memcmp(bench->packed, expected, n * 2) == 0));
+    dither_free(bench->dither);
+    bench->dither = NULL;
+  }
+
+  for (channels = 1; channels <= 2; ++channels)
+  {
+    sox_sample_t expected_min[2], expected_max[2];
+
+    bench->channels = channels;
+    for (peak = peak_variants; peak->name != NULL; ++peak)
+    {
+      sox_sample_t min[2] = { SOX_SAMPLE_MAX, SOX_SAMPLE_MAX };
+      sox_sample_t max[2] = { SOX_SAMPLE_MIN, SOX_SAMPLE_MIN };
+
+      if (!cpu_has(peak->feature))
+      {
+        printf("%-12s %-4s %-3u %-7s (not on this CPU)\n", "peaks", "-", channels, peak->name);
+        continue;
+      }
+      peak->reduce(bench->samples, n, channels, 0, min, max);
+      if (peak == peak_variants)
+      {
+        memcpy(expected_min, min, sizeof(min));
+        memcpy(expected_max, max, sizeof(max));
+      }
+      bench->variant = peak;
+      time_both(bench, "peaks", peak->name, sizeof(sox_sample_t), 0, run_reduce,
+        checked(bench, memcmp(min, expected_min, sizeof(min)) == 0
+          && memcmp(max, expected_max, sizeof(max)) == 0));
+    }
+  }
+}
+
+/* Thresholding the envelope, where the sound only starts near the end,
+ * so that the whole of it is searched. */
+static void bench_find_sound(bench_t * bench)
+{
+  size_t i;
+
+  bench->format = NULL;
+  bench->channels = 0;
+  bench->envelope.peaks = (uint16_t *)bench->work;
+  for (i = 0; i < BENCH_MEMORY_SAMPLES; ++i)
+  {
+    bench->envelope.peaks[i] = (uint16_t)(abs(bench->samples[i] >> 16) / 4);
+  }
+  for (i = 0; i < 2; ++i)
+  {
+    size_t blocks = i == 0 ? BENCH_CACHE_SAMPLES : BENCH_MEMORY_SAMPLES;
+
+    bench->envelope.peaks[blocks - 2] = bench->envelope.peaks[blocks - 1] = 30000;
+    bench->envelope.header.block_count = blocks;
+    bench->envelope.header.frames = blocks * ENVELOPE_BLOCK_FRAMES;
+    time_kernel(bench, "find sound", "scalar", blocks, blocks * sizeof(uint16_t), 0,
+      run_find_sound, "-");
+    bench->envelope.peaks[blocks - 2] = bench->envelope.peaks[blocks - 1] = 0;
+  }
+}
+
+/* The test signal: two sines, and a little noise, at about -6 dB. */
+static void make_signal(sox_sample_t * samples, size_t count)
+{
+  uint32_t random = 0x9E3779B9u;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    double value = 0.35 * sin(i * 0.0627) + 0.1 * sin(i * 0.00931);
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    value += ((int32_t)random / 2147483648.0) * 0.05;
+    samples[i] = (sox_sample_t)(value * SOX_SAMPLE_MAX);
+  }
+}
+
+int main(void)
+{
+  bench_t bench;
+  size_t i;
+
+  memset(&bench, 0, sizeof(bench));
+  bench.native = (unsigned char *)malloc(BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t));
+  bench.work = (unsigned char *)malloc(BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t));
+  bench.samples = (sox_sample_t *)malloc(BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t));
+  bench.widened = (sox_sample_t *)malloc(BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t));
+  bench.packed = (unsigned char *)malloc(BENCH_MEMORY_SAMPLES * sizeof(sox_sample_t));
+  if (bench.native == NULL || bench.work == NULL || bench.samples == NULL
+      || bench.widened == NULL || bench.packed == NULL)
+  {
+    fprintf(stderr, "Not enough memory\n");
+    return 1;
+  }
+  make_signal(bench.samples, BENCH_MEMORY_SAMPLES);
+  printf("%-12s %-4s %-3s %-7s %-7s %9s %9s  %s\n", "kernel", "fmt", "ch", "version", "run",
+    "GB/s", "cyc/smp", "check");
+  for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+  {
+    bench_native(&bench, &formats[i]);
+  }
+  bench_variants(&bench);
+  bench_find_sound(&bench);
+  printf("%s (%08x)\n", bench.failures ? "Some versions disagree" : "All versions agree",
+    (unsigned)bench.results);
+  free(bench.native);
+  free(bench.work);
+  free(bench.samples);
+  free(bench.widened);
+  free(bench.packed);
+  return bench.failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/* budget.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The memory budget. Any number of jobs can run at once, and between them
+ * the decoders' chunks, the overlapped I/O slots, the fan-out's ring and
+ * the trim chain's scratch could add up to more than the machine (or a 32
+ * bit process) has room for. So each of those asks the budget first, for
+ * what it would like and the least it can work with, and makes do with
+ * what it is given: fewer decode workers, fewer requests in flight, less
+ * scratch kept in memory.
+ *
+ * A job is let in, when it first asks, once there is room for its reserve
+ * (MEMORY_JOB_RESERVE), which covers the least each of its buffers needs;
+ * until then it waits. Past that, it can have whatever nobody else is
+ * using. A job that has been let in never waits again, so jobs can't end
+ * up waiting on each other; and a job on its own is always let in, so the
+ * budget can't stop everything.
+ *
+ */
+
+#include "wt.h"
+
+static SRWLOCK budget_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE budget_released = CONDITION_VARIABLE_INIT;
+static uint64_t budget_used;        /* Each job's reserve, or what it holds if more */
+static uint64_t budget_charged;     /* What all the jobs' buffers hold now... */
+static uint64_t budget_peak;        /* ...and the most they have held at once */
+static unsigned budget_jobs;        /* Jobs let in */
+
+static uint64_t held(budget_account_t const * account)
+{
+  return max(account->charged, (uint64_t)MEMORY_JOB_RESERVE);
+}
+
+/* Called with the lock held, which waiting lets go of. */
+static void admit(budget_account_t * account)
+{
+  while (budget_jobs > 0 && budget_used + MEMORY_JOB_RESERVE > MEMORY_BUDGET)
+  {
+    SleepConditionVariableSRW(&budget_released, &budget_lock, INFINITE, 0);
+  }
+  account->admitted = 1;
+  budget_jobs++;
+  budget_used += held(account);
+}
+
+/* Ask for up to `wanted` bytes for a buffer, and at least `minimum`.
+ * Returns what has been charged to the job, for budget_release() to give
+ * back when the buffer is freed. */
+size_t budget_charge(budget_account_t * account, size_t wanted, size_t minimum)
+{
+  uint64_t available, before;
+  size_t granted;
+
+  if (account == NULL)
+  {
+    return wanted;
+  }
+  AcquireSRWLockExclusive(&budget_lock);
+  if (!account->admitted)
+  {
+    admit(account);
+  }
+  /* What is left of its own reserve, and of the budget. */
+  available = MEMORY_JOB_RESERVE > account->charged ? MEMORY_JOB_RESERVE - account->charged : 0;
+  available += MEMORY_BUDGET > budget_used ? MEMORY_BUDGET - budget_used : 0;
+  granted = (size_t)min((uint64_t)wanted, max(available, (uint64_t)minimum));
+  before = held(account);
+  account->charged += granted;
+  account->high_water = max(account->high_water, account->charged);
+  budget_used += held(account) - before;
+  budget_charged += granted;
+  budget_peak = max(budget_peak, budget_charged);
+  ReleaseSRWLockExclusive(&budget_lock);
+  return granted;
+}
+
+void budget_release(budget_account_t * account, size_t bytes)
+{
+  uint64_t before;
+
+  if (account == NULL || bytes == 0)
+  {
+    return;
+  }
+  AcquireSRWLockExclusive(&budget_lock);
+  before = held(account);
+  account->charged -= bytes;
+  budget_used -= before - held(account);
+  budget_charged -= bytes;
+  ReleaseSRWLockExclusive(&budget_lock);
+  WakeAllConditionVariable(&budget_released);
+}
+
+/* The job is done: give back its reserve, and anything still charged. */
+void budget_close(budget_account_t * account)
+{
+  if (!account->admitted)
+  {
+    return;
+  }
+  AcquireSRWLockExclusive(&budget_lock);
+  budget_used -= held(account);
+  budget_charged -= account->charged;
+  budget_jobs--;
+  account->admitted = 0;
+  account->charged = 0;
+  ReleaseSRWLockExclusive(&budget_lock);
+  WakeAllConditionVariable(&budget_released);
+}
+
+/* The most the jobs' buffers have held at once, since the process began. */
+uint64_t budget_high_water(void)
+{
+  uint64_t peak;
+
+  AcquireSRWLockShared(&budget_lock);
+  peak = budget_peak;
+  ReleaseSRWLockShared(&budget_lock);
+  return peak;
+}
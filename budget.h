@@ -0,0 +1,25 @@
+/* budget.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the memory budget that the
+ * running jobs' larger buffers are charged against.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* One job's side of the budget. NULL for an account means the buffers
+ * aren't charged to anyone, and get all they ask for. */
+typedef struct {
+  int admitted;             /* Whether its reserve has been set aside */
+  uint64_t charged;         /* What its buffers hold now... */
+  uint64_t high_water;      /* ...and the most they have held at once */
+} budget_account_t;
+
+size_t budget_charge(budget_account_t * account, size_t wanted, size_t minimum);
+void budget_release(budget_account_t * account, size_t bytes);
+void budget_close(budget_account_t * account);
+uint64_t budget_high_water(void);
@@ -0,0 +1,29 @@
+/* checksum.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the CRC-32C checksums kept in
+ * the manifest, over the bytes of each track as they sit in the output.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHECKSUM_POLYNOMIAL 0x82f63b78u /* Castagnoli, reflected */
+
+typedef uint32_t (* checksum_kernel_t)(uint32_t crc, unsigned char const * p, size_t count);
+
+/* The ways the checksum can be worked out, each needing the CPU feature
+ * named (or none); for the benchmark. */
+typedef struct {
+  char const * name;
+  char const * feature;     /* As __builtin_cpu_supports() takes it, or NULL */
+  checksum_kernel_t block;  /* Takes and returns the checksum inverted */
+} checksum_variant_t;
+
+extern checksum_variant_t const checksum_variants[]; /* Ending with a NULL name */
+
+uint32_t checksum_bytes(uint32_t crc, void const * bytes, size_t count);
+uint32_t checksum_combine(uint32_t first, uint32_t second, uint64_t second_length);
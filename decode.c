@@ -0,0 +1,254 @@
+/* decode.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Reading the input files. A FLAC (or other compressed) file costs far
+ * more to decode than to write out, so where the format can seek we open
+ * the file once per worker and decode a batch of consecutive chunks at the
+ * same time (OpenMP), each worker seeking to the start of its own chunk.
+ * The chunks are then handed out in order, so the caller sees one stream,
+ * just as from sox_read().
+ *
+ */
+
+#include "wt.h"
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lossless formats we splice; only those this libSoX was built with count. */
+static char const * const input_types[] = {
+  "wav", "flac", "aiff", "aif", "aifc", "w64", "caf", "au", "snd", "wv", NULL
+};
+
+int decoder_accepts(char const * filename)
+{
+  char const * extension = strrchr(filename, '.');
+  size_t i;
+
+  if (extension == NULL)
+  {
+    return 0;
+  }
+  ++extension;
+  for (i = 0; input_types[i] != NULL; ++i)
+  {
+    if (_stricmp(extension, input_types[i]) == 0)
+    {
+      return sox_find_format(input_types[i], sox_true) != NULL;
+    }
+  }
+  return 0;
+}
+
+/* The PCM encoding to write an input's samples with, for inputs (like
+ * FLAC) whose own encoding means nothing to a WAV writer. */
+void decoder_pcm_encoding(sox_encodinginfo_t const * encoding, sox_encodinginfo_t * pcm)
+{
+  *pcm = *encoding;
+  if (encoding->encoding == SOX_ENCODING_SIGN2 || encoding->encoding == SOX_ENCODING_UNSIGNED
+      || encoding->encoding == SOX_ENCODING_FLOAT)
+  {
+    return;
+  }
+  pcm->bits_per_sample = encoding->bits_per_sample == 0 ? 16
+    : (encoding->bits_per_sample + 7) / 8 * 8;
+  pcm->encoding = pcm->bits_per_sample == 8 ? SOX_ENCODING_UNSIGNED : SOX_ENCODING_SIGN2;
+}
+
+/* Whether decoding the file is worth spreading over several handles. */
+static int can_decode_in_parallel(sox_format_t const * format)
+{
+  return format->handler.seek != NULL && format->seekable
+    && format->signal.length >= 2 * DECODE_CHUNK_FRAMES * format->signal.channels
+    && format->encoding.encoding != SOX_ENCODING_SIGN2
+    && format->encoding.encoding != SOX_ENCODING_UNSIGNED
+    && format->encoding.encoding != SOX_ENCODING_FLOAT;
+}
+
+decoder_t * decoder_open(char const * filename, budget_account_t * account)
+{
+  decoder_t * decoder = (decoder_t *)calloc(1, sizeof(decoder_t));
+  size_t chunk_bytes;
+  int i, workers;
+
+  if (decoder == NULL)
+  {
+    return NULL;
+  }
+  decoder->format = decoder->workers[0] = sox_open_read(filename, NULL, NULL, NULL);
+  if (decoder->format == NULL)
+  {
+    free(decoder);
+    return NULL;
+  }
+  decoder->worker_count = 1;
+  workers = min(omp_get_max_threads(), DECODE_MAX_WORKERS);
+  if (workers < 2 || !can_decode_in_parallel(decoder->format))
+  {
+    return decoder;
+  }
+  decoder->chunk_samples = DECODE_CHUNK_FRAMES * decoder->format->signal.channels;
+  /* As many workers as the budget has room for chunks; with less than
+   * two, the file is just read as it is. */
+  chunk_bytes = decoder->chunk_samples * sizeof(sox_sample_t);
+  decoder->account = account;
+  decoder->charged = budget_charge(account, workers * chunk_bytes, 0);
+  workers = (int)(decoder->charged / chunk_bytes);
+  budget_release(account, decoder->charged - workers * chunk_bytes);
+  decoder->charged = workers * chunk_bytes;
+  if (workers >= 2)
+  {
+    decoder->chunks = (sox_sample_t *)malloc(decoder->charged);
+  }
+  if (decoder->chunks == NULL)
+  {
+    budget_release(account, decoder->charged);
+    decoder->charged = 0;
+    return decoder;
+  }
+  /* Fewer handles than hoped for just means fewer workers. */
+  for (i = 1; i < workers; ++i)
+  {
+    decoder->workers[i] = sox_open_read(filename, NULL, NULL, NULL);
+    if (decoder->workers[i] == NULL)
+    {
+      break;
+    }
+  }
+  decoder->worker_count = i;
+  decoder->chunk = decoder->worker_count;  /* No batch decoded yet */
+  return decoder;
+}
+
+/* Decode the next batch: chunk i of it by worker i. */
+static void decode_batch(decoder_t * decoder)
+{
+  uint64_t length = decoder->format->signal.length;
+  int i, failed[DECODE_MAX_WORKERS];
+
+  #pragma omp parallel for num_threads(decoder->worker_count)
+  for (i = 0; i < decoder->worker_count; ++i)
+  {
+    sox_format_t * worker = decoder->workers[i];
+    sox_sample_t * chunk = decoder->chunks + i * decoder->chunk_samples;
+    uint64_t start = decoder->next_sample + (uint64_t)i * decoder->chunk_samples;
+    size_t fill = 0, number_read;
+
+    failed[i] = 0;
+    if (start < length)
+    {
+      if (sox_seek(worker, start, SOX_SEEK_SET) != SOX_SUCCESS)
+      {
+        failed[i] = 1;
+      }
+      else while (fill < decoder->chunk_samples
+          && (number_read = sox_read(worker, chunk + fill, decoder->chunk_samples - fill)))
+      {
+        fill += number_read;
+      }
+      /* Only the chunk that reaches the end may come back short; short of
+       * it, the worker couldn't decode the rest. */
+      if (fill < decoder->chunk_samples && start + fill < length)
+      {
+        failed[i] = 1;
+      }
+    }
+    decoder->chunk_fill[i] = fill;
+  }
+  /* Past a short chunk (the end of the file) nothing else matters. */
+  for (i = 0; i < decoder->worker_count; ++i)
+  {
+    if (failed[i])
+    {
+      decoder->failed = 1;
+      break;
+    }
+    if (decoder->chunk_fill[i] < decoder->chunk_samples)
+    {
+      break;
+    }
+  }
+  decoder->next_sample += (uint64_t)decoder->worker_count * decoder->chunk_samples;
+  decoder->chunk = 0;
+  decoder->cursor = 0;
+}
+
+/* Read up to count interleaved samples, as sox_read() would. */
+size_t decoder_read(decoder_t * decoder, sox_sample_t * samples, size_t count)
+{
+  size_t done = 0;
+
+  if (decoder->worker_count == 1)
+  {
+    return sox_read(decoder->format, samples, count);
+  }
+  while (done < count && !decoder->failed)
+  {
+    size_t available, n;
+
+    if (decoder->chunk == decoder->worker_count)
+    {
+      if (decoder->next_sample >= decoder->format->signal.length)
+      {
+        break;
+      }
+      decode_batch(decoder);
+      continue;
+    }
+    available = decoder->chunk_fill[decoder->chunk] - decoder->cursor;
+    if (available == 0)
+    {
+      /* A short chunk is the end of the file (decode_batch() has made
+       * sure of that). */
+      if (decoder->chunk_fill[decoder->chunk] < decoder->chunk_samples)
+      {
+        decoder->next_sample = decoder->format->signal.length;
+        decoder->chunk = decoder->worker_count;
+        break;
+      }
+      decoder->chunk++;
+      decoder->cursor = 0;
+      continue;
+    }
+    n = min(available, count - done);
+    memcpy(samples + done, decoder->chunks + decoder->chunk * decoder->chunk_samples
+      + decoder->cursor, n * sizeof(sox_sample_t));
+    decoder->cursor += n;
+    done += n;
+  }
+  return done;
+}
+
+/* Go to an interleaved sample offset (a whole frame), as sox_seek() would. */
+int decoder_seek(decoder_t * decoder, uint64_t offset)
+{
+  if (decoder->worker_count == 1)
+  {
+    return sox_seek(decoder->format, offset, SOX_SEEK_SET);
+  }
+  decoder->next_sample = offset;
+  decoder->chunk = decoder->worker_count;
+  return SOX_SUCCESS;
+}
+
+int decoder_close(decoder_t * decoder)
+{
+  int i, result = SOX_SUCCESS;
+
+  if (decoder == NULL)
+  {
+    return SOX_SUCCESS;
+  }
+  for (i = 0; i < decoder->worker_count; ++i)
+  {
+    if (sox_close(decoder->workers[i]) != SOX_SUCCESS)
+    {
+      result = SOX_EOF;
+    }
+  }
+  free(decoder->chunks);
+  budget_release(decoder->account, decoder->charged);
+  free(decoder);
+  return result;
+}
@@ -0,0 +1,41 @@
+/* decode.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for reading the input files, which
+ * may be in any of the lossless formats libSoX knows, not just WAV.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+#include "budget.h"
+
+#define DECODE_MAX_WORKERS 8
+#define DECODE_CHUNK_FRAMES ((size_t)64 * 4096) /* Per worker, a whole number of FLAC blocks */
+
+/* An open input. Compressed files that can seek are decoded a batch at a
+ * time, each worker taking the next chunk of the batch from its own
+ * handle; anything else is read straight through `format`. */
+typedef struct {
+  sox_format_t * format;                         /* Describes the file (also worker 0) */
+  sox_format_t * workers[DECODE_MAX_WORKERS];
+  int worker_count;
+  sox_sample_t * chunks;                         /* worker_count chunks of chunk_samples */
+  size_t chunk_samples;
+  size_t chunk_fill[DECODE_MAX_WORKERS];
+  int chunk;                                     /* The chunk being handed out... */
+  size_t cursor;                                 /* ...and how far into it */
+  uint64_t next_sample;                          /* Where the next batch starts */
+  int failed;                                    /* A worker couldn't seek */
+  budget_account_t * account;                    /* What the chunks are charged to... */
+  size_t charged;                                /* ...and how much */
+} decoder_t;
+
+int decoder_accepts(char const * filename);
+void decoder_pcm_encoding(sox_encodinginfo_t const * encoding, sox_encodinginfo_t * pcm);
+decoder_t * decoder_open(char const * filename, budget_account_t * account);
+size_t decoder_read(decoder_t * decoder, sox_sample_t * samples, size_t count);
+int decoder_seek(decoder_t * decoder, uint64_t offset);
+int decoder_close(decoder_t * decoder);
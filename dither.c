@@ -0,0 +1,290 @@
+/* dither.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Reducing libSoX samples to 16-bit output. Rather than rounding (and so
+ * turning the lost bits into distortion that follows the signal), we add
+ * triangular (TPDF) dither first, which leaves a steady, signal-free hiss
+ * at -96 dB instead. Shaped dither feeds the error back through the 44.1
+ * kHz filter of Lipshitz et al. (as in SoX's "dither -s"), which moves most
+ * of that hiss up to where the ear is least sensitive.
+ *
+ * The random numbers come from eight xorshift generators side by side, one
+ * per vector lane, so that TPDF dither and the saturating pack down to 16
+ * bits run eight samples at a time. The vector and scalar versions give
+ * exactly the same output. Shaped dither depends on the error of the
+ * sample before, so it is done one sample at a time.
+ *
+ */
+
+#include "wt.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#define DITHER_CHUNK 1024   /* Samples dithered at a time by dither_apply() */
+
+static dither_kernel_t tpdf_block;
+
+static double const shape_coefficients[DITHER_SHAPE_TAPS] = {
+  2.033, -2.165, 1.959, -1.590, 0.6149
+};
+
+static uint32_t next_random(uint32_t * state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/* Two uniform 16-bit numbers from one draw; their difference is triangular,
+ * within one 16-bit LSB (65536) either way. */
+static int32_t tpdf_noise(uint32_t random)
+{
+  return (int32_t)(random >> 16) - (int32_t)(random & 0xffff);
+}
+
+/* Round (sample + noise) to 16 bits. Halving both first keeps the sum in
+ * range; with no noise it rounds just as SOX_SAMPLE_TO_SIGNED_16BIT does. */
+static int16_t quantize(sox_sample_t sample, int32_t noise)
+{
+  int32_t value = ((sample >> 1) + (noise >> 1) + 0x4000) >> 15;
+
+  return (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+}
+
+static void store16(unsigned char * dest, int16_t value)
+{
+  dest[0] = value & 0xff;
+  dest[1] = (value >> 8) & 0xff;
+}
+
+static size_t tpdf_scalar(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    int32_t noise = 0;
+
+    if (dither->mode != DITHER_NONE)
+    {
+      noise = tpdf_noise(next_random(&dither->lanes[dither->lane]));
+    }
+    dither->lane = (dither->lane + 1) % DITHER_LANES;
+    store16(dest + 2 * i, quantize(samples[i], noise));
+  }
+  return count;
+}
+
+/* The vector versions do whole groups of eight, starting at lane 0, and
+ * leave the rest to tpdf_scalar(). */
+static size_t tpdf_none(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  return 0;
+}
+
+__attribute__((target("sse2")))
+static __m128i xorshift_sse2(__m128i x)
+{
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+__attribute__((target("sse2")))
+static __m128i quantize_sse2(__m128i samples, __m128i random, __m128i keep)
+{
+  __m128i noise = _mm_and_si128(keep, _mm_sub_epi32(_mm_srli_epi32(random, 16),
+    _mm_and_si128(random, _mm_set1_epi32(0xffff))));
+  __m128i sum = _mm_add_epi32(_mm_srai_epi32(samples, 1), _mm_srai_epi32(noise, 1));
+
+  return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(0x4000)), 15);
+}
+
+__attribute__((target("sse2")))
+static size_t tpdf_sse2(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  __m128i low = _mm_loadu_si128((__m128i const *)dither->lanes);
+  __m128i high = _mm_loadu_si128((__m128i const *)(dither->lanes + 4));
+  __m128i keep = _mm_set1_epi32(dither->mode == DITHER_NONE ? 0 : -1);
+  size_t i;
+
+  for (i = 0; i + 8 <= count; i += 8)
+  {
+    __m128i first, second;
+
+    low = xorshift_sse2(low);
+    high = xorshift_sse2(high);
+    first = quantize_sse2(_mm_loadu_si128((__m128i const *)(samples + i)), low, keep);
+    second = quantize_sse2(_mm_loadu_si128((__m128i const *)(samples + i + 4)), high, keep);
+    _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_packs_epi32(first, second));
+  }
+  _mm_storeu_si128((__m128i *)dither->lanes, low);
+  _mm_storeu_si128((__m128i *)(dither->lanes + 4), high);
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t tpdf_avx2(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  __m256i lanes = _mm256_loadu_si256((__m256i const *)dither->lanes);
+  __m256i keep = _mm256_set1_epi32(dither->mode == DITHER_NONE ? 0 : -1);
+  __m256i mask = _mm256_set1_epi32(0xffff);
+  __m256i round = _mm256_set1_epi32(0x4000);
+  size_t i;
+
+  for (i = 0; i + 8 <= count; i += 8)
+  {
+    __m256i noise, value;
+
+    lanes = _mm256_xor_si256(lanes, _mm256_slli_epi32(lanes, 13));
+    lanes = _mm256_xor_si256(lanes, _mm256_srli_epi32(lanes, 17));
+    lanes = _mm256_xor_si256(lanes, _mm256_slli_epi32(lanes, 5));
+    noise = _mm256_and_si256(keep, _mm256_sub_epi32(_mm256_srli_epi32(lanes, 16),
+      _mm256_and_si256(lanes, mask)));
+    value = _mm256_add_epi32(
+      _mm256_srai_epi32(_mm256_loadu_si256((__m256i const *)(samples + i)), 1),
+      _mm256_srai_epi32(noise, 1));
+    value = _mm256_srai_epi32(_mm256_add_epi32(value, round), 15);
+    _mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_packs_epi32(
+      _mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1)));
+  }
+  _mm256_storeu_si256((__m256i *)dither->lanes, lanes);
+  return i;
+}
+
+dither_variant_t const dither_variants[] = {
+  { "scalar", NULL, tpdf_scalar },
+  { "sse2", "sse2", tpdf_sse2 },
+  { "avx2", "avx2", tpdf_avx2 },
+  { NULL, NULL, NULL }
+};
+
+static dither_kernel_t choose_kernel(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return tpdf_avx2;
+  }
+  if (__builtin_cpu_supports("sse2"))
+  {
+    return tpdf_sse2;
+  }
+  return tpdf_none;
+}
+
+static void shaped_block(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  size_t i;
+  unsigned k;
+
+  for (i = 0; i < count; ++i)
+  {
+    float * errors = dither->errors[dither->channel];
+    double shaped = samples[i] / 65536.0, value;
+
+    for (k = 0; k < DITHER_SHAPE_TAPS; ++k)
+    {
+      shaped -= shape_coefficients[k] * errors[k];
+    }
+    value = floor(shaped + tpdf_noise(next_random(&dither->lanes[dither->lane])) / 65536.0
+      + 0.5);
+    dither->lane = (dither->lane + 1) % DITHER_LANES;
+    memmove(errors + 1, errors, (DITHER_SHAPE_TAPS - 1) * sizeof(float));
+    errors[0] = (float)(value - shaped);
+    store16(dest + 2 * i, (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : value));
+    if (++dither->channel == dither->channels)
+    {
+      dither->channel = 0;
+    }
+  }
+}
+
+/* Shaping only suits the rates its filter was designed for; elsewhere it
+ * would put the noise in the wrong place, so plain TPDF is used instead. */
+dither_t * dither_create(dither_mode_t mode, unsigned channels, sox_rate_t rate)
+{
+  dither_t * dither;
+  unsigned i;
+
+  if (channels == 0 || channels > DITHER_MAX_CHANNELS)
+  {
+    return NULL;
+  }
+  dither = (dither_t *)calloc(1, sizeof(dither_t));
+  if (dither == NULL)
+  {
+    return NULL;
+  }
+  if (mode == DITHER_SHAPED && rate != 44100 && rate != 48000)
+  {
+    mode = DITHER_TPDF;
+  }
+  dither->mode = mode;
+  dither->channels = channels;
+  for (i = 0; i < DITHER_LANES; ++i)
+  {
+    dither->lanes[i] = 0x9E3779B9u * (i + 1);
+  }
+  if (tpdf_block == NULL)
+  {
+    tpdf_block = choose_kernel();
+  }
+  return dither;
+}
+
+/* Dither count interleaved samples down to 16-bit little-endian PCM.
+ * Returns the number of bytes stored. */
+size_t dither_pack16(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest)
+{
+  size_t head, done;
+
+  if (dither->mode == DITHER_SHAPED)
+  {
+    shaped_block(dither, samples, count, dest);
+    return count * 2;
+  }
+  /* Bring the generators round to lane 0 for the vector version. */
+  head = min(count, (size_t)((DITHER_LANES - dither->lane) % DITHER_LANES));
+  tpdf_scalar(dither, samples, head, dest);
+  done = head + tpdf_block(dither, samples + head, count - head, dest + 2 * head);
+  tpdf_scalar(dither, samples + done, count - done, dest + 2 * done);
+  return count * 2;
+}
+
+/* Dither in place, leaving samples that a 16-bit writer (libSoX's, or the
+ * FLAC encoder) stores exactly. */
+void dither_apply(dither_t * dither, sox_sample_t * samples, size_t count)
+{
+  unsigned char packed[DITHER_CHUNK * 2];
+  size_t done, n, i;
+
+  for (done = 0; done < count; done += n)
+  {
+    n = min(count - done, (size_t)DITHER_CHUNK);
+    dither_pack16(dither, samples + done, n, packed);
+    for (i = 0; i < n; ++i)
+    {
+      int16_t value = (int16_t)(packed[2 * i] | (packed[2 * i + 1] << 8));
+      samples[done + i] = (sox_sample_t)((uint32_t)(int32_t)value << 16);
+    }
+  }
+}
+
+void dither_free(dither_t * dither)
+{
+  free(dither);
+}
@@ -0,0 +1,52 @@
+/* dither.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the dither stage, which reduces
+ * libSoX samples to 16 bits for the output.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+
+#define DITHER_LANES 8            /* Independent random number generators */
+#define DITHER_MAX_CHANNELS 16
+#define DITHER_SHAPE_TAPS 5
+
+typedef enum {
+  DITHER_NONE,                    /* Plain rounding, as libSoX would */
+  DITHER_TPDF,                    /* Triangular dither, +/- 1 LSB */
+  DITHER_SHAPED                   /* TPDF, with the noise shaped away from where we hear best */
+} dither_mode_t;
+
+typedef struct {
+  dither_mode_t mode;
+  unsigned channels;
+  unsigned channel;               /* Channel of the next sample */
+  unsigned lane;                  /* Generator for the next sample */
+  uint32_t lanes[DITHER_LANES];
+  float errors[DITHER_MAX_CHANNELS][DITHER_SHAPE_TAPS]; /* Shaped only: past errors */
+} dither_t;
+
+typedef size_t (* dither_kernel_t)(dither_t * dither, sox_sample_t const * samples,
+  size_t count, unsigned char * dest);
+
+/* The ways TPDF dither can be done, each needing the CPU feature named (or
+ * none); for the benchmark. Each starts with the generators at lane 0, and
+ * returns how many samples it did: the vector ones only whole vectors. All
+ * give the same output. */
+typedef struct {
+  char const * name;
+  char const * feature;     /* As __builtin_cpu_supports() takes it, or NULL */
+  dither_kernel_t block;
+} dither_variant_t;
+
+extern dither_variant_t const dither_variants[]; /* Ending with a NULL name */
+
+dither_t * dither_create(dither_mode_t mode, unsigned channels, sox_rate_t rate);
+size_t dither_pack16(dither_t * dither, sox_sample_t const * samples, size_t count,
+  unsigned char * dest);
+void dither_apply(dither_t * dither, sox_sample_t * samples, size_t count);
+void dither_free(dither_t * dither);
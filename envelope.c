@@ -0,0 +1,248 @@
+/* envelope.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The silence envelope (e.g. 01-intro.wav.envelope). Reading a file once
+ * gives the peak level of every 64 frames; after that, the trim points for
+ * any threshold and duration come from the envelope without decoding the
+ * audio again. The envelope is kept next to the file, along with the file's
+ * size and modification time, so an edited file is scanned afresh.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+static void envelope_path(char const * filename, char * path, size_t path_size)
+{
+  StringCbPrintfA(path, path_size, "%s%s", filename, ENVELOPE_SUFFIX);
+}
+
+/* Read a cached envelope, if there is one and it still matches the file. */
+static int envelope_read(char const * filename, uint64_t file_size, uint64_t file_time,
+  envelope_t * envelope)
+{
+  char path[MAX_PATH];
+  envelope_header_t * header = &envelope->header;
+  FILE * file;
+  int result = SOX_EOF;
+
+  envelope_path(filename, path, sizeof(path));
+  file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (fread(header, sizeof(*header), 1, file) == 1
+      && memcmp(header->magic, ENVELOPE_MAGIC, sizeof(header->magic)) == 0
+      && header->file_size == file_size
+      && header->file_time == file_time
+      && header->block_frames == ENVELOPE_BLOCK_FRAMES
+      && header->channels > 0
+      && header->block_count == (header->frames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES
+      && header->block_count <= SIZE_MAX / sizeof(uint16_t))
+  {
+    envelope->peaks = (uint16_t *)malloc((size_t)header->block_count * sizeof(uint16_t) + 1);
+    if (envelope->peaks != NULL
+        && fread(envelope->peaks, sizeof(uint16_t), (size_t)header->block_count, file)
+             == header->block_count)
+    {
+      result = SOX_SUCCESS;
+    } else {
+      free(envelope->peaks);
+      envelope->peaks = NULL;
+    }
+  }
+  fclose(file);
+  return result;
+}
+
+/* Decode the file and take the peak level of each block, and the hash of
+ * the samples that the result store knows the file by. */
+static int envelope_scan(char const * filename, sox_sample_t * buffer, size_t buffer_samples,
+  envelope_t * envelope)
+{
+  envelope_header_t * header = &envelope->header;
+  sox_format_t * input;
+  uint64_t allocated = 0, samples_read = 0;
+  size_t number_read, i, block_samples;
+  unsigned peak = 0;
+  int result = SOX_SUCCESS;
+
+  input = sox_open_read(filename, NULL, NULL, NULL);
+  if (input == NULL)
+  {
+    return SOX_EOF;
+  }
+  header->channels = input->signal.channels;
+  header->rate = input->signal.rate;
+  block_samples = ENVELOPE_BLOCK_FRAMES * header->channels;
+  header->fingerprint = FINGERPRINT_SEED;
+  while (result == SOX_SUCCESS && (number_read = sox_read(input, buffer, buffer_samples)))
+  {
+    header->fingerprint = fingerprint_samples(header->fingerprint, buffer, number_read);
+    for (i = 0; i < number_read; ++i)
+    {
+      sox_sample_t sample = buffer[i];
+      unsigned level = (unsigned)(sample < 0 ? -(sample >> 16) : sample >> 16);
+      if (level > peak) peak = level;
+      if (++samples_read % block_samples == 0)
+      {
+        if (header->block_count == allocated)
+        {
+          uint64_t grown = allocated ? allocated * 2 : 4096;
+          uint16_t * peaks = (uint16_t *)realloc(envelope->peaks,
+            (size_t)grown * sizeof(uint16_t));
+          if (peaks == NULL)
+          {
+            result = SOX_EOF;
+            break;
+          }
+          envelope->peaks = peaks;
+          allocated = grown;
+        }
+        envelope->peaks[header->block_count++] = (uint16_t)peak;
+        peak = 0;
+      }
+    }
+  }
+  sox_close(input);
+  if (result == SOX_SUCCESS && samples_read % block_samples != 0)
+  {
+    /* The last, partial, block. */
+    uint16_t * peaks = (uint16_t *)realloc(envelope->peaks,
+      (size_t)(header->block_count + 1) * sizeof(uint16_t));
+    if (peaks == NULL)
+    {
+      result = SOX_EOF;
+    } else {
+      envelope->peaks = peaks;
+      envelope->peaks[header->block_count++] = (uint16_t)peak;
+    }
+  }
+  header->frames = samples_read / header->channels;
+  return result;
+}
+
+int envelope_write(char const * filename, envelope_t const * envelope)
+{
+  char path[MAX_PATH];
+  FILE * file;
+  int result = SOX_SUCCESS;
+
+  envelope_path(filename, path, sizeof(path));
+  file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (fwrite(&envelope->header, sizeof(envelope->header), 1, file) != 1
+      || fwrite(envelope->peaks, sizeof(uint16_t), (size_t)envelope->header.block_count, file)
+           != envelope->header.block_count)
+  {
+    result = SOX_EOF;
+  }
+  if (fclose(file) != 0 || result != SOX_SUCCESS)
+  {
+    DeleteFileA(path);
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* The envelope of a file: from the cache if it is up to date, otherwise
+ * by reading the file (with the caller's buffer) and caching the result. */
+int envelope_get(char const * filename, sox_sample_t * buffer, size_t buffer_samples,
+  envelope_t * envelope)
+{
+  uint64_t file_size, file_time;
+
+  memset(envelope, 0, sizeof(*envelope));
+  if (manifest_stat(filename, &file_size, &file_time) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  if (envelope_read(filename, file_size, file_time, envelope) == SOX_SUCCESS)
+  {
+    return SOX_SUCCESS;
+  }
+  memset(envelope, 0, sizeof(*envelope));
+  memcpy(envelope->header.magic, ENVELOPE_MAGIC, sizeof(envelope->header.magic));
+  envelope->header.block_frames = ENVELOPE_BLOCK_FRAMES;
+  envelope->header.file_size = file_size;
+  envelope->header.file_time = file_time;
+  if (envelope_scan(filename, buffer, buffer_samples, envelope) != SOX_SUCCESS)
+  {
+    envelope_free(envelope);
+    return SOX_EOF;
+  }
+  envelope_write(filename, envelope); /* Only a cache; no harm if this fails */
+  return SOX_SUCCESS;
+}
+
+/* Where the sound starts and ends, as the silence effect (with one period
+ * above threshold) would find it from either end: the first and last runs
+ * of at least min_frames above the threshold (a fraction of full scale).
+ * If there are none, start == end. */
+void envelope_find_sound(envelope_t const * envelope, double threshold, uint64_t min_frames,
+  uint64_t * start, uint64_t * end)
+{
+  uint64_t blocks = envelope->header.block_count;
+  uint64_t needed = (min_frames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES;
+  uint64_t i, run = 0;
+  double level = threshold * 32768;
+
+  if (needed == 0)
+  {
+    needed = 1;
+  }
+  *start = *end = envelope->header.frames;
+  for (i = 0; i < blocks; ++i)
+  {
+    run = envelope->peaks[i] > level ? run + 1 : 0;
+    if (run == needed)
+    {
+      *start = (i + 1 - needed) * ENVELOPE_BLOCK_FRAMES;
+      break;
+    }
+  }
+  if (i == blocks)
+  {
+    return;
+  }
+  run = 0;
+  for (i = blocks; i-- > 0; )
+  {
+    run = envelope->peaks[i] > level ? run + 1 : 0;
+    if (run == needed)
+    {
+      *end = min((i + needed) * ENVELOPE_BLOCK_FRAMES, envelope->header.frames);
+      break;
+    }
+  }
+}
+
+/* Cut the envelope down to match a file trimmed to the given frames
+ * (start being on a block boundary, as envelope_find_sound() gives), whose
+ * samples hash to fingerprint. */
+void envelope_crop(envelope_t * envelope, uint64_t start, uint64_t end, uint64_t fingerprint)
+{
+  uint64_t first = start / ENVELOPE_BLOCK_FRAMES;
+
+  envelope->header.fingerprint = fingerprint;
+
+  envelope->header.frames = end - start;
+  envelope->header.block_count = (envelope->header.frames + ENVELOPE_BLOCK_FRAMES - 1)
+    / ENVELOPE_BLOCK_FRAMES;
+  memmove(envelope->peaks, envelope->peaks + first,
+    (size_t)envelope->header.block_count * sizeof(uint16_t));
+}
+
+void envelope_free(envelope_t * envelope)
+{
+  free(envelope->peaks);
+  envelope->peaks = NULL;
+}
@@ -0,0 +1,42 @@
+/* envelope.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the silence envelope, a cached
+ * block-by-block peak level of an input file, used to find trim points.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+
+#define ENVELOPE_SUFFIX ".envelope"
+#define ENVELOPE_MAGIC "SPLENV02"
+#define ENVELOPE_BLOCK_FRAMES 64  /* About 1.5 ms at 44.1 kHz */
+
+typedef struct {
+  char magic[8];
+  uint32_t channels;
+  uint32_t block_frames;
+  double rate;
+  uint64_t frames;
+  uint64_t file_size;       /* Size and modification time of the audio file */
+  uint64_t file_time;       /* when the envelope was taken */
+  uint64_t block_count;
+  uint64_t fingerprint;     /* Hash of all the samples, as fingerprint_samples() */
+} envelope_header_t;
+
+/* The loudest sample (on any channel) in each block, as a 16-bit level. */
+typedef struct {
+  envelope_header_t header;
+  uint16_t * peaks;
+} envelope_t;
+
+int envelope_get(char const * filename, sox_sample_t * buffer, size_t buffer_samples,
+  envelope_t * envelope);
+int envelope_write(char const * filename, envelope_t const * envelope);
+void envelope_find_sound(envelope_t const * envelope, double threshold, uint64_t min_frames,
+  uint64_t * start, uint64_t * end);
+void envelope_crop(envelope_t * envelope, uint64_t start, uint64_t end, uint64_t fingerprint);
+void envelope_free(envelope_t * envelope);
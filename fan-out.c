@@ -0,0 +1,405 @@
+/* fan-out.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Writing several deliverables from one decode. The splice thread decodes
+ * each input into a ring of FANOUT_DEPTH blocks; every sink has a thread
+ * of its own, which takes the blocks in order through a libSoX effects
+ * chain (our input effect, "rate" if the sink's rate differs, then our
+ * output effect, which dithers and writes). A block is reused once the
+ * slowest sink is done with it, so the decoder runs as fast as the slowest
+ * sink, and no input is read more than once however many outputs there
+ * are.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+/* Copy up to `wanted` samples from the ring, waiting for them as needed.
+ * Short only at the end of the input (or if it failed). */
+static size_t sink_take(fanout_sink_t * sink, sox_sample_t * dest, size_t wanted)
+{
+  fanout_t * fanout = sink->fanout;
+  size_t taken = 0;
+
+  EnterCriticalSection(&fanout->lock);
+  while (taken < wanted)
+  {
+    size_t slot, n;
+
+    while (sink->taken == fanout->produced && !fanout->finished && !fanout->failed)
+    {
+      SleepConditionVariableCS(&fanout->filled, &fanout->lock, INFINITE);
+    }
+    if (sink->taken == fanout->produced || fanout->failed)
+    {
+      break;
+    }
+    slot = (size_t)(sink->taken % FANOUT_DEPTH);
+    n = min(wanted - taken, fanout->counts[slot] - sink->cursor);
+    /* The block stays put until we say we are done with it. */
+    LeaveCriticalSection(&fanout->lock);
+    memcpy(dest + taken, fanout->blocks + slot * FANOUT_BLOCK_SAMPLES + sink->cursor,
+      n * sizeof(sox_sample_t));
+    EnterCriticalSection(&fanout->lock);
+    taken += n;
+    sink->cursor += n;
+    if (sink->cursor == fanout->counts[slot])
+    {
+      sink->cursor = 0;
+      sink->taken++;
+      WakeAllConditionVariable(&fanout->emptied);
+    }
+  }
+  LeaveCriticalSection(&fanout->lock);
+  return taken;
+}
+
+/* The effects are given their sink as the input effect is given its file. */
+static int sink_getopts(sox_effect_t * effp, int argc, char * argv[])
+{
+  if (argc != 2)
+  {
+    return SOX_EOF;
+  }
+  *(fanout_sink_t **)effp->priv = (fanout_sink_t *)argv[1];
+  return SOX_SUCCESS;
+}
+
+static int fanin_drain(sox_effect_t * effp, sox_sample_t * obuf, size_t * osamp)
+{
+  fanout_sink_t * sink = *(fanout_sink_t **)effp->priv;
+  unsigned channels = effp->out_signal.channels;
+
+  *osamp = sink_take(sink, obuf, *osamp - *osamp % channels);
+  /* (A stray part frame at the very end is dropped.) */
+  *osamp -= *osamp % channels;
+  return *osamp > 0 ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int sink_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * obuf,
+  size_t * isamp, size_t * osamp)
+{
+  fanout_sink_t * sink = *(fanout_sink_t **)effp->priv;
+  size_t count = *isamp;
+  int result = SOX_SUCCESS;
+
+  *osamp = 0;
+  if (count == 0)
+  {
+    return SOX_SUCCESS;
+  }
+  if (sink->dither != NULL)
+  {
+    /* obuf is as big as any ibuf, and we never output anything. */
+    memcpy(obuf, ibuf, count * sizeof(sox_sample_t));
+    dither_apply(sink->dither, obuf, count);
+    ibuf = obuf;
+  }
+  if (sink->encoder != NULL)
+  {
+    result = flac_write(sink->encoder, ibuf, count);
+  }
+  else if (sox_write(sink->out, ibuf, count) != count)
+  {
+    result = SOX_EOF;
+  }
+  if (result != SOX_SUCCESS)
+  {
+    sink->failed = 1;
+  }
+  return result;
+}
+
+static sox_effect_handler_t const fanin_handler = {
+  "fanin", NULL, SOX_EFF_MCHAN, sink_getopts, NULL, NULL, fanin_drain, NULL, NULL,
+  sizeof(fanout_sink_t *)
+};
+
+static sox_effect_handler_t const sink_handler = {
+  "fanout", NULL, SOX_EFF_MCHAN, sink_getopts, NULL, sink_flow, NULL, NULL, NULL,
+  sizeof(fanout_sink_t *)
+};
+
+static int add_effect(sox_effects_chain_t * chain, sox_effect_handler_t const * handler,
+  fanout_sink_t * sink, sox_signalinfo_t * signal, sox_signalinfo_t const * out_signal)
+{
+  sox_effect_t * e;
+  char * args[1];
+  int result;
+
+  if (handler == NULL || (e = sox_create_effect(handler)) == NULL)
+  {
+    return SOX_EOF;
+  }
+  /* Options are always given, even none: that is where an effect such as
+   * rate sets itself up. */
+  args[0] = (char *)sink;
+  result = sox_effect_options(e, sink == NULL ? 0 : 1, args);
+  if (result == SOX_SUCCESS)
+  {
+    result = sox_add_effect(chain, e, signal, out_signal);
+  }
+  free(e);
+  return result;
+}
+
+static int sink_open(fanout_sink_t * sink)
+{
+  if (sink->encoding.bits_per_sample == 16 && sink->fanout->encoding.bits_per_sample > 16)
+  {
+    sink->dither = dither_create(DEFAULT_DITHER, sink->signal.channels, sink->signal.rate);
+  }
+  if (sink->flac)
+  {
+    sink->encoder = flac_open(sink->path, (unsigned)sink->signal.rate, sink->signal.channels,
+      sink->encoding.bits_per_sample, 0);
+    return sink->encoder == NULL ? SOX_EOF : SOX_SUCCESS;
+  }
+  sink->out = sox_open_write(sink->path, &sink->signal, &sink->encoding, NULL, NULL, NULL);
+  return sink->out == NULL ? SOX_EOF : SOX_SUCCESS;
+}
+
+/* One sink's thread: run its chain until the input runs out. */
+static DWORD WINAPI sink_thread(LPVOID parameter)
+{
+  fanout_sink_t * sink = (fanout_sink_t *)parameter;
+  fanout_t * fanout = sink->fanout;
+  sox_effects_chain_t * chain = NULL;
+  sox_signalinfo_t signal = fanout->signal;
+
+  if (sink_open(sink) != SOX_SUCCESS
+      || (chain = sox_create_effects_chain(&fanout->encoding, &sink->encoding)) == NULL
+      || add_effect(chain, &fanin_handler, sink, &signal, &signal) != SOX_SUCCESS
+      || (signal.rate != sink->signal.rate
+          && add_effect(chain, sox_find_effect("rate"), NULL, &signal, &sink->signal)
+               != SOX_SUCCESS)
+      || add_effect(chain, &sink_handler, sink, &signal, &signal) != SOX_SUCCESS)
+  {
+    sink->failed = 1;
+  } else {
+    sox_flow_effects(chain, NULL, NULL);
+  }
+  if (chain != NULL)
+  {
+    sox_delete_effects_chain(chain);
+  }
+  if (sink->encoder != NULL && flac_close(sink->encoder) != SOX_SUCCESS)
+  {
+    sink->failed = 1;
+  }
+  if (sink->out != NULL && sox_close(sink->out) != SOX_SUCCESS)
+  {
+    sink->failed = 1;
+  }
+  sink->encoder = NULL;
+  sink->out = NULL;
+  EnterCriticalSection(&fanout->lock);
+  if (fanout->failed || !fanout->finished || sink->taken != fanout->produced)
+  {
+    /* Stopped short, one way or another. */
+    sink->failed = 1;
+  }
+  sink->done = 1;
+  WakeAllConditionVariable(&fanout->emptied);
+  LeaveCriticalSection(&fanout->lock);
+  if (sink->failed)
+  {
+    DeleteFileA(sink->path);
+  }
+  return 0;
+}
+
+/* A fan-out for samples of this signal, decoded from this encoding. */
+fanout_t * fanout_create(sox_signalinfo_t const * signal, sox_encodinginfo_t const * encoding)
+{
+  fanout_t * fanout = (fanout_t *)calloc(1, sizeof(fanout_t));
+
+  if (fanout == NULL)
+  {
+    return NULL;
+  }
+  fanout->blocks = (sox_sample_t *)malloc(FANOUT_DEPTH * FANOUT_BLOCK_SAMPLES
+    * sizeof(sox_sample_t));
+  if (fanout->blocks == NULL)
+  {
+    free(fanout);
+    return NULL;
+  }
+  fanout->signal = *signal;
+  fanout->encoding = *encoding;
+  InitializeCriticalSection(&fanout->lock);
+  InitializeConditionVariable(&fanout->filled);
+  InitializeConditionVariable(&fanout->emptied);
+  return fanout;
+}
+
+/*
+ * Add an output, before fanout_start()
+ *
+ * A rate of 0 keeps the input's; so do bits_per_sample of 0, except that
+ * FLAC goes up to 24 bits, as in splice_flac(). Reducing to 16 bits is
+ * dithered.
+ */
+int fanout_add_sink(fanout_t * fanout, char const * path, int flac, sox_rate_t rate,
+  unsigned bits_per_sample)
+{
+  fanout_sink_t * sink;
+  unsigned bits;
+
+  if (fanout->sink_count == FANOUT_MAX_SINKS)
+  {
+    return SOX_EOF;
+  }
+  sink = &fanout->sinks[fanout->sink_count];
+  memset(sink, 0, sizeof(*sink));
+  if (FAILED(StringCbCopyA(sink->path, sizeof(sink->path), path)))
+  {
+    return SOX_EOF;
+  }
+  sink->fanout = fanout;
+  sink->flac = flac;
+  sink->signal = fanout->signal;
+  sink->signal.length = 0;
+  sink->encoding = fanout->encoding;
+  if (rate != 0)
+  {
+    sink->signal.rate = rate;
+  }
+  bits = bits_per_sample != 0 ? bits_per_sample : fanout->encoding.bits_per_sample;
+  if (flac)
+  {
+    bits = bits <= 8 ? 8 : bits <= 16 ? 16 : 24;
+  }
+  if (bits != sink->encoding.bits_per_sample)
+  {
+    sink->encoding.encoding = bits == 8 ? SOX_ENCODING_UNSIGNED : SOX_ENCODING_SIGN2;
+    sink->encoding.bits_per_sample = bits;
+    sink->signal.precision = min(sink->signal.precision, bits);
+  }
+  fanout->sink_count++;
+  return SOX_SUCCESS;
+}
+
+/* Start the sinks' threads. */
+int fanout_start(fanout_t * fanout)
+{
+  size_t i;
+
+  for (i = 0; i < fanout->sink_count; ++i)
+  {
+    fanout_sink_t * sink = &fanout->sinks[i];
+
+    sink->thread = CreateThread(NULL, 0, sink_thread, sink, 0, NULL);
+    if (sink->thread == NULL)
+    {
+      sink->failed = sink->done = 1;
+      return SOX_EOF;
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+/* The block to decode into next, once every sink has finished with it; up
+ * to FANOUT_BLOCK_SAMPLES. NULL if every sink has failed. */
+sox_sample_t * fanout_block(fanout_t * fanout)
+{
+  sox_sample_t * block = NULL;
+
+  EnterCriticalSection(&fanout->lock);
+  for (;;)
+  {
+    uint64_t slowest = fanout->produced;
+    int running = 0;
+    size_t i;
+
+    for (i = 0; i < fanout->sink_count; ++i)
+    {
+      if (!fanout->sinks[i].done)
+      {
+        running = 1;
+        slowest = min(slowest, fanout->sinks[i].taken);
+      }
+    }
+    if (!running)
+    {
+      break;
+    }
+    if (fanout->produced - slowest < FANOUT_DEPTH)
+    {
+      block = fanout->blocks + (size_t)(fanout->produced % FANOUT_DEPTH) * FANOUT_BLOCK_SAMPLES;
+      break;
+    }
+    SleepConditionVariableCS(&fanout->emptied, &fanout->lock, INFINITE);
+  }
+  LeaveCriticalSection(&fanout->lock);
+  return block;
+}
+
+/* Hand the block from fanout_block() to the sinks, with count samples in it. */
+void fanout_commit(fanout_t * fanout, size_t count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  EnterCriticalSection(&fanout->lock);
+  fanout->counts[fanout->produced % FANOUT_DEPTH] = count;
+  fanout->produced++;
+  WakeAllConditionVariable(&fanout->filled);
+  LeaveCriticalSection(&fanout->lock);
+}
+
+/* No more input (or, if failed, none that should be written). Waits for
+ * the sinks to finish, and returns SOX_EOF if any output is missing. */
+int fanout_finish(fanout_t * fanout, int failed)
+{
+  size_t i;
+  int result = failed ? SOX_EOF : SOX_SUCCESS;
+
+  EnterCriticalSection(&fanout->lock);
+  fanout->finished = 1;
+  if (failed)
+  {
+    fanout->failed = 1;
+  }
+  WakeAllConditionVariable(&fanout->filled);
+  LeaveCriticalSection(&fanout->lock);
+  for (i = 0; i < fanout->sink_count; ++i)
+  {
+    fanout_sink_t * sink = &fanout->sinks[i];
+
+    if (sink->thread != NULL)
+    {
+      WaitForSingleObject(sink->thread, INFINITE);
+      CloseHandle(sink->thread);
+      sink->thread = NULL;
+    }
+    if (sink->failed)
+    {
+      result = SOX_EOF;
+    }
+  }
+  return result;
+}
+
+/* After fanout_finish(). */
+void fanout_free(fanout_t * fanout)
+{
+  size_t i;
+
+  if (fanout == NULL)
+  {
+    return;
+  }
+  for (i = 0; i < fanout->sink_count; ++i)
+  {
+    dither_free(fanout->sinks[i].dither);
+  }
+  DeleteCriticalSection(&fanout->lock);
+  free(fanout->blocks);
+  free(fanout);
+}
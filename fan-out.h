@@ -0,0 +1,63 @@
+/* fan-out.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the fan-out, which hands one
+ * stream of decoded samples to several outputs, each converting and
+ * writing it on its own thread.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+#include "dither.h"
+#include "flac-encode.h"
+
+#define FANOUT_MAX_SINKS 4
+#define FANOUT_DEPTH 8                          /* Blocks the slowest sink may fall behind */
+#define FANOUT_BLOCK_SAMPLES ((size_t)64 * 1024) /* Per block */
+
+struct fanout_t;
+
+/* One output, with its own conversion: rate, then dither, then encoding. */
+typedef struct {
+  struct fanout_t * fanout;
+  char path[MAX_PATH];
+  int flac;                       /* FLAC rather than WAV */
+  sox_signalinfo_t signal;        /* What is written */
+  sox_encodinginfo_t encoding;
+  dither_t * dither;              /* When reducing to 16 bits */
+  sox_format_t * out;             /* WAV... */
+  flac_encoder_t * encoder;       /* ...or FLAC */
+  HANDLE thread;
+  uint64_t taken;                 /* Blocks finished with */
+  size_t cursor;                  /* Samples taken from the next one */
+  int done;                       /* The thread has stopped taking blocks */
+  int failed;
+} fanout_sink_t;
+
+typedef struct fanout_t {
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE filled;      /* A block has been added (or the input has ended) */
+  CONDITION_VARIABLE emptied;     /* The slowest sink has finished with a block */
+  sox_signalinfo_t signal;        /* The decoded samples */
+  sox_encodinginfo_t encoding;
+  sox_sample_t * blocks;          /* FANOUT_DEPTH blocks, used in turn */
+  size_t counts[FANOUT_DEPTH];
+  uint64_t produced;              /* Blocks added so far */
+  int finished;                   /* No more will be */
+  int failed;                     /* The input failed; sinks should give up */
+  fanout_sink_t sinks[FANOUT_MAX_SINKS];
+  size_t sink_count;
+} fanout_t;
+
+fanout_t * fanout_create(sox_signalinfo_t const * signal, sox_encodinginfo_t const * encoding);
+int fanout_add_sink(fanout_t * fanout, char const * path, int flac, sox_rate_t rate,
+  unsigned bits_per_sample);
+int fanout_start(fanout_t * fanout);
+sox_sample_t * fanout_block(fanout_t * fanout);
+void fanout_commit(fanout_t * fanout, size_t count);
+int fanout_finish(fanout_t * fanout, int failed);
+void fanout_free(fanout_t * fanout);
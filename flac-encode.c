@@ -0,0 +1,811 @@
+/* flac-encode.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * A FLAC writer for spliced output. Samples are gathered into a batch of
+ * frames; the frames of a batch don't depend on each other, so they are
+ * encoded at the same time on all the cores (OpenMP), then written in
+ * order. Each channel of a frame is coded as a constant, verbatim, or with
+ * the best of the fixed predictors and Rice-coded residuals; stereo also
+ * tries left/side, right/side and mid/side. When the stream is done, the
+ * STREAMINFO block (with the MD5 of the audio) and the seek table at the
+ * front of the file are filled in.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FIXED_ORDER 4
+#define MAX_PARTITION_ORDER 8
+
+enum {SUBFRAME_CONSTANT, SUBFRAME_VERBATIM, SUBFRAME_FIXED};
+
+/**
+ * MD5 of the samples, for STREAMINFO
+ *
+ */
+
+static uint32_t const md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static unsigned char const md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_block(uint32_t * state, unsigned char const * p)
+{
+  uint32_t w[16], a = state[0], b = state[1], c = state[2], d = state[3], f, t;
+  unsigned i, g;
+
+  for (i = 0; i < 16; ++i)
+  {
+    w[i] = p[4 * i] | (uint32_t)p[4 * i + 1] << 8 | (uint32_t)p[4 * i + 2] << 16
+      | (uint32_t)p[4 * i + 3] << 24;
+  }
+  for (i = 0; i < 64; ++i)
+  {
+    if (i < 16)
+    {
+      f = (b & c) | (~b & d);
+      g = i;
+    }
+    else if (i < 32)
+    {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    }
+    else if (i < 48)
+    {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    t = d;
+    d = c;
+    c = b;
+    f = a + f + md5_k[i] + w[g];
+    b = b + ((f << md5_r[i]) | (f >> (32 - md5_r[i])));
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+static void md5_init(flac_md5_t * md5)
+{
+  md5->state[0] = 0x67452301;
+  md5->state[1] = 0xefcdab89;
+  md5->state[2] = 0x98badcfe;
+  md5->state[3] = 0x10325476;
+  md5->length = 0;
+}
+
+static void md5_update(flac_md5_t * md5, unsigned char const * data, size_t length)
+{
+  size_t used = (size_t)(md5->length % 64);
+
+  md5->length += length;
+  if (used > 0)
+  {
+    size_t n = min(length, 64 - used);
+    memcpy(md5->buffer + used, data, n);
+    data += n;
+    length -= n;
+    if (used + n < 64)
+    {
+      return;
+    }
+    md5_block(md5->state, md5->buffer);
+  }
+  for (; length >= 64; data += 64, length -= 64)
+  {
+    md5_block(md5->state, data);
+  }
+  memcpy(md5->buffer, data, length);
+}
+
+static void md5_final(flac_md5_t * md5, unsigned char * digest)
+{
+  unsigned char padding[72] = {0x80};
+  uint64_t bits = md5->length * 8;
+  size_t used = (size_t)(md5->length % 64);
+  size_t pad = (used < 56 ? 56 : 120) - used;
+  unsigned i;
+
+  for (i = 0; i < 8; ++i)
+  {
+    padding[pad + i] = (unsigned char)(bits >> (8 * i));
+  }
+  md5_update(md5, padding, pad + 8);
+  for (i = 0; i < 16; ++i)
+  {
+    digest[i] = (unsigned char)(md5->state[i / 4] >> (8 * (i % 4)));
+  }
+}
+
+/* The MD5 is of the samples as little-endian signed integers. */
+static void md5_samples(flac_md5_t * md5, int32_t const * pcm, size_t count, unsigned bytes)
+{
+  unsigned char buffer[1024 * 3];
+  size_t i, j;
+
+  while (count > 0)
+  {
+    size_t n = min(count, (size_t)1024);
+    for (i = j = 0; i < n; ++i)
+    {
+      buffer[j++] = (unsigned char)pcm[i];
+      if (bytes > 1) buffer[j++] = (unsigned char)(pcm[i] >> 8);
+      if (bytes > 2) buffer[j++] = (unsigned char)(pcm[i] >> 16);
+    }
+    md5_update(md5, buffer, j);
+    pcm += n;
+    count -= n;
+  }
+}
+
+/**
+ * Bit writing and CRCs
+ *
+ */
+
+typedef struct {
+  unsigned char * data;
+  size_t bytes;
+  uint64_t accumulator;
+  unsigned bits;            /* Not yet written out */
+} bit_writer_t;
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+
+static void make_crc_tables(void)
+{
+  unsigned i, bit;
+
+  for (i = 0; i < 256; ++i)
+  {
+    unsigned crc8 = i, crc16 = i << 8;
+    for (bit = 0; bit < 8; ++bit)
+    {
+      crc8 = (crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1;
+      crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1;
+    }
+    crc8_table[i] = (uint8_t)crc8;
+    crc16_table[i] = (uint16_t)crc16;
+  }
+}
+
+static unsigned crc8(unsigned char const * data, size_t length)
+{
+  unsigned crc = 0;
+
+  while (length--)
+  {
+    crc = crc8_table[crc ^ *data++];
+  }
+  return crc;
+}
+
+static unsigned crc16(unsigned char const * data, size_t length)
+{
+  unsigned crc = 0;
+
+  while (length--)
+  {
+    crc = ((crc << 8) ^ crc16_table[(crc >> 8) ^ *data++]) & 0xFFFF;
+  }
+  return crc;
+}
+
+static void put_bits(bit_writer_t * w, uint32_t value, unsigned count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  w->accumulator = (w->accumulator << count) | (value & (uint32_t)((1ULL << count) - 1));
+  w->bits += count;
+  while (w->bits >= 8)
+  {
+    w->bits -= 8;
+    w->data[w->bytes++] = (unsigned char)(w->accumulator >> w->bits);
+  }
+}
+
+static void put_zeros(bit_writer_t * w, uint64_t count)
+{
+  for (; count >= 32; count -= 32)
+  {
+    put_bits(w, 0, 32);
+  }
+  put_bits(w, 0, (unsigned)count);
+}
+
+static void put_rice(bit_writer_t * w, int64_t residual, unsigned parameter)
+{
+  uint64_t folded = residual >= 0 ? (uint64_t)residual << 1
+    : ((uint64_t)(-(residual + 1)) << 1) | 1;
+
+  put_zeros(w, folded >> parameter);
+  put_bits(w, 1, 1);
+  put_bits(w, (uint32_t)folded, parameter);
+}
+
+/* The frame number, in FLAC's stretched UTF-8. */
+static void put_utf8(bit_writer_t * w, uint64_t value)
+{
+  unsigned bytes = 2, i;
+
+  if (value < 0x80)
+  {
+    put_bits(w, (uint32_t)value, 8);
+    return;
+  }
+  while (bytes < 7 && value >= (1ULL << (5 * bytes + 1)))
+  {
+    ++bytes;
+  }
+  put_bits(w, ((0xFF00 >> bytes) & 0xFF) | (uint32_t)(value >> (6 * (bytes - 1))), 8);
+  for (i = bytes - 1; i-- > 0; )
+  {
+    put_bits(w, 0x80 | ((uint32_t)(value >> (6 * i)) & 0x3F), 8);
+  }
+}
+
+/**
+ * Subframes
+ *
+ */
+
+typedef struct {
+  int type;
+  unsigned order;
+  unsigned partition_order;
+  unsigned method;          /* 0: 4-bit Rice parameters, 1: 5-bit */
+  unsigned parameters[1 << MAX_PARTITION_ORDER];
+  uint64_t bits;
+} subframe_plan_t;
+
+static void fixed_residual(int64_t const * x, size_t n, unsigned order, int64_t * residual)
+{
+  size_t i;
+
+  for (i = order; i < n; ++i)
+  {
+    switch (order)
+    {
+      case 0: residual[i] = x[i]; break;
+      case 1: residual[i] = x[i] - x[i - 1]; break;
+      case 2: residual[i] = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+      case 3: residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+      default: residual[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+    }
+  }
+}
+
+static uint64_t fold(int64_t residual)
+{
+  return residual >= 0 ? (uint64_t)residual << 1 : ((uint64_t)(-(residual + 1)) << 1) | 1;
+}
+
+/* The cheapest Rice parameter for a partition. The cost is an upper bound
+ * (the quotients are summed before they are rounded down). */
+static uint64_t rice_cost(uint64_t sum, uint64_t count, unsigned limit, unsigned * parameter)
+{
+  uint64_t best = UINT64_MAX;
+  unsigned k;
+
+  for (k = 0; k <= limit; ++k)
+  {
+    uint64_t cost = count * (k + 1) + (sum >> k);
+    if (cost < best)
+    {
+      best = cost;
+      *parameter = k;
+    }
+  }
+  return best;
+}
+
+/* Work out the cheapest way to code one channel of a frame. */
+static void plan_subframe(int64_t const * x, size_t n, unsigned bps, int64_t * residual,
+  subframe_plan_t * plan)
+{
+  uint64_t sums[1 << MAX_PARTITION_ORDER];
+  unsigned parameters[1 << MAX_PARTITION_ORDER];
+  unsigned order, best_order = 0, limit, parameter_bits, p, max_p = 0;
+  uint64_t best_sum = UINT64_MAX;
+  size_t i, j;
+
+  for (i = 1; i < n && x[i] == x[0]; ++i)
+  {
+  }
+  if (i == n)
+  {
+    plan->type = SUBFRAME_CONSTANT;
+    plan->bits = 8 + bps;
+    return;
+  }
+  plan->type = SUBFRAME_VERBATIM;
+  plan->bits = 8 + (uint64_t)n * bps;
+
+  for (order = 0; order <= MAX_FIXED_ORDER && order < n; ++order)
+  {
+    uint64_t sum = 0;
+    fixed_residual(x, n, order, residual);
+    for (i = order; i < n; ++i)
+    {
+      sum += residual[i] < 0 ? -residual[i] : residual[i];
+    }
+    if (sum < best_sum)
+    {
+      best_sum = sum;
+      best_order = order;
+    }
+  }
+  order = best_order;
+  fixed_residual(x, n, order, residual);
+  limit = bps > 16 ? 30 : 14;
+  parameter_bits = bps > 16 ? 5 : 4;
+  while (max_p < MAX_PARTITION_ORDER && n % (2u << max_p) == 0 && (n >> (max_p + 1)) > order)
+  {
+    ++max_p;
+  }
+  for (j = 0; j < (1u << max_p); ++j)
+  {
+    size_t first = j * (n >> max_p), last = first + (n >> max_p);
+    sums[j] = 0;
+    for (i = max(first, (size_t)order); i < last; ++i)
+    {
+      sums[j] += fold(residual[i]);
+    }
+  }
+  /* Try each partition order, merging the sums pairwise on the way down. */
+  for (p = max_p + 1; p-- > 0; )
+  {
+    uint64_t bits = 8 + (uint64_t)order * bps + 2 + 4;
+    for (j = 0; j < (1u << p); ++j)
+    {
+      uint64_t count = (n >> p) - (j == 0 ? order : 0);
+      bits += parameter_bits + rice_cost(sums[j], count, limit, &parameters[j]);
+    }
+    if (bits < plan->bits)
+    {
+      plan->type = SUBFRAME_FIXED;
+      plan->order = order;
+      plan->partition_order = p;
+      plan->method = bps > 16;
+      plan->bits = bits;
+      memcpy(plan->parameters, parameters, (1u << p) * sizeof(unsigned));
+    }
+    for (j = 0; p > 0 && j < (1u << (p - 1)); ++j)
+    {
+      sums[j] = sums[2 * j] + sums[2 * j + 1];
+    }
+  }
+}
+
+static void write_subframe(bit_writer_t * w, int64_t const * x, size_t n, unsigned bps,
+  subframe_plan_t const * plan, int64_t * residual)
+{
+  size_t i, j;
+
+  put_bits(w, 0, 1);
+  switch (plan->type)
+  {
+    case SUBFRAME_CONSTANT:
+      put_bits(w, 0, 6);
+      put_bits(w, 0, 1);
+      put_bits(w, (uint32_t)x[0], bps);
+      break;
+    case SUBFRAME_VERBATIM:
+      put_bits(w, 1, 6);
+      put_bits(w, 0, 1);
+      for (i = 0; i < n; ++i)
+      {
+        put_bits(w, (uint32_t)x[i], bps);
+      }
+      break;
+    default:
+      put_bits(w, 8 | plan->order, 6);
+      put_bits(w, 0, 1);
+      for (i = 0; i < plan->order; ++i)
+      {
+        put_bits(w, (uint32_t)x[i], bps);
+      }
+      fixed_residual(x, n, plan->order, residual);
+      put_bits(w, plan->method, 2);
+      put_bits(w, plan->partition_order, 4);
+      for (j = 0; j < (1u << plan->partition_order); ++j)
+      {
+        size_t first = j * (n >> plan->partition_order);
+        size_t last = first + (n >> plan->partition_order);
+        put_bits(w, plan->parameters[j], plan->method ? 5 : 4);
+        for (i = max(first, (size_t)plan->order); i < last; ++i)
+        {
+          put_rice(w, residual[i], plan->parameters[j]);
+        }
+      }
+      break;
+  }
+}
+
+/**
+ * Frames
+ *
+ */
+
+/* Encode n samples per channel into out, which has room for them even if
+ * they all go verbatim. Returns the frame's length, or 0 if out of memory. */
+static size_t encode_frame(flac_encoder_t const * encoder, int32_t const * pcm, size_t n,
+  uint64_t frame_number, unsigned char * out)
+{
+  unsigned channels = encoder->channels, bps = encoder->bits_per_sample;
+  int64_t * x[FLAC_MAX_CHANNELS + 2], * residual, * buffer;
+  subframe_plan_t * plans;
+  unsigned assignment = channels - 1, c, order[2] = {0, 1}, widths[FLAC_MAX_CHANNELS + 2];
+  bit_writer_t w = {out, 0, 0, 0};
+  size_t i, header_bytes;
+
+  buffer = (int64_t *)malloc((channels + 3) * n * sizeof(int64_t));
+  plans = (subframe_plan_t *)malloc((channels + 2) * sizeof(subframe_plan_t));
+  if (buffer == NULL || plans == NULL)
+  {
+    free(buffer);
+    free(plans);
+    return 0;
+  }
+  for (c = 0; c < channels + 2; ++c)
+  {
+    x[c] = buffer + c * n;
+    widths[c] = bps;
+  }
+  residual = buffer + (channels + 2) * n;
+  for (i = 0; i < n; ++i)
+  {
+    for (c = 0; c < channels; ++c)
+    {
+      x[c][i] = pcm[i * channels + c];
+    }
+  }
+  if (channels == 2)
+  {
+    /* x[2] is the side channel, x[3] the mid. */
+    for (i = 0; i < n; ++i)
+    {
+      x[2][i] = x[0][i] - x[1][i];
+      x[3][i] = (x[0][i] + x[1][i]) >> 1;
+    }
+    widths[2] = bps + 1;
+  }
+  for (c = 0; c < (channels == 2 ? 4u : channels); ++c)
+  {
+    plan_subframe(x[c], n, widths[c], residual, &plans[c]);
+  }
+  if (channels == 2)
+  {
+    uint64_t left_right = plans[0].bits + plans[1].bits;
+    uint64_t left_side = plans[0].bits + plans[2].bits;
+    uint64_t right_side = plans[2].bits + plans[1].bits;
+    uint64_t mid_side = plans[3].bits + plans[2].bits;
+    uint64_t best = min(min(left_right, left_side), min(right_side, mid_side));
+
+    if (best == left_side)
+    {
+      assignment = 8;
+      order[1] = 2;
+    }
+    else if (best == right_side)
+    {
+      assignment = 9;
+      order[0] = 2;
+    }
+    else if (best == mid_side)
+    {
+      assignment = 10;
+      order[0] = 3;
+      order[1] = 2;
+    }
+  }
+
+  /* Frame header: sync code, fixed block size, the block size itself at
+   * the end, and the rate and sample size from STREAMINFO. */
+  put_bits(&w, 0x3FFE, 14);
+  put_bits(&w, 0, 1);
+  put_bits(&w, 0, 1);
+  put_bits(&w, 7, 4);
+  put_bits(&w, 0, 4);
+  put_bits(&w, assignment, 4);
+  put_bits(&w, 0, 3);
+  put_bits(&w, 0, 1);
+  put_utf8(&w, frame_number);
+  put_bits(&w, (uint32_t)(n - 1), 16);
+  header_bytes = w.bytes;
+  put_bits(&w, crc8(out, header_bytes), 8);
+
+  for (c = 0; c < channels; ++c)
+  {
+    unsigned source = channels == 2 ? order[c] : c;
+    write_subframe(&w, x[source], n, widths[source], &plans[source], residual);
+  }
+  if (w.bits > 0)
+  {
+    put_bits(&w, 0, 8 - w.bits);
+  }
+  put_bits(&w, crc16(out, w.bytes), 16);
+  free(buffer);
+  free(plans);
+  return w.bytes;
+}
+
+/**
+ * The stream
+ *
+ */
+
+static void put_be(unsigned char * p, uint64_t value, unsigned bytes)
+{
+  while (bytes--)
+  {
+    p[bytes] = (unsigned char)value;
+    value >>= 8;
+  }
+}
+
+/* Write (or rewrite) the metadata blocks at the front of the file. */
+static int write_metadata(flac_encoder_t * encoder, unsigned char const * md5)
+{
+  unsigned char block[4 + 34];
+  unsigned char point[18];
+  size_t i;
+
+  memcpy(block, "fLaC", 4);
+  if (fseek(encoder->file, 0, SEEK_SET) != 0 || fwrite(block, 4, 1, encoder->file) != 1)
+  {
+    return SOX_EOF;
+  }
+  block[0] = 0;             /* STREAMINFO, not last */
+  put_be(block + 1, 34, 3);
+  put_be(block + 4, FLAC_BLOCK_SIZE, 2);
+  put_be(block + 6, FLAC_BLOCK_SIZE, 2);
+  put_be(block + 8, encoder->min_frame_size, 3);
+  put_be(block + 11, encoder->max_frame_size, 3);
+  put_be(block + 14, (uint64_t)encoder->rate << 44 | (uint64_t)(encoder->channels - 1) << 41
+    | (uint64_t)(encoder->bits_per_sample - 1) << 36 | (encoder->samples & 0xFFFFFFFFFULL), 8);
+  memcpy(block + 22, md5, 16);
+  if (fwrite(block, sizeof(block), 1, encoder->file) != 1)
+  {
+    return SOX_EOF;
+  }
+  block[0] = 0x80 | 3;      /* SEEKTABLE, last */
+  put_be(block + 1, encoder->seek_point_count * 18, 3);
+  if (fwrite(block, 4, 1, encoder->file) != 1)
+  {
+    return SOX_EOF;
+  }
+  for (i = 0; i < encoder->seek_point_count; ++i)
+  {
+    if (i < encoder->seek_points_used)
+    {
+      put_be(point, encoder->seek_points[i].sample, 8);
+      put_be(point + 8, encoder->seek_points[i].offset, 8);
+      put_be(point + 16, encoder->seek_points[i].samples, 2);
+    } else {
+      memset(point, 0, sizeof(point));
+      memset(point, 0xFF, 8); /* A placeholder */
+    }
+    if (fwrite(point, sizeof(point), 1, encoder->file) != 1)
+    {
+      return SOX_EOF;
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+static void free_encoder(flac_encoder_t * encoder)
+{
+  size_t i;
+
+  if (encoder->frames != NULL)
+  {
+    for (i = 0; i < FLAC_FRAMES_PER_BATCH; ++i)
+    {
+      free(encoder->frames[i]);
+    }
+  }
+  free(encoder->frames);
+  free(encoder->frame_sizes);
+  free(encoder->pcm);
+  free(encoder->seek_points);
+  free(encoder);
+}
+
+/* Open a FLAC file for writing. expected_samples (per channel) sizes the
+ * seek table; 0 if it isn't known. */
+flac_encoder_t * flac_open(char const * path, unsigned rate, unsigned channels,
+  unsigned bits_per_sample, uint64_t expected_samples)
+{
+  static int crc_tables_made;
+  flac_encoder_t * encoder;
+  unsigned char no_md5[16] = {0};
+  size_t i;
+
+  if (channels == 0 || channels > FLAC_MAX_CHANNELS || rate == 0 || rate > 655350
+      || (bits_per_sample != 8 && bits_per_sample != 16 && bits_per_sample != 24))
+  {
+    return NULL;
+  }
+  if (!crc_tables_made)
+  {
+    make_crc_tables();
+    crc_tables_made = 1;
+  }
+  encoder = (flac_encoder_t *)calloc(1, sizeof(flac_encoder_t));
+  if (encoder == NULL)
+  {
+    return NULL;
+  }
+  encoder->rate = rate;
+  encoder->channels = channels;
+  encoder->bits_per_sample = bits_per_sample;
+  encoder->min_frame_size = UINT32_MAX;
+  encoder->frame_capacity = 32 + channels * (2 + (FLAC_BLOCK_SIZE * (bits_per_sample + 1) + 7) / 8);
+  encoder->seek_point_count = expected_samples > 0
+    ? (size_t)(expected_samples / ((uint64_t)rate * FLAC_SEEK_INTERVAL)) + 1
+    : FLAC_UNKNOWN_SEEK_POINTS;
+  encoder->pcm = (int32_t *)malloc((size_t)FLAC_FRAMES_PER_BATCH * FLAC_BLOCK_SIZE
+    * channels * sizeof(int32_t));
+  encoder->frames = (unsigned char **)calloc(FLAC_FRAMES_PER_BATCH, sizeof(unsigned char *));
+  encoder->frame_sizes = (size_t *)calloc(FLAC_FRAMES_PER_BATCH, sizeof(size_t));
+  encoder->seek_points = (flac_seek_point_t *)calloc(encoder->seek_point_count,
+    sizeof(flac_seek_point_t));
+  if (encoder->pcm == NULL || encoder->frames == NULL || encoder->frame_sizes == NULL
+      || encoder->seek_points == NULL)
+  {
+    free_encoder(encoder);
+    return NULL;
+  }
+  for (i = 0; i < FLAC_FRAMES_PER_BATCH; ++i)
+  {
+    encoder->frames[i] = (unsigned char *)malloc(encoder->frame_capacity);
+    if (encoder->frames[i] == NULL)
+    {
+      free_encoder(encoder);
+      return NULL;
+    }
+  }
+  md5_init(&encoder->md5);
+  encoder->file = fopen(path, "wb");
+  if (encoder->file == NULL)
+  {
+    free_encoder(encoder);
+    return NULL;
+  }
+  if (write_metadata(encoder, no_md5) != SOX_SUCCESS)
+  {
+    fclose(encoder->file);
+    free_encoder(encoder);
+    return NULL;
+  }
+  return encoder;
+}
+
+/* Encode the frames gathered so far, in parallel, and write them out in
+ * order. Only the last batch may end with a short frame. */
+static int flush_batch(flac_encoder_t * encoder)
+{
+  size_t frame_samples = (size_t)FLAC_BLOCK_SIZE * encoder->channels;
+  int frames = (int)((encoder->pcm_fill + frame_samples - 1) / frame_samples);
+  unsigned bytes = encoder->bits_per_sample / 8;
+  int i, failed = 0;
+
+  #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+  for (i = 0; i < frames; ++i)
+  {
+    size_t first = (size_t)i * frame_samples;
+    size_t n = min(frame_samples, encoder->pcm_fill - first) / encoder->channels;
+
+    encoder->frame_sizes[i] = encode_frame(encoder, encoder->pcm + first, n,
+      encoder->frame_number + i, encoder->frames[i]);
+    failed |= (encoder->frame_sizes[i] == 0);
+  }
+  if (failed)
+  {
+    return SOX_EOF;
+  }
+  for (i = 0; i < frames; ++i)
+  {
+    size_t first = (size_t)i * frame_samples;
+    size_t n = min(frame_samples, encoder->pcm_fill - first) / encoder->channels;
+    uint32_t size = (uint32_t)encoder->frame_sizes[i];
+
+    md5_samples(&encoder->md5, encoder->pcm + first, n * encoder->channels, bytes);
+    if (encoder->samples >= encoder->next_seek_sample
+        && encoder->seek_points_used < encoder->seek_point_count)
+    {
+      flac_seek_point_t * point = &encoder->seek_points[encoder->seek_points_used++];
+      point->sample = encoder->samples;
+      point->offset = encoder->bytes;
+      point->samples = (unsigned)n;
+      encoder->next_seek_sample = encoder->samples + (uint64_t)encoder->rate * FLAC_SEEK_INTERVAL;
+    }
+    if (fwrite(encoder->frames[i], size, 1, encoder->file) != 1)
+    {
+      return SOX_EOF;
+    }
+    encoder->min_frame_size = min(encoder->min_frame_size, size);
+    encoder->max_frame_size = max(encoder->max_frame_size, size);
+    encoder->bytes += size;
+    encoder->samples += n;
+    encoder->frame_number++;
+  }
+  encoder->pcm_fill = 0;
+  return SOX_SUCCESS;
+}
+
+/* Take in the next interleaved samples. */
+int flac_write(flac_encoder_t * encoder, sox_sample_t const * samples, size_t count)
+{
+  size_t batch = (size_t)FLAC_FRAMES_PER_BATCH * FLAC_BLOCK_SIZE * encoder->channels;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    int32_t * out = &encoder->pcm[encoder->pcm_fill++];
+    switch (encoder->bits_per_sample)
+    {
+      case 8: *out = SOX_SAMPLE_TO_SIGNED_8BIT(samples[i], encoder->clips); break;
+      case 16: *out = SOX_SAMPLE_TO_SIGNED_16BIT(samples[i], encoder->clips); break;
+      default: *out = SOX_SAMPLE_TO_SIGNED_24BIT(samples[i], encoder->clips); break;
+    }
+    if (encoder->pcm_fill == batch && flush_batch(encoder) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+/* Write out what's left, fill in the metadata and close the file. */
+int flac_close(flac_encoder_t * encoder)
+{
+  unsigned char md5[16];
+  int result;
+
+  /* A trailing part-frame (fewer samples than channels) is dropped. */
+  encoder->pcm_fill -= encoder->pcm_fill % encoder->channels;
+  result = flush_batch(encoder);
+  md5_final(&encoder->md5, md5);
+  if (encoder->min_frame_size == UINT32_MAX)
+  {
+    encoder->min_frame_size = 0;
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = write_metadata(encoder, md5);
+  }
+  if (fclose(encoder->file) != 0)
+  {
+    result = SOX_EOF;
+  }
+  free_encoder(encoder);
+  return result;
+}
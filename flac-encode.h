@@ -0,0 +1,54 @@
+/* flac-encode.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the FLAC output writer.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sox.h"
+
+#define FLAC_BLOCK_SIZE 4096          /* Samples per channel in each frame */
+#define FLAC_FRAMES_PER_BATCH 256     /* Frames encoded at once, across the threads */
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_SEEK_INTERVAL 10         /* Seconds between seek points */
+#define FLAC_UNKNOWN_SEEK_POINTS 8640 /* Room for 24 hours, if the length isn't known */
+
+typedef struct {
+  uint32_t state[4];
+  uint64_t length;
+  unsigned char buffer[64];
+} flac_md5_t;
+
+typedef struct {
+  uint64_t sample;          /* First sample of the frame pointed at */
+  uint64_t offset;          /* Bytes from the first frame to that one */
+  unsigned samples;
+} flac_seek_point_t;
+
+typedef struct {
+  FILE * file;
+  unsigned rate, channels, bits_per_sample;
+  int32_t * pcm;            /* Interleaved samples waiting to be encoded */
+  size_t pcm_fill;
+  unsigned char ** frames;  /* Encoded frames of the current batch... */
+  size_t * frame_sizes;     /* ...and their lengths */
+  size_t frame_capacity;
+  uint64_t frame_number;
+  uint64_t samples;         /* Per channel, written so far */
+  uint64_t bytes;           /* Of frames written so far */
+  uint32_t min_frame_size, max_frame_size;
+  flac_seek_point_t * seek_points;
+  size_t seek_point_count, seek_points_used;
+  uint64_t next_seek_sample;
+  sox_uint64_t clips;
+  flac_md5_t md5;
+} flac_encoder_t;
+
+flac_encoder_t * flac_open(char const * path, unsigned rate, unsigned channels,
+  unsigned bits_per_sample, uint64_t expected_samples);
+int flac_write(flac_encoder_t * encoder, sox_sample_t const * samples, size_t count);
+int flac_close(flac_encoder_t * encoder);
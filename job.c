@@ -0,0 +1,150 @@
+/* job.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The job context. Each folder selection gets its own job, which owns its
+ * list of files, its open libSoX handles and its scratch buffers, so that
+ * a second job can start while the first is still running.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+static volatile LONG job_count = 0;
+
+job_t * job_create(PCWSTR directory)
+{
+  job_t * job = (job_t *)calloc(1, sizeof(job_t));
+  char temp_path[MAX_PATH];
+
+  if (job == NULL)
+  {
+    return NULL;
+  }
+  job->filenames = (char **)calloc(1, sizeof(char *));
+  job->file_capacity = 1;
+  if (job->filenames == NULL
+      || FAILED(StringCchCopyW(job->directory, MAX_PATH, directory))
+      || WideCharToMultiByte(CP_UTF8, 0, directory, -1,
+           job->directory_name, MAX_PATH, NULL, NULL) == 0
+      || FAILED(StringCbPrintfA(job->output_filename, MAX_PATH, "%s\\%s",
+           job->directory_name, DEFAULT_OUTPUT_FILENAME))
+      || GetTempPathA(MAX_PATH, temp_path) == 0
+      /* (Only made if something spills into it.) */
+      || FAILED(StringCbPrintfA(job->scratch_directory, MAX_PATH, "%ssplice-scratch-%lu-%ld",
+           temp_path, GetCurrentProcessId(), InterlockedIncrement(&job_count))))
+  {
+    job_free(job);
+    return NULL;
+  }
+  job->write_peaks = WRITE_PEAK_FILE;
+  return job;
+}
+
+/* Choose what splice() writes, and so the name of the output. */
+int job_set_output_format(job_t * job, output_format_t format)
+{
+  char const * name = format == OUTPUT_FLAC ? FLAC_OUTPUT_FILENAME : DEFAULT_OUTPUT_FILENAME;
+
+  if (FAILED(StringCbPrintfA(job->output_filename, MAX_PATH, "%s\\%s",
+        job->directory_name, name)))
+  {
+    return SOX_EOF;
+  }
+  job->output_format = format;
+  return SOX_SUCCESS;
+}
+
+/* The full path (in UTF-8) of a file in the job's folder, from the job's
+ * arena. */
+char * job_path(job_t * job, PCWSTR name)
+{
+  size_t directory_length = strlen(job->directory_name);
+  int name_length = WideCharToMultiByte(CP_UTF8, 0, name, -1, NULL, 0, NULL, NULL);
+  char * path;
+
+  if (name_length == 0)
+  {
+    return NULL;
+  }
+  path = (char *)arena_alloc(&job->arena, directory_length + 1 + (size_t)name_length);
+  if (path == NULL)
+  {
+    return NULL;
+  }
+  memcpy(path, job->directory_name, directory_length);
+  path[directory_length] = '\\';
+  if (WideCharToMultiByte(CP_UTF8, 0, name, -1, path + directory_length + 1, name_length,
+        NULL, NULL) == 0)
+  {
+    return NULL;
+  }
+  return path;
+}
+
+/* Add a file (a path from job_path()) to the end of the job's list. */
+int job_add_file(job_t * job, char * path)
+{
+  if (job->file_count + 1 >= job->file_capacity)
+  {
+    size_t capacity = job->file_capacity < 16 ? 32 : job->file_capacity * 2;
+    char ** filenames = (char **)realloc(job->filenames, capacity * sizeof(char *));
+    if (filenames == NULL)
+    {
+      return SOX_EOF;
+    }
+    job->filenames = filenames;
+    job->file_capacity = capacity;
+  }
+  job->filenames[job->file_count++] = path;
+  job->filenames[job->file_count] = NULL;
+  return SOX_SUCCESS;
+}
+
+/* The file name without its folder. */
+char const * job_base_name(char const * path)
+{
+  char const * separator = strrchr(path, '\\');
+
+  return separator == NULL ? path : separator + 1;
+}
+
+/* Close whatever the job still has open, e.g. after an error. */
+void job_cleanup(job_t * job)
+{
+  if (job->in != NULL)
+  {
+    sox_close(job->in);
+    job->in = NULL;
+  }
+  if (job->out != NULL)
+  {
+    sox_close(job->out);
+    job->out = NULL;
+  }
+  decoder_close(job->decoder);
+  job->decoder = NULL;
+}
+
+void job_free(job_t * job)
+{
+  if (job == NULL)
+  {
+    return;
+  }
+  job_cleanup(job);
+  peaks_free(job->peaks);
+  dither_free(job->dither);
+  trim_chain_free(job->trim_chain);
+  free(job->filenames);
+  arena_free(&job->arena);
+  if (job->scratch_directory[0] != '\0')
+  {
+    RemoveDirectoryA(job->scratch_directory);
+  }
+  budget_close(&job->memory);
+  free(job);
+}
@@ -0,0 +1,71 @@
+/* job.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the job context, which holds
+ * everything one splice (or duration count) needs, so that several can
+ * run at once in their own threads.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+#include "arena.h"
+#include "budget.h"
+#include "peaks.h"
+#include "decode.h"
+#include "dither.h"
+#include "trim-chain.h"
+#include "server.h"
+#include "automation.h"
+
+#define JOB_BUFFER_SAMPLES (size_t)2048 /* Typical operating system I/O buffer size */
+#define JOB_TIME_STRINGS 16
+
+typedef enum {
+  OUTPUT_WAV,               /* spliced-audio.wav, with its manifest and journal */
+  OUTPUT_FLAC               /* spliced-audio.flac */
+} output_format_t;
+
+/* Running totals, for reporting when the job is done. */
+typedef struct {
+  uint64_t files;           /* Input files read */
+  uint64_t samples;         /* Samples read from them */
+  uint64_t bytes_written;   /* Bytes of sample data written to the output */
+} job_stats_t;
+
+typedef struct {
+  TCHAR directory[MAX_PATH];          /* The folder the job works on */
+  char directory_name[MAX_PATH];      /* ...and the same, as libSoX wants it */
+  char output_filename[MAX_PATH];     /* Full path of the spliced output */
+  char scratch_directory[MAX_PATH];   /* Where effect scratch spills, removed with the job */
+  budget_account_t memory;            /* Its share of the memory budget */
+  output_format_t output_format;
+  char ** filenames;                  /* Full paths of the inputs, NULL-terminated */
+  size_t file_count, file_capacity;
+  arena_t arena;                      /* Paths, strings and scratch space, freed with the job */
+  sox_format_t * in, * out;           /* Open libSoX handles, closed by job_cleanup() */
+  decoder_t * decoder;                /* ...and the input being spliced, likewise */
+  unsigned output_bits;               /* 16 to reduce the output to 16 bits, 0 to keep the inputs' */
+  dither_t * dither;                  /* ...and the dither for doing so, made when first needed */
+  trim_chain_t * trim_chain;          /* The effects chain trim_silence() last used */
+  duration_cache_t * durations;       /* Lengths the job server already knows, or NULL */
+  automation_t * automation;          /* Each input's gain and fades, or NULL for none */
+  int write_peaks;                    /* Whether to write a peak file alongside the output */
+  peaks_t * peaks;                    /* ...and the peaks gathered so far */
+  sox_sample_t samples[JOB_BUFFER_SAMPLES];                       /* Scratch space */
+  unsigned char packed[JOB_BUFFER_SAMPLES * sizeof(sox_sample_t)];  /* for copying */
+  TCHAR time_strings[JOB_TIME_STRINGS][50];  /* Handed out by str_time() */
+  unsigned time_string_index;
+  job_stats_t stats;
+} job_t;
+
+job_t * job_create(PCWSTR directory);
+int job_set_output_format(job_t * job, output_format_t format);
+char * job_path(job_t * job, PCWSTR name);
+int job_add_file(job_t * job, char * path);
+char const * job_base_name(char const * path);
+void job_cleanup(job_t * job);
+void job_free(job_t * job);
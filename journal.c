@@ -0,0 +1,110 @@
+/* journal.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The splice progress journal. While splice() runs, it periodically
+ * records how far it has got (spliced-audio.wav.journal), after making
+ * sure that everything up to that point is on the disk. If the job dies,
+ * the next run picks up from the last checkpoint instead of starting over.
+ *
+ * The journal is a manifest of the tracks written so far, preceded by a
+ * cursor line. Each checkpoint is written to a temporary file and renamed
+ * over the previous one, so a crash mid-checkpoint leaves the old one intact.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <string.h>
+#include <strsafe.h>
+#include <io.h>
+
+static void journal_path(char const * output_filename, char * path, size_t path_size)
+{
+  StringCbPrintfA(path, path_size, "%s%s", output_filename, JOURNAL_SUFFIX);
+}
+
+int journal_checkpoint(char const * output_filename, manifest_t const * manifest,
+  journal_cursor_t const * cursor)
+{
+  char path[MAX_PATH], temp_path[MAX_PATH];
+  manifest_t written;
+  FILE * file;
+  int result;
+
+  journal_path(output_filename, path, sizeof(path));
+  StringCbPrintfA(temp_path, sizeof(temp_path), "%s.tmp", path);
+  file = fopen(temp_path, "w");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  /* Only the tracks up to and including the current one are meaningful. */
+  written = *manifest;
+  written.track_count = cursor->track + 1;
+  fprintf(file, "splice-journal %d\n", JOURNAL_VERSION);
+  fprintf(file, "cursor %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+    (uint64_t)cursor->track, cursor->track_samples, cursor->data_bytes,
+    cursor->tail_bytes, cursor->tail_fingerprint);
+  result = manifest_print(file, &written);
+  if (fflush(file) != 0 || _commit(_fileno(file)) != 0)
+  {
+    result = SOX_EOF;
+  }
+  if (fclose(file) != 0)
+  {
+    result = SOX_EOF;
+  }
+  if (result != SOX_SUCCESS
+      || !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+  {
+    DeleteFileA(temp_path);
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+int journal_read(char const * output_filename, manifest_t * manifest,
+  journal_cursor_t * cursor)
+{
+  char path[MAX_PATH];
+  char line[MAX_PATH];
+  uint64_t track;
+  FILE * file;
+  int version = 0;
+  int result = SOX_EOF;
+
+  memset(manifest, 0, sizeof(*manifest));
+  journal_path(output_filename, path, sizeof(path));
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (fgets(line, sizeof(line), file) != NULL
+      && sscanf(line, "splice-journal %d", &version) == 1
+      && version == JOURNAL_VERSION
+      && fgets(line, sizeof(line), file) != NULL
+      && sscanf(line, "cursor %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+           &track, &cursor->track_samples, &cursor->data_bytes,
+           &cursor->tail_bytes, &cursor->tail_fingerprint) == 5)
+  {
+    cursor->track = (size_t)track;
+    result = manifest_scan(file, manifest);
+    if (result == SOX_SUCCESS && manifest->track_count != cursor->track + 1)
+    {
+      manifest_free(manifest);
+      result = SOX_EOF;
+    }
+  }
+  fclose(file);
+  return result;
+}
+
+void journal_remove(char const * output_filename)
+{
+  char path[MAX_PATH];
+
+  journal_path(output_filename, path, sizeof(path));
+  DeleteFileA(path);
+}
@@ -0,0 +1,30 @@
+/* journal.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the splice progress journal.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "manifest.h"
+
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_VERSION 3
+#define CHECKPOINT_INTERVAL ((uint64_t)64 * 1024 * 1024) /* Output bytes between checkpoints */
+
+/* How far a splice had got when the checkpoint was taken. */
+typedef struct {
+  size_t track;             /* Input file being copied */
+  uint64_t track_samples;   /* Samples of that file already in the output */
+  uint64_t data_bytes;      /* Bytes of sample data safely on disk */
+  uint64_t tail_bytes;      /* Length of the last block written... */
+  uint64_t tail_fingerprint;/* ...and a hash of it, to validate the prefix */
+} journal_cursor_t;
+
+int journal_checkpoint(char const * output_filename, manifest_t const * manifest,
+  journal_cursor_t const * cursor);
+int journal_read(char const * output_filename, manifest_t * manifest,
+  journal_cursor_t * cursor);
+void journal_remove(char const * output_filename);
@@ -0,0 +1,240 @@
+/* manifest.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Reading and writing the splice manifest. The manifest is a small text
+ * file saved next to the output (spliced-audio.wav.manifest) listing the
+ * byte range, sample count and content fingerprint of every track, so
+ * that a later re-splice only has to touch the tracks that changed, and
+ * the checksums of the tracks and of the whole output, so that it can be
+ * verified without the inputs.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+#define MANIFEST_LINE_LENGTH (MAX_PATH + 200)
+
+void manifest_path(char const * output_filename, char * path, size_t path_size)
+{
+  StringCbPrintfA(path, path_size, "%s%s", output_filename, MANIFEST_SUFFIX);
+}
+
+/* Write the body of a manifest to an open file; the journal reuses this. */
+int manifest_print(FILE * file, manifest_t const * manifest)
+{
+  size_t i;
+
+  fprintf(file, "signal %.0f %u %u %u\n", manifest->rate,
+    manifest->channels, manifest->bits_per_sample, manifest->encoding);
+  fprintf(file, "data %" PRIu64 "\n", manifest->data_offset);
+  if (manifest->checksummed)
+  {
+    fprintf(file, "checksum %08x\n", (unsigned)manifest_checksum(manifest));
+  } else {
+    fprintf(file, "checksum none\n");
+  }
+  for (i = 0; i < manifest->track_count; ++i)
+  {
+    manifest_track_t const * track = &manifest->tracks[i];
+    /* The filename goes last, since it may contain spaces. */
+    fprintf(file, "track %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+      " %" PRIu64 " %" PRIu64 " %08x %016" PRIx64 " %s\n", track->byte_offset,
+      track->byte_length, track->samples, track->file_size, track->file_time,
+      track->fingerprint, (unsigned)track->checksum, track->automation, track->filename);
+  }
+  return ferror(file) ? SOX_EOF : SOX_SUCCESS;
+}
+
+/* An output rewritten some other way no longer matches its manifest. */
+void manifest_remove(char const * output_filename)
+{
+  char path[MAX_PATH];
+
+  manifest_path(output_filename, path, sizeof(path));
+  DeleteFileA(path);
+}
+
+int manifest_write(char const * output_filename, manifest_t const * manifest)
+{
+  char path[MAX_PATH];
+  FILE * file;
+  int result;
+
+  manifest_path(output_filename, path, sizeof(path));
+  file = fopen(path, "w");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  fprintf(file, "splice-manifest %d\n", MANIFEST_VERSION);
+  result = manifest_print(file, manifest);
+  if (fclose(file) != 0)
+  {
+    return SOX_EOF;
+  }
+  return result;
+}
+
+/* Read the body of a manifest from an open file, up to end of file. */
+int manifest_scan(FILE * file, manifest_t * manifest)
+{
+  char line[MANIFEST_LINE_LENGTH];
+  double rate;
+  unsigned checksum;
+
+  memset(manifest, 0, sizeof(*manifest));
+  if (fgets(line, sizeof(line), file) == NULL
+      || sscanf(line, "signal %lf %u %u %u", &rate, &manifest->channels,
+           &manifest->bits_per_sample, &manifest->encoding) != 4
+      || fgets(line, sizeof(line), file) == NULL
+      || sscanf(line, "data %" SCNu64, &manifest->data_offset) != 1
+      || fgets(line, sizeof(line), file) == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (sscanf(line, "checksum %x", &checksum) == 1)
+  {
+    manifest->checksummed = 1;
+    manifest->checksum = checksum;
+  }
+  else if (strncmp(line, "checksum none", 13) != 0)
+  {
+    return SOX_EOF;
+  }
+  manifest->rate = rate;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    manifest_track_t track, * tracks;
+    int name_start = 0;
+    size_t name_length;
+
+    if (sscanf(line, "track %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+          " %" SCNu64 " %" SCNu64 " %x %" SCNx64 " %n", &track.byte_offset,
+          &track.byte_length, &track.samples, &track.file_size, &track.file_time,
+          &track.fingerprint, &checksum, &track.automation, &name_start) != 8
+        || name_start == 0)
+    {
+      manifest_free(manifest);
+      return SOX_EOF;
+    }
+    track.checksum = checksum;
+    name_length = strcspn(line + name_start, "\r\n");
+    track.filename = (char *)malloc(name_length + 1);
+    tracks = (manifest_track_t *)realloc(manifest->tracks,
+      (manifest->track_count + 1) * sizeof(manifest_track_t));
+    if (tracks != NULL)
+    {
+      manifest->tracks = tracks;
+    }
+    if (track.filename == NULL || tracks == NULL)
+    {
+      free(track.filename);
+      manifest_free(manifest);
+      return SOX_EOF;
+    }
+    memcpy(track.filename, line + name_start, name_length);
+    track.filename[name_length] = '\0';
+    manifest->tracks[manifest->track_count++] = track;
+  }
+  return SOX_SUCCESS;
+}
+
+int manifest_read(char const * output_filename, manifest_t * manifest)
+{
+  char path[MAX_PATH];
+  char line[MANIFEST_LINE_LENGTH];
+  FILE * file;
+  int version = 0;
+  int result = SOX_EOF;
+
+  memset(manifest, 0, sizeof(*manifest));
+  manifest_path(output_filename, path, sizeof(path));
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (fgets(line, sizeof(line), file) != NULL
+      && sscanf(line, "splice-manifest %d", &version) == 1
+      && version == MANIFEST_VERSION)
+  {
+    result = manifest_scan(file, manifest);
+  }
+  fclose(file);
+  return result;
+}
+
+void manifest_free(manifest_t * manifest)
+{
+  size_t i;
+
+  for (i = 0; i < manifest->track_count; ++i)
+  {
+    free(manifest->tracks[i].filename);
+  }
+  free(manifest->tracks);
+  manifest->tracks = NULL;
+  manifest->track_count = 0;
+}
+
+/* File size and last-write time; if both match the manifest, we assume
+ * the file has not been touched since the last splice. */
+int manifest_stat(char const * filename, uint64_t * file_size, uint64_t * file_time)
+{
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+  if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes))
+  {
+    return SOX_EOF;
+  }
+  *file_size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+  *file_time = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32)
+    | attributes.ftLastWriteTime.dwLowDateTime;
+  return SOX_SUCCESS;
+}
+
+/* The checksum of the whole data chunk, from those of its tracks. */
+uint32_t manifest_checksum(manifest_t const * manifest)
+{
+  uint32_t checksum = 0;
+  size_t i;
+
+  for (i = 0; i < manifest->track_count; ++i)
+  {
+    checksum = checksum_combine(checksum, manifest->tracks[i].checksum,
+      manifest->tracks[i].byte_length);
+  }
+  return checksum;
+}
+
+/* FNV-1a over raw bytes, for checking what actually reached the disk. */
+uint64_t fingerprint_bytes(uint64_t hash, void const * bytes, size_t count)
+{
+  unsigned char const * p = (unsigned char const *)bytes;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* FNV-1a over whole samples rather than bytes; start from FINGERPRINT_SEED. */
+uint64_t fingerprint_samples(uint64_t hash, sox_sample_t const * samples, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    hash ^= (uint32_t)samples[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
@@ -0,0 +1,53 @@
+/* manifest.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the splice manifest, which
+ * records where each track landed in the output file.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sox.h"
+
+#define MANIFEST_SUFFIX ".manifest"
+#define MANIFEST_VERSION 3
+#define FINGERPRINT_SEED 0xcbf29ce484222325ULL /* FNV-1a 64-bit offset basis */
+
+typedef struct {
+  char * filename;
+  uint64_t byte_offset;     /* Offset of the track from the start of the data chunk */
+  uint64_t byte_length;
+  uint64_t samples;
+  uint64_t file_size;       /* Size and modification time of the input file, */
+  uint64_t file_time;       /* so unchanged tracks can be skipped cheaply */
+  uint64_t fingerprint;     /* Hash of the track's samples */
+  uint32_t checksum;        /* CRC-32C of its bytes in the output */
+  uint64_t automation;      /* automation_key() of the gain and fades applied */
+} manifest_track_t;
+
+typedef struct {
+  sox_rate_t rate;
+  unsigned channels;
+  unsigned bits_per_sample;
+  unsigned encoding;
+  uint64_t data_offset;
+  int checksummed;          /* Whether the tracks' checksums are known... */
+  uint32_t checksum;        /* ...and that of the whole data chunk, as read */
+  size_t track_count;
+  manifest_track_t * tracks;
+} manifest_t;
+
+void manifest_path(char const * output_filename, char * path, size_t path_size);
+int manifest_print(FILE * file, manifest_t const * manifest);
+int manifest_scan(FILE * file, manifest_t * manifest);
+int manifest_write(char const * output_filename, manifest_t const * manifest);
+void manifest_remove(char const * output_filename);
+int manifest_read(char const * output_filename, manifest_t * manifest);
+void manifest_free(manifest_t * manifest);
+int manifest_stat(char const * filename, uint64_t * file_size, uint64_t * file_time);
+uint32_t manifest_checksum(manifest_t const * manifest);
+uint64_t fingerprint_bytes(uint64_t hash, void const * bytes, size_t count);
+uint64_t fingerprint_samples(uint64_t hash, sox_sample_t const * samples, size_t count);
@@ -0,0 +1,253 @@
+/* native-pcm.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Block kernels at the samples' own width. A WAV input already in the
+ * output's format can go straight from one file to the other; widening it
+ * to 32 bits on the way in and narrowing it again on the way out would
+ * only double the memory traffic. What we need to know about the samples
+ * on the way through (their fingerprint, their peaks) is worked out from
+ * them as they are.
+ *
+ * The kernels are written once, as macros, and stamped out for each
+ * format, and for mono, stereo and any other number of channels, so that
+ * the compiler sees a fixed sample size and channel count in each loop.
+ *
+ */
+
+#include "wt.h"
+#include <float.h>
+#include <math.h>
+
+/* Round to the nearest value the format can hold. */
+static double clamp_round(double value, double low, double high)
+{
+  value = floor(value + 0.5);
+  return value < low ? low : value > high ? high : value;
+}
+
+static int32_t load_s24(unsigned char const * p)
+{
+  return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+static void store_s24(unsigned char * p, int32_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+}
+
+/* As libSoX widens floats when it reads them. */
+static sox_sample_t widen_float(float value)
+{
+  SOX_SAMPLE_LOCALS;
+  sox_uint64_t clips = 0;
+
+  return SOX_FLOAT_32BIT_TO_SAMPLE(value, clips);
+}
+
+/* For each format: the type a sample is worked on in, and its range; how
+ * one is loaded, stored and widened. */
+#define VALUE_s16 int32_t
+#define LOW_s16 (-32768)
+#define HIGH_s16 32767
+#define LOAD_s16(p, i) ((int32_t)((int16_t const *)(p))[i])
+#define STORE_s16(p, i, v) (((int16_t *)(p))[i] = (int16_t)clamp_round(v, LOW_s16, HIGH_s16))
+#define WIDEN_s16(v) SOX_SIGNED_16BIT_TO_SAMPLE(v, )
+
+#define VALUE_s24 int32_t
+#define LOW_s24 (-8388608)
+#define HIGH_s24 8388607
+#define LOAD_s24(p, i) load_s24((unsigned char const *)(p) + 3 * (i))
+#define STORE_s24(p, i, v) store_s24((unsigned char *)(p) + 3 * (i), \
+  (int32_t)clamp_round(v, LOW_s24, HIGH_s24))
+#define WIDEN_s24(v) SOX_SIGNED_24BIT_TO_SAMPLE(v, )
+
+#define VALUE_s32 int32_t
+#define LOW_s32 INT32_MIN
+#define HIGH_s32 INT32_MAX
+#define LOAD_s32(p, i) (((int32_t const *)(p))[i])
+#define STORE_s32(p, i, v) (((int32_t *)(p))[i] = (int32_t)clamp_round(v, LOW_s32, HIGH_s32))
+#define WIDEN_s32(v) ((sox_sample_t)(v))
+
+#define VALUE_f32 float
+#define LOW_f32 (-FLT_MAX)
+#define HIGH_f32 FLT_MAX
+#define LOAD_f32(p, i) (((float const *)(p))[i])
+#define STORE_f32(p, i, v) (((float *)(p))[i] = (float)(v))  /* Floats may go past full scale */
+#define WIDEN_f32(v) widen_float(v)
+
+/* The kernels that don't care about channels. */
+#define FORMAT_KERNELS(F)                                                      \
+static uint64_t fingerprint_##F(uint64_t hash, void const * data, size_t count) \
+{                                                                              \
+  size_t i;                                                                    \
+                                                                               \
+  for (i = 0; i < count; ++i)                                                  \
+  {                                                                            \
+    hash ^= (uint32_t)WIDEN_##F(LOAD_##F(data, i));                            \
+    hash *= 0x100000001b3ULL;                                                  \
+  }                                                                            \
+  return hash;                                                                 \
+}                                                                              \
+                                                                               \
+static void gain_##F(void * data, size_t count, double gain)                   \
+{                                                                              \
+  size_t i;                                                                    \
+                                                                               \
+  for (i = 0; i < count; ++i)                                                  \
+  {                                                                            \
+    STORE_##F(data, i, LOAD_##F(data, i) * gain);                              \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static void widen_##F(void const * data, size_t count, sox_sample_t * dest)    \
+{                                                                              \
+  size_t i;                                                                    \
+                                                                               \
+  for (i = 0; i < count; ++i)                                                  \
+  {                                                                            \
+    dest[i] = WIDEN_##F(LOAD_##F(data, i));                                    \
+  }                                                                            \
+}
+
+/* The kernels that go frame by frame. CHANNELS is 0 for "any", when the
+ * count comes from the caller instead. */
+#define CHANNEL_KERNELS(F, CHANNELS)                                           \
+static void extremes_##F##_##CHANNELS(void const * data, size_t count,         \
+  unsigned channels, unsigned channel, sox_sample_t * min, sox_sample_t * max) \
+{                                                                              \
+  unsigned const n = CHANNELS ? CHANNELS : channels;                           \
+  VALUE_##F low[NATIVE_MAX_CHANNELS], high[NATIVE_MAX_CHANNELS];               \
+  size_t i;                                                                    \
+  unsigned c;                                                                  \
+                                                                               \
+  for (c = 0; c < n; ++c)                                                      \
+  {                                                                            \
+    low[c] = HIGH_##F;                                                         \
+    high[c] = LOW_##F;                                                         \
+  }                                                                            \
+  for (i = 0, c = channel; i < count; ++i)                                     \
+  {                                                                            \
+    VALUE_##F value = LOAD_##F(data, i);                                       \
+    if (value < low[c]) low[c] = value;                                        \
+    if (value > high[c]) high[c] = value;                                      \
+    if (++c == n) c = 0;                                                       \
+  }                                                                            \
+  for (c = 0; c < n && c < count; ++c)                                         \
+  {                                                                            \
+    unsigned k = (channel + c) % n;                                            \
+    sox_sample_t widened = WIDEN_##F(low[k]);                                  \
+    if (widened < min[k]) min[k] = widened;                                    \
+    widened = WIDEN_##F(high[k]);                                              \
+    if (widened > max[k]) max[k] = widened;                                    \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static void fade_##F##_##CHANNELS(void * data, size_t frames, unsigned channels, \
+  double from, double step)                                                    \
+{                                                                              \
+  unsigned const n = CHANNELS ? CHANNELS : channels;                           \
+  size_t i;                                                                    \
+  unsigned c;                                                                  \
+                                                                               \
+  for (i = 0; i < frames; ++i)                                                 \
+  {                                                                            \
+    double gain = from + step * i;                                             \
+    for (c = 0; c < n; ++c)                                                    \
+    {                                                                          \
+      STORE_##F(data, i * n + c, LOAD_##F(data, i * n + c) * gain);            \
+    }                                                                          \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static void mix_##F##_##CHANNELS(void * dest, void const * src, size_t frames, \
+  unsigned channels, double from, double step)                                 \
+{                                                                              \
+  unsigned const n = CHANNELS ? CHANNELS : channels;                           \
+  size_t i;                                                                    \
+  unsigned c;                                                                  \
+                                                                               \
+  for (i = 0; i < frames; ++i)                                                 \
+  {                                                                            \
+    double gain = from + step * i;                                             \
+    for (c = 0; c < n; ++c)                                                    \
+    {                                                                          \
+      STORE_##F(dest, i * n + c, LOAD_##F(dest, i * n + c) * (1 - gain)       \
+        + LOAD_##F(src, i * n + c) * gain);                                    \
+    }                                                                          \
+  }                                                                            \
+}
+
+#define KERNELS(F, FORMAT, BYTES, CHANNELS)                                    \
+  { FORMAT, BYTES, CHANNELS, fingerprint_##F, extremes_##F##_##CHANNELS, gain_##F, \
+    fade_##F##_##CHANNELS, mix_##F##_##CHANNELS, widen_##F }
+
+FORMAT_KERNELS(s16)
+CHANNEL_KERNELS(s16, 1)
+CHANNEL_KERNELS(s16, 2)
+CHANNEL_KERNELS(s16, 0)
+FORMAT_KERNELS(s24)
+CHANNEL_KERNELS(s24, 1)
+CHANNEL_KERNELS(s24, 2)
+CHANNEL_KERNELS(s24, 0)
+FORMAT_KERNELS(s32)
+CHANNEL_KERNELS(s32, 1)
+CHANNEL_KERNELS(s32, 2)
+CHANNEL_KERNELS(s32, 0)
+FORMAT_KERNELS(f32)
+CHANNEL_KERNELS(f32, 1)
+CHANNEL_KERNELS(f32, 2)
+CHANNEL_KERNELS(f32, 0)
+
+/* By format, then mono, stereo, any. */
+static native_kernels_t const kernel_tables[NATIVE_FORMATS][3] = {
+  { KERNELS(s16, NATIVE_S16, 2, 1), KERNELS(s16, NATIVE_S16, 2, 2), KERNELS(s16, NATIVE_S16, 2, 0) },
+  { KERNELS(s24, NATIVE_S24, 3, 1), KERNELS(s24, NATIVE_S24, 3, 2), KERNELS(s24, NATIVE_S24, 3, 0) },
+  { KERNELS(s32, NATIVE_S32, 4, 1), KERNELS(s32, NATIVE_S32, 4, 2), KERNELS(s32, NATIVE_S32, 4, 0) },
+  { KERNELS(f32, NATIVE_F32, 4, 1), KERNELS(f32, NATIVE_F32, 4, 2), KERNELS(f32, NATIVE_F32, 4, 0) }
+};
+
+/* Which of our formats, if any, samples are stored in. */
+int native_format(sox_encoding_t encoding, unsigned bits_per_sample, native_format_t * format)
+{
+  if (encoding == SOX_ENCODING_FLOAT && bits_per_sample == 32)
+  {
+    *format = NATIVE_F32;
+    return SOX_SUCCESS;
+  }
+  if (encoding != SOX_ENCODING_SIGN2)
+  {
+    return SOX_EOF;
+  }
+  switch (bits_per_sample)
+  {
+  case 16:
+    *format = NATIVE_S16;
+    return SOX_SUCCESS;
+  case 24:
+    *format = NATIVE_S24;
+    return SOX_SUCCESS;
+  case 32:
+    *format = NATIVE_S32;
+    return SOX_SUCCESS;
+  }
+  return SOX_EOF;
+}
+
+native_kernels_t const * native_kernels(native_format_t format, unsigned channels)
+{
+  if (channels == 0 || channels > NATIVE_MAX_CHANNELS)
+  {
+    return NULL;
+  }
+  return &kernel_tables[format][channels == 1 ? 0 : channels == 2 ? 1 : 2];
+}
+
+/* The kernels for any number of channels, which those for mono and stereo
+ * must agree with; for the benchmark. */
+native_kernels_t const * native_reference_kernels(native_format_t format)
+{
+  return &kernel_tables[format][2];
+}
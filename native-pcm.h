@@ -0,0 +1,52 @@
+/* native-pcm.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the block kernels that work on
+ * samples as they are stored (16, 24 or 32-bit integers, or floats),
+ * rather than widened to sox_sample_t.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+
+#define NATIVE_BLOCK_FRAMES ((size_t)16 * 1024) /* Frames per read, when copying an input as it is */
+#define NATIVE_MAX_CHANNELS 32                  /* Most channels the kernels will take */
+
+typedef enum {
+  NATIVE_S16,
+  NATIVE_S24,
+  NATIVE_S32,
+  NATIVE_F32,
+  NATIVE_FORMATS
+} native_format_t;
+
+/* One format's kernels, specialized for mono, stereo, or any number of
+ * channels. Counts are in samples, except where they say frames. A sample
+ * is only widened (to match what libSoX would have decoded) where the
+ * result has to be a sox_sample_t. */
+typedef struct {
+  native_format_t format;
+  unsigned sample_bytes;
+  unsigned channels;        /* 1 or 2, or 0 for any number */
+  /* fingerprint_samples(), as if the samples had been decoded */
+  uint64_t (*fingerprint)(uint64_t hash, void const * data, size_t count);
+  /* Widen the run's lowest and highest value of each channel into min and
+   * max (which are only ever pushed outwards); the first sample is of
+   * channel `channel`. For the peaks, and thresholds. */
+  void (*extremes)(void const * data, size_t count, unsigned channels, unsigned channel,
+    sox_sample_t * min, sox_sample_t * max);
+  void (*gain)(void * data, size_t count, double gain);
+  /* Gain of from + step * frame */
+  void (*fade)(void * data, size_t frames, unsigned channels, double from, double step);
+  /* dest faded out as src is faded in, from + step * frame being src's gain */
+  void (*mix)(void * dest, void const * src, size_t frames, unsigned channels, double from,
+    double step);
+  void (*widen)(void const * data, size_t count, sox_sample_t * dest);
+} native_kernels_t;
+
+int native_format(sox_encoding_t encoding, unsigned bits_per_sample, native_format_t * format);
+native_kernels_t const * native_kernels(native_format_t format, unsigned channels);
+native_kernels_t const * native_reference_kernels(native_format_t format);
@@ -0,0 +1,471 @@
+/* peaks.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The waveform peak file (spliced-audio.wav.peaks). As splice() writes the
+ * output, the blocks going past are reduced to the smallest and largest
+ * sample per channel in every 256 frames; every 16 of those buckets make
+ * one of 4096 frames, and every 16 of those one of 65536. A waveform view
+ * maps the file and reads whichever level suits its zoom, instead of
+ * decoding the whole output.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+#include <immintrin.h>
+
+static peak_reducer_t reduce_block;
+
+static void reduce_scalar(sox_sample_t const * samples, size_t count,
+  unsigned channels, unsigned channel, sox_sample_t * min, sox_sample_t * max)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    sox_sample_t sample = samples[i];
+    if (sample < min[channel]) min[channel] = sample;
+    if (sample > max[channel]) max[channel] = sample;
+    if (++channel == channels) channel = 0;
+  }
+}
+
+/* The vector versions keep one min and max per lane. As long as the block
+ * starts on a frame and the channel count divides the lane count, each lane
+ * only ever sees one channel. */
+__attribute__((target("sse4.1")))
+static void reduce_sse41(sox_sample_t const * samples, size_t count,
+  unsigned channels, unsigned channel, sox_sample_t * min, sox_sample_t * max)
+{
+  size_t i = 0;
+  unsigned lane;
+
+  if (channel == 0 && 4 % channels == 0 && count >= 8)
+  {
+    __m128i vmin = _mm_set1_epi32(SOX_SAMPLE_MAX);
+    __m128i vmax = _mm_set1_epi32(SOX_SAMPLE_MIN);
+    sox_sample_t lanes_min[4], lanes_max[4];
+
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((__m128i const *)(samples + i));
+      vmin = _mm_min_epi32(vmin, v);
+      vmax = _mm_max_epi32(vmax, v);
+    }
+    _mm_storeu_si128((__m128i *)lanes_min, vmin);
+    _mm_storeu_si128((__m128i *)lanes_max, vmax);
+    for (lane = 0; lane < 4; ++lane)
+    {
+      if (lanes_min[lane] < min[lane % channels]) min[lane % channels] = lanes_min[lane];
+      if (lanes_max[lane] > max[lane % channels]) max[lane % channels] = lanes_max[lane];
+    }
+  }
+  reduce_scalar(samples + i, count - i, channels, channel, min, max);
+}
+
+__attribute__((target("avx2")))
+static void reduce_avx2(sox_sample_t const * samples, size_t count,
+  unsigned channels, unsigned channel, sox_sample_t * min, sox_sample_t * max)
+{
+  size_t i = 0;
+  unsigned lane;
+
+  if (channel == 0 && 8 % channels == 0 && count >= 16)
+  {
+    __m256i vmin = _mm256_set1_epi32(SOX_SAMPLE_MAX);
+    __m256i vmax = _mm256_set1_epi32(SOX_SAMPLE_MIN);
+    sox_sample_t lanes_min[8], lanes_max[8];
+
+    for (; i + 8 <= count; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256((__m256i const *)(samples + i));
+      vmin = _mm256_min_epi32(vmin, v);
+      vmax = _mm256_max_epi32(vmax, v);
+    }
+    _mm256_storeu_si256((__m256i *)lanes_min, vmin);
+    _mm256_storeu_si256((__m256i *)lanes_max, vmax);
+    for (lane = 0; lane < 8; ++lane)
+    {
+      if (lanes_min[lane] < min[lane % channels]) min[lane % channels] = lanes_min[lane];
+      if (lanes_max[lane] > max[lane % channels]) max[lane % channels] = lanes_max[lane];
+    }
+  }
+  reduce_scalar(samples + i, count - i, channels, channel, min, max);
+}
+
+peak_variant_t const peak_variants[] = {
+  { "scalar", NULL, reduce_scalar },
+  { "sse4.1", "sse4.1", reduce_sse41 },
+  { "avx2", "avx2", reduce_avx2 },
+  { NULL, NULL, NULL }
+};
+
+static peak_reducer_t choose_reducer(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return reduce_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1"))
+  {
+    return reduce_sse41;
+  }
+  return reduce_scalar;
+}
+
+static void reset_level(peak_level_t * level)
+{
+  unsigned c;
+
+  for (c = 0; c < PEAKS_MAX_CHANNELS; ++c)
+  {
+    level->min[c] = SOX_SAMPLE_MAX;
+    level->max[c] = SOX_SAMPLE_MIN;
+  }
+  level->filled = 0;
+}
+
+/* Finish the bucket being filled at this level, and fold it into the
+ * one above. */
+static int push_bucket(peaks_t * peaks, unsigned index)
+{
+  peak_level_t * level = &peaks->levels[index];
+  size_t bucket_values = peaks->channels * 2;
+  int16_t * bucket;
+  unsigned c;
+
+  if (level->bucket_count == level->allocated)
+  {
+    uint64_t allocated = level->allocated ? level->allocated * 2 : 1024;
+    int16_t * buckets = (int16_t *)realloc(level->buckets,
+      (size_t)allocated * bucket_values * sizeof(int16_t));
+    if (buckets == NULL)
+    {
+      return SOX_EOF;
+    }
+    level->buckets = buckets;
+    level->allocated = allocated;
+  }
+  bucket = level->buckets + (size_t)level->bucket_count * bucket_values;
+  for (c = 0; c < peaks->channels; ++c)
+  {
+    bucket[2 * c] = (int16_t)(level->min[c] >> 16);
+    bucket[2 * c + 1] = (int16_t)(level->max[c] >> 16);
+  }
+  level->bucket_count++;
+  if (index + 1 < PEAK_LEVELS)
+  {
+    peak_level_t * above = &peaks->levels[index + 1];
+    for (c = 0; c < peaks->channels; ++c)
+    {
+      if (level->min[c] < above->min[c]) above->min[c] = level->min[c];
+      if (level->max[c] > above->max[c]) above->max[c] = level->max[c];
+    }
+    if (++above->filled == PEAK_LEVEL_FACTOR && push_bucket(peaks, index + 1) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+  }
+  reset_level(level);
+  return SOX_SUCCESS;
+}
+
+peaks_t * peaks_create(unsigned channels)
+{
+  peaks_t * peaks;
+  unsigned i;
+
+  if (channels == 0 || channels > PEAKS_MAX_CHANNELS)
+  {
+    return NULL;
+  }
+  peaks = (peaks_t *)calloc(1, sizeof(peaks_t));
+  if (peaks == NULL)
+  {
+    return NULL;
+  }
+  peaks->channels = channels;
+  for (i = 0; i < PEAK_LEVELS; ++i)
+  {
+    reset_level(&peaks->levels[i]);
+  }
+  if (reduce_block == NULL)
+  {
+    reduce_block = choose_reducer();
+  }
+  return peaks;
+}
+
+/* Take in the next interleaved samples of the output, as they are stored
+ * (kernels) or decoded (kernels NULL). */
+static int add_samples(peaks_t * peaks, void const * data, size_t count,
+  native_kernels_t const * kernels)
+{
+  peak_level_t * level = &peaks->levels[0];
+  size_t bucket_samples = (size_t)PEAK_FINEST_BUCKET * peaks->channels;
+  unsigned char const * samples = (unsigned char const *)data;
+  size_t sample_bytes = kernels ? kernels->sample_bytes : sizeof(sox_sample_t);
+
+  while (count > 0)
+  {
+    size_t in_bucket = (size_t)level->filled * peaks->channels + peaks->channel;
+    size_t n = min(count, bucket_samples - in_bucket);
+
+    if (kernels)
+    {
+      kernels->extremes(samples, n, peaks->channels, peaks->channel, level->min, level->max);
+    } else {
+      reduce_block((sox_sample_t const *)samples, n, peaks->channels, peaks->channel,
+        level->min, level->max);
+    }
+    peaks->frames += (peaks->channel + n) / peaks->channels;
+    peaks->channel = (peaks->channel + n) % peaks->channels;
+    level->filled = (unsigned)((in_bucket + n) / peaks->channels);
+    if (in_bucket + n == bucket_samples && push_bucket(peaks, 0) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+    samples += n * sample_bytes;
+    count -= n;
+  }
+  return SOX_SUCCESS;
+}
+
+int peaks_add(peaks_t * peaks, sox_sample_t const * samples, size_t count)
+{
+  return add_samples(peaks, samples, count, NULL);
+}
+
+int peaks_add_native(peaks_t * peaks, void const * data, size_t count,
+  native_kernels_t const * kernels)
+{
+  return add_samples(peaks, data, count, kernels);
+}
+
+static void peaks_path(char const * output_filename, char * path, size_t path_size)
+{
+  StringCbPrintfA(path, path_size, "%s%s", output_filename, PEAKS_SUFFIX);
+}
+
+/* Finish off the last, partial, buckets and write the peak file. Like the
+ * journal, it is written aside and renamed into place. */
+int peaks_write(peaks_t * peaks, char const * output_filename)
+{
+  char path[MAX_PATH], temp_path[MAX_PATH];
+  size_t bucket_bytes = peaks->channels * 2 * sizeof(int16_t);
+  uint64_t offset = sizeof(peaks_header_t);
+  uint32_t frames_per_bucket = PEAK_FINEST_BUCKET;
+  peaks_header_t header;
+  FILE * file;
+  unsigned i;
+  int result = SOX_SUCCESS;
+
+  for (i = 0; i < PEAK_LEVELS; ++i)
+  {
+    if (peaks->levels[i].filled > 0 && push_bucket(peaks, i) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PEAKS_MAGIC, sizeof(header.magic));
+  header.channels = peaks->channels;
+  header.level_count = PEAK_LEVELS;
+  header.frames = peaks->frames;
+  for (i = 0; i < PEAK_LEVELS; ++i)
+  {
+    header.levels[i].frames_per_bucket = frames_per_bucket;
+    header.levels[i].bucket_count = peaks->levels[i].bucket_count;
+    header.levels[i].offset = offset;
+    offset += peaks->levels[i].bucket_count * bucket_bytes;
+    frames_per_bucket *= PEAK_LEVEL_FACTOR;
+  }
+
+  peaks_path(output_filename, path, sizeof(path));
+  StringCbPrintfA(temp_path, sizeof(temp_path), "%s.tmp", path);
+  file = fopen(temp_path, "wb");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    result = SOX_EOF;
+  }
+  for (i = 0; i < PEAK_LEVELS && result == SOX_SUCCESS; ++i)
+  {
+    size_t length = (size_t)peaks->levels[i].bucket_count * bucket_bytes;
+    if (length > 0 && fwrite(peaks->levels[i].buckets, 1, length, file) != length)
+    {
+      result = SOX_EOF;
+    }
+  }
+  if (fclose(file) != 0)
+  {
+    result = SOX_EOF;
+  }
+  if (result != SOX_SUCCESS
+      || !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+  {
+    DeleteFileA(temp_path);
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Drop a peak file that no longer matches the output. */
+void peaks_remove(char const * output_filename)
+{
+  char path[MAX_PATH];
+
+  peaks_path(output_filename, path, sizeof(path));
+  DeleteFileA(path);
+}
+
+void peaks_free(peaks_t * peaks)
+{
+  unsigned i;
+
+  if (peaks == NULL)
+  {
+    return;
+  }
+  for (i = 0; i < PEAK_LEVELS; ++i)
+  {
+    free(peaks->levels[i].buckets);
+  }
+  free(peaks);
+}
+
+int peaks_map_open(char const * output_filename, peaks_map_t * map)
+{
+  char path[MAX_PATH];
+  LARGE_INTEGER file_size;
+  peaks_header_t const * header;
+  unsigned i;
+
+  memset(map, 0, sizeof(*map));
+  peaks_path(output_filename, path, sizeof(path));
+  map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (map->file == INVALID_HANDLE_VALUE)
+  {
+    return SOX_EOF;
+  }
+  if (!GetFileSizeEx(map->file, &file_size)
+      || (uint64_t)file_size.QuadPart < sizeof(peaks_header_t)
+      || (map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL
+      || (map->view = (unsigned char const *)MapViewOfFile(map->mapping,
+           FILE_MAP_READ, 0, 0, 0)) == NULL)
+  {
+    peaks_map_close(map);
+    return SOX_EOF;
+  }
+  header = map->header = (peaks_header_t const *)map->view;
+  if (memcmp(header->magic, PEAKS_MAGIC, sizeof(header->magic)) != 0
+      || header->channels == 0 || header->channels > PEAKS_MAX_CHANNELS
+      || header->level_count != PEAK_LEVELS)
+  {
+    peaks_map_close(map);
+    return SOX_EOF;
+  }
+  for (i = 0; i < PEAK_LEVELS; ++i)
+  {
+    if (header->levels[i].frames_per_bucket == 0
+        || header->levels[i].offset + header->levels[i].bucket_count
+             * header->channels * 2 * sizeof(int16_t) > (uint64_t)file_size.QuadPart)
+    {
+      peaks_map_close(map);
+      return SOX_EOF;
+    }
+  }
+  return SOX_SUCCESS;
+}
+
+/* Fill in a min and max per channel for each of `columns` columns spanning
+ * the given frames, from the coarsest level that still has a bucket per
+ * column. Returns the number of columns filled, which is fewer if the
+ * frames run past the end of the output. */
+size_t peaks_lookup(peaks_map_t const * map, uint64_t first_frame, uint64_t frame_count,
+  size_t columns, int16_t * minmax)
+{
+  peaks_header_t const * header = map->header;
+  unsigned channels = header->channels;
+  uint64_t frames_per_column, frames_per_bucket, bucket_count;
+  int16_t const * buckets;
+  unsigned level = 0, c;
+  size_t column;
+
+  if (columns == 0 || frame_count == 0)
+  {
+    return 0;
+  }
+  frames_per_column = frame_count / columns;
+  while (level + 1 < PEAK_LEVELS
+      && header->levels[level + 1].frames_per_bucket <= frames_per_column)
+  {
+    ++level;
+  }
+  frames_per_bucket = header->levels[level].frames_per_bucket;
+  bucket_count = header->levels[level].bucket_count;
+  buckets = (int16_t const *)(map->view + header->levels[level].offset);
+
+  for (column = 0; column < columns; ++column)
+  {
+    uint64_t start = first_frame + frame_count * column / columns;
+    uint64_t end = first_frame + frame_count * (column + 1) / columns;
+    uint64_t bucket = start / frames_per_bucket;
+    uint64_t last = (end + frames_per_bucket - 1) / frames_per_bucket;
+    int16_t * out = minmax + column * channels * 2;
+
+    if (bucket >= bucket_count)
+    {
+      break;
+    }
+    if (last <= bucket)
+    {
+      last = bucket + 1;
+    }
+    if (last > bucket_count)
+    {
+      last = bucket_count;
+    }
+    for (c = 0; c < channels; ++c)
+    {
+      out[2 * c] = INT16_MAX;
+      out[2 * c + 1] = INT16_MIN;
+    }
+    for (; bucket < last; ++bucket)
+    {
+      int16_t const * in = buckets + (size_t)bucket * channels * 2;
+      for (c = 0; c < channels; ++c)
+      {
+        if (in[2 * c] < out[2 * c]) out[2 * c] = in[2 * c];
+        if (in[2 * c + 1] > out[2 * c + 1]) out[2 * c + 1] = in[2 * c + 1];
+      }
+    }
+  }
+  return column;
+}
+
+void peaks_map_close(peaks_map_t * map)
+{
+  if (map->view != NULL)
+  {
+    UnmapViewOfFile(map->view);
+  }
+  if (map->mapping != NULL)
+  {
+    CloseHandle(map->mapping);
+  }
+  if (map->file != NULL && map->file != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(map->file);
+  }
+  memset(map, 0, sizeof(*map));
+}
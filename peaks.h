@@ -0,0 +1,84 @@
+/* peaks.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the waveform peak file, a
+ * min/max pyramid of the spliced output for drawing it at any zoom.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+#include "native-pcm.h"
+
+#define PEAKS_SUFFIX ".peaks"
+#define PEAKS_MAGIC "SPLPEAK1"
+#define PEAK_LEVELS 3
+#define PEAK_FINEST_BUCKET 256    /* Frames per bucket at level 0... */
+#define PEAK_LEVEL_FACTOR 16      /* ...times this at each level up: 4096, 65536 */
+#define PEAKS_MAX_CHANNELS 16
+
+/* The file starts with this header. Each level is an array of buckets,
+ * each holding a min and a max per channel, as 16-bit values. */
+typedef struct {
+  char magic[8];
+  uint32_t channels;
+  uint32_t level_count;
+  uint64_t frames;
+  struct {
+    uint32_t frames_per_bucket;
+    uint32_t reserved;
+    uint64_t bucket_count;
+    uint64_t offset;        /* From the start of the file */
+  } levels[PEAK_LEVELS];
+} peaks_header_t;
+
+/* A level being built: the finished buckets, and the one being filled. */
+typedef struct {
+  int16_t * buckets;
+  uint64_t bucket_count;
+  uint64_t allocated;
+  sox_sample_t min[PEAKS_MAX_CHANNELS], max[PEAKS_MAX_CHANNELS];
+  unsigned filled;          /* Frames (level 0) or buckets below, so far */
+} peak_level_t;
+
+typedef struct {
+  unsigned channels;
+  unsigned channel;         /* Channel of the next sample to arrive */
+  uint64_t frames;
+  peak_level_t levels[PEAK_LEVELS];
+} peaks_t;
+
+/* A peak file mapped into memory for reading. */
+typedef void (* peak_reducer_t)(sox_sample_t const * samples, size_t count,
+  unsigned channels, unsigned channel, sox_sample_t * min, sox_sample_t * max);
+
+/* The ways decoded samples can be reduced, each needing the CPU feature
+ * named (or none); for the benchmark. */
+typedef struct {
+  char const * name;
+  char const * feature;     /* As __builtin_cpu_supports() takes it, or NULL */
+  peak_reducer_t reduce;
+} peak_variant_t;
+
+extern peak_variant_t const peak_variants[]; /* Ending with a NULL name */
+
+typedef struct {
+  HANDLE file, mapping;
+  unsigned char const * view;
+  peaks_header_t const * header;
+} peaks_map_t;
+
+peaks_t * peaks_create(unsigned channels);
+int peaks_add(peaks_t * peaks, sox_sample_t const * samples, size_t count);
+int peaks_add_native(peaks_t * peaks, void const * data, size_t count,
+  native_kernels_t const * kernels);
+int peaks_write(peaks_t * peaks, char const * output_filename);
+void peaks_remove(char const * output_filename);
+void peaks_free(peaks_t * peaks);
+int peaks_map_open(char const * output_filename, peaks_map_t * map);
+size_t peaks_lookup(peaks_map_t const * map, uint64_t first_frame, uint64_t frame_count,
+  size_t columns, int16_t * minmax);
+void peaks_map_close(peaks_map_t * map);
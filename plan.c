@@ -0,0 +1,249 @@
+/* plan.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The splice plan. Everything about the output but its samples follows
+ * from the inputs' lengths: how long it is, how big, where each track
+ * lands in it, and whether it needs a container with 64-bit sizes. The
+ * lengths come from the headers, or, for a file the last splice read and
+ * that hasn't changed since, from its manifest (which also knows the ones
+ * a header leaves out). So the plan costs opening each file at most, and
+ * no decoding; splice() uses it to set aside the whole file before writing
+ * it, and it can be reported on its own, as a dry run.
+ *
+ * The splice butts the files together, and trimming rewrites the files
+ * before they are spliced, so there are no overlaps or trims to allow for.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+/* The track's length as the last splice found it, if that was of this
+ * same file, untouched since. */
+static int manifest_samples(manifest_t const * manifest, size_t index, char const * filename,
+  uint64_t * samples)
+{
+  manifest_track_t const * track;
+  uint64_t size, time;
+
+  if (index >= manifest->track_count)
+  {
+    return SOX_EOF;
+  }
+  track = &manifest->tracks[index];
+  if (track->filename == NULL || strcmp(track->filename, job_base_name(filename)) != 0
+      || manifest_stat(filename, &size, &time) != SOX_SUCCESS
+      || size != track->file_size || time != track->file_time)
+  {
+    return SOX_EOF;
+  }
+  *samples = track->samples;
+  return SOX_SUCCESS;
+}
+
+/* What the input's header says: its length, and for the first input, the
+ * signal and encoding the output takes from it. The encoding is the PCM
+ * one its samples will be written in (16-bit, if the job asks for that
+ * and they have more). The other inputs must match its signal. */
+static int read_header(job_t * job, size_t index, splice_plan_t * plan, uint64_t * samples)
+{
+  sox_format_t * input = sox_open_read(job->filenames[index], NULL, NULL, NULL);
+  int result = SOX_SUCCESS;
+
+  if (input == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (index == 0)
+  {
+    plan->signal = input->signal;
+    decoder_pcm_encoding(&input->encoding, &plan->encoding);
+    if (job->output_bits == 16 && plan->encoding.bits_per_sample > 16)
+    {
+      plan->encoding.encoding = SOX_ENCODING_SIGN2;
+      plan->encoding.bits_per_sample = 16;
+    }
+  }
+  else if (input->signal.channels != plan->signal.channels
+      || input->signal.rate != plan->signal.rate)
+  {
+    result = SOX_EOF;
+  }
+  *samples = input->signal.length == 0 ? PLAN_UNKNOWN : input->signal.length;
+  sox_close(input);
+  return result;
+}
+
+/* Place the tracks one after another, and choose the container. */
+static void lay_out(splice_plan_t * plan)
+{
+  unsigned bytes_per_sample = plan->encoding.bits_per_sample / 8;
+  size_t i;
+
+  for (i = 0; i < plan->track_count; ++i)
+  {
+    plan_track_t * track = &plan->tracks[i];
+
+    track->byte_offset = plan->data_bytes;
+    track->byte_length = track->samples == PLAN_UNKNOWN ? PLAN_UNKNOWN
+      : track->samples * bytes_per_sample;
+    if (track->samples == PLAN_UNKNOWN || plan->samples == PLAN_UNKNOWN)
+    {
+      /* (And so is everything after it.) */
+      plan->samples = plan->data_bytes = PLAN_UNKNOWN;
+    } else {
+      plan->samples += track->samples;
+      plan->data_bytes += track->byte_length;
+    }
+  }
+  /* Any output we can pack, splice() writes itself; beyond 4 GB (or when
+   * we can't tell) it goes in a container with 64-bit sizes. The rest is
+   * written by libSoX, with a header of its own. */
+  plan->raw = wav_can_pack(plan->encoding.encoding, plan->encoding.bits_per_sample);
+  plan->layout.container = plan->data_bytes > RIFF_MAX_DATA_BYTES
+    ? LARGE_OUTPUT_CONTAINER : WAV_CONTAINER_RIFF;
+  plan->layout.rate = plan->signal.rate;
+  plan->layout.channels = plan->signal.channels;
+  plan->layout.bits_per_sample = plan->encoding.bits_per_sample;
+  plan->layout.encoding = plan->encoding.encoding;
+  plan->file_bytes = wav_file_bytes(&plan->layout,
+    plan->data_bytes == PLAN_UNKNOWN ? 0 : plan->data_bytes);
+  if (!plan->raw || plan->data_bytes == PLAN_UNKNOWN)
+  {
+    plan->file_bytes = PLAN_UNKNOWN;
+  }
+}
+
+/* Work out the output of splicing the job's files, without reading any of
+ * their samples. Free it with plan_free(), whatever this returns. */
+int plan_splice(job_t * job, splice_plan_t * plan)
+{
+  manifest_t manifest;
+  int indexed, result = SOX_SUCCESS;
+  size_t i;
+
+  memset(plan, 0, sizeof(*plan));
+  if (job->file_count == 0)
+  {
+    return SOX_EOF;
+  }
+  plan->tracks = (plan_track_t *)calloc(job->file_count, sizeof(plan_track_t));
+  if (plan->tracks == NULL)
+  {
+    return SOX_EOF;
+  }
+  plan->track_count = job->file_count;
+  indexed = manifest_read(job->output_filename, &manifest) == SOX_SUCCESS;
+  for (i = 0; i < job->file_count && result == SOX_SUCCESS; ++i)
+  {
+    plan_track_t * track = &plan->tracks[i];
+
+    track->filename = job->filenames[i];
+    /* The first header is needed for the signal whatever the manifest says. */
+    if (i == 0)
+    {
+      result = read_header(job, i, plan, &track->samples);
+    }
+    if (result == SOX_SUCCESS && indexed
+        && manifest_samples(&manifest, i, job->filenames[i], &track->samples) == SOX_SUCCESS)
+    {
+      track->from_manifest = 1;
+    }
+    else if (result == SOX_SUCCESS && i > 0)
+    {
+      result = read_header(job, i, plan, &track->samples);
+    }
+  }
+  if (indexed)
+  {
+    manifest_free(&manifest);
+  }
+  if (result != SOX_SUCCESS)
+  {
+    plan_free(plan);
+    return SOX_EOF;
+  }
+  lay_out(plan);
+  return SOX_SUCCESS;
+}
+
+/* A length of the output as h:mm:ss.mmm. */
+static void format_time(splice_plan_t const * plan, uint64_t samples, char * text, size_t size)
+{
+  uint64_t ms;
+
+  if (samples == PLAN_UNKNOWN)
+  {
+    StringCbCopyA(text, size, "unknown");
+    return;
+  }
+  ms = (uint64_t)((double)(samples / max(plan->signal.channels, 1)) * 1000
+    / max(plan->signal.rate, 1));
+  StringCbPrintfA(text, size, "%u:%02u:%02u.%03u", (unsigned)(ms / 3600000),
+    (unsigned)(ms / 60000 % 60), (unsigned)(ms / 1000 % 60), (unsigned)(ms % 1000));
+}
+
+static char const * container_name(splice_plan_t const * plan)
+{
+  if (!plan->raw)
+  {
+    return "WAV by libSoX";
+  }
+  switch (plan->layout.container)
+  {
+  case WAV_CONTAINER_RF64:
+    return "RF64";
+  case WAV_CONTAINER_W64:
+    return "Wave64";
+  default:
+    return "RIFF";
+  }
+}
+
+/* Report the plan without splicing anything: the output's length, size
+ * and container, then where each track starts and how long it is. */
+void plan_report(job_t * job, splice_plan_t const * plan)
+{
+  arena_mark_t mark = arena_mark(&job->arena);
+  size_t size = (plan->track_count + 1) * (MAX_PATH + 64), i;
+  char * message = (char *)arena_alloc(&job->arena, size);
+  char line[MAX_PATH + 64], start[32], length[32], bytes[32];
+
+  if (message == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return;
+  }
+  format_time(plan, plan->samples, length, sizeof(length));
+  if (plan->file_bytes == PLAN_UNKNOWN)
+  {
+    StringCbCopyA(bytes, sizeof(bytes), "unknown");
+  } else {
+    StringCbPrintfA(bytes, sizeof(bytes), "%" PRIu64, plan->file_bytes);
+  }
+  StringCbPrintfA(message, size, "%s: %s, %s bytes (%s)", job_base_name(job->output_filename),
+    length, bytes, container_name(plan));
+  for (i = 0; i < plan->track_count; ++i)
+  {
+    plan_track_t const * track = &plan->tracks[i];
+
+    format_time(plan, track->byte_offset == PLAN_UNKNOWN ? PLAN_UNKNOWN
+      : track->byte_offset / (plan->encoding.bits_per_sample / 8), start, sizeof(start));
+    format_time(plan, track->samples, length, sizeof(length));
+    StringCbPrintfA(line, sizeof(line), "\n%s at %s, %s", job_base_name(track->filename),
+      start, length);
+    StringCbCatA(message, size, line);
+  }
+  report_current_action(NULL, message);
+  arena_release(&job->arena, mark);
+}
+
+void plan_free(splice_plan_t * plan)
+{
+  free(plan->tracks);
+  plan->tracks = NULL;
+  plan->track_count = 0;
+}
@@ -0,0 +1,41 @@
+/* plan.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the splice plan: the output's
+ * layout, worked out from the inputs' headers before anything is written.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sox.h"
+#include "wav-io.h"
+#include "job.h"
+
+#define PLAN_UNKNOWN UINT64_MAX /* A length no header (or manifest) gives */
+
+/* Where one input lands in the output. */
+typedef struct {
+  char const * filename;    /* The job's */
+  uint64_t samples;         /* Interleaved, as libSoX counts them... */
+  uint64_t byte_offset;     /* ...and where they go, from the start of the data chunk... */
+  uint64_t byte_length;     /* ...and how long they are there */
+  int from_manifest;        /* Known from the last splice, rather than from the header */
+} plan_track_t;
+
+typedef struct {
+  sox_signalinfo_t signal;      /* The first input's */
+  sox_encodinginfo_t encoding;  /* What the output's samples are written in */
+  int raw;                      /* Whether splice() writes the WAV itself... */
+  wav_layout_t layout;          /* ...in this container, data_offset and all */
+  uint64_t samples;             /* All the tracks' */
+  uint64_t data_bytes;          /* ...and the data chunk's length */
+  uint64_t file_bytes;          /* The whole file, where splice() writes it itself */
+  size_t track_count;
+  plan_track_t * tracks;
+} splice_plan_t;
+
+int plan_splice(job_t * job, splice_plan_t * plan);
+void plan_report(job_t * job, splice_plan_t const * plan);
+void plan_free(splice_plan_t * plan);
@@ -0,0 +1,160 @@
+/* scratch.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Scratch storage for effects that have to hold on to all of their input,
+ * like the reverse in the trim chain. libSoX's own reverse puts it in
+ * libSoX.tmp* files in the temp folder, which Windows won't let it delete
+ * while they are open, so they were left for cleanup() to sweep up by
+ * wildcard, and every job in every process shared the folder. Here it goes
+ * in memory, reserved once and committed as it fills, and only what won't
+ * fit in the budget goes to disk: to a file in the job's own folder that
+ * Windows deletes as soon as it is closed.
+ *
+ */
+
+#include "wt.h"
+#include <string.h>
+#include <strsafe.h>
+
+void scratch_init(scratch_t * scratch, char const * spill_directory, size_t budget,
+  budget_account_t * account)
+{
+  memset(scratch, 0, sizeof(*scratch));
+  scratch->spill_directory = spill_directory;
+  scratch->budget = budget - budget % SCRATCH_COMMIT_BYTES;
+  scratch->account = account;
+  scratch->spill = INVALID_HANDLE_VALUE;
+}
+
+/* Find out how much the job can spare for memory, and reserve that. If it
+ * is less than was hoped for, or the reserve fails, more of it spills. */
+static void reserve_memory(scratch_t * scratch)
+{
+  size_t granted;
+
+  granted = budget_charge(scratch->account, scratch->budget, SCRATCH_COMMIT_BYTES);
+  scratch->in_memory = granted - granted % SCRATCH_COMMIT_BYTES;
+  budget_release(scratch->account, granted - scratch->in_memory);
+  if (scratch->in_memory > 0)
+  {
+    scratch->memory = (unsigned char *)VirtualAlloc(NULL, scratch->in_memory, MEM_RESERVE,
+      PAGE_READWRITE);
+  }
+  if (scratch->memory == NULL)
+  {
+    budget_release(scratch->account, scratch->in_memory);
+    scratch->in_memory = 0;
+  }
+}
+
+/* Make sure the memory holds at least `size` bytes. */
+static int commit_memory(scratch_t * scratch, size_t size)
+{
+  size_t grow;
+
+  if (size <= scratch->committed)
+  {
+    return SOX_SUCCESS;
+  }
+  grow = size - scratch->committed;
+  grow += (SCRATCH_COMMIT_BYTES - grow % SCRATCH_COMMIT_BYTES) % SCRATCH_COMMIT_BYTES;
+  if (VirtualAlloc(scratch->memory + scratch->committed, grow, MEM_COMMIT,
+        PAGE_READWRITE) == NULL)
+  {
+    return SOX_EOF;
+  }
+  scratch->committed += grow;
+  return SOX_SUCCESS;
+}
+
+static int open_spill(scratch_t * scratch)
+{
+  char path[MAX_PATH];
+
+  if ((!CreateDirectoryA(scratch->spill_directory, NULL)
+        && GetLastError() != ERROR_ALREADY_EXISTS)
+      || FAILED(StringCbPrintfA(path, sizeof(path), "%s\\spill-%p.tmp",
+           scratch->spill_directory, (void *)scratch)))
+  {
+    return SOX_EOF;
+  }
+  scratch->spill = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+  return scratch->spill == INVALID_HANDLE_VALUE ? SOX_EOF : SOX_SUCCESS;
+}
+
+int scratch_write(scratch_t * scratch, void const * bytes, size_t length)
+{
+  unsigned char const * p = (unsigned char const *)bytes;
+
+  if (scratch->size == 0 && scratch->memory == NULL && scratch->budget > 0)
+  {
+    reserve_memory(scratch);
+  }
+  if (scratch->size < scratch->in_memory)
+  {
+    size_t n = (size_t)min(length, scratch->in_memory - scratch->size);
+    if (commit_memory(scratch, (size_t)scratch->size + n) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+    memcpy(scratch->memory + scratch->size, p, n);
+    scratch->size += n;
+    p += n;
+    length -= n;
+  }
+  if (length == 0)
+  {
+    return SOX_SUCCESS;
+  }
+  if (scratch->spill == INVALID_HANDLE_VALUE && open_spill(scratch) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  if (wav_write_at(scratch->spill, scratch->size - scratch->in_memory, p, length) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  scratch->size += length;
+  return SOX_SUCCESS;
+}
+
+int scratch_read_at(scratch_t * scratch, uint64_t offset, void * bytes, size_t length)
+{
+  unsigned char * p = (unsigned char *)bytes;
+
+  if (offset + length > scratch->size)
+  {
+    return SOX_EOF;
+  }
+  if (offset < scratch->in_memory)
+  {
+    size_t n = (size_t)min(length, scratch->in_memory - offset);
+    memcpy(p, scratch->memory + offset, n);
+    offset += n;
+    p += n;
+    length -= n;
+  }
+  if (length == 0)
+  {
+    return SOX_SUCCESS;
+  }
+  return wav_read_at(scratch->spill, offset - scratch->in_memory, p, length);
+}
+
+/* Give back the memory, its charge, and the spill file (which goes with
+ * it). */
+void scratch_free(scratch_t * scratch)
+{
+  if (scratch->memory != NULL)
+  {
+    VirtualFree(scratch->memory, 0, MEM_RELEASE);
+    budget_release(scratch->account, scratch->in_memory);
+  }
+  if (scratch->spill != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(scratch->spill);
+  }
+  scratch_init(scratch, scratch->spill_directory, scratch->budget, scratch->account);
+}
@@ -0,0 +1,35 @@
+/* scratch.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for effect scratch storage, kept in
+ * memory up to a budget and spilled to a file beyond it.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+#include "budget.h"
+
+#define SCRATCH_COMMIT_BYTES ((size_t)1024 * 1024) /* Memory is committed this much at a time */
+
+/* Bytes written one after another and read back in any order. The first
+ * `in_memory` of them are in memory, the rest in the spill file. */
+typedef struct {
+  char const * spill_directory;   /* The job's, made when first needed */
+  size_t budget;                  /* The most it would like in memory... */
+  budget_account_t * account;     /* ...asked of the job's share of the memory budget... */
+  size_t in_memory;               /* ...and what it was given, when first needed */
+  unsigned char * memory;         /* That much reserved... */
+  size_t committed;               /* ...and this much of it committed */
+  uint64_t size;                  /* Bytes written so far */
+  HANDLE spill;                   /* Deleted when closed */
+} scratch_t;
+
+void scratch_init(scratch_t * scratch, char const * spill_directory, size_t budget,
+  budget_account_t * account);
+int scratch_write(scratch_t * scratch, void const * bytes, size_t length);
+int scratch_read_at(scratch_t * scratch, uint64_t offset, void * bytes, size_t length);
+void scratch_free(scratch_t * scratch);
@@ -0,0 +1,298 @@
+/* server.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The job server ("splice /serve"). Starting the application costs
+ * sox_init() and the registration of every format handler, and quitting
+ * costs sox_quit(); a batch script that starts it once per folder pays
+ * that for every folder. The server pays it once, then runs the jobs sent
+ * by "splice /submit <job> <folder>", one at a time, over a named pipe.
+ * Between jobs it keeps libSoX, the effect handlers, OpenMP's threads and
+ * the lengths of the files it has already measured.
+ *
+ * A request is one message, "<job> <folder>", where the job is splice,
+ * resplice, flac, splice16, deliver, preview, plan, duration or verify (or
+ * just "quit"). The reply is "ok <milliseconds> ms", "ok <seconds>" for a
+ * duration, "ok <bytes> bytes" for a plan (the plan itself is logged), or
+ * "error"; the details of any error are in splice-server.log.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+LONG volatile errors_reported;
+
+static size_t duration_slot(duration_cache_t const * cache, char const * filename)
+{
+  size_t slot = (size_t)fingerprint_bytes(FINGERPRINT_SEED, filename, strlen(filename))
+    & (cache->capacity - 1);
+
+  while (cache->entries[slot].filename != NULL
+      && strcmp(cache->entries[slot].filename, filename) != 0)
+  {
+    slot = (slot + 1) & (cache->capacity - 1);
+  }
+  return slot;
+}
+
+duration_entry_t * duration_cache_find(duration_cache_t * cache, char const * filename)
+{
+  duration_entry_t * entry;
+
+  if (cache->capacity == 0)
+  {
+    return NULL;
+  }
+  entry = &cache->entries[duration_slot(cache, filename)];
+  return entry->filename == NULL ? NULL : entry;
+}
+
+/* Remember (or update) the length of a file. Kept at most half full. */
+int duration_cache_store(duration_cache_t * cache, char const * filename, uint64_t file_size,
+  uint64_t file_time, double seconds)
+{
+  duration_entry_t * entry;
+
+  if ((cache->entry_count + 1) * 2 > cache->capacity)
+  {
+    duration_cache_t larger;
+    size_t i;
+
+    larger.capacity = cache->capacity == 0 ? 256 : cache->capacity * 2;
+    larger.entry_count = cache->entry_count;
+    larger.entries = (duration_entry_t *)calloc(larger.capacity, sizeof(duration_entry_t));
+    if (larger.entries == NULL)
+    {
+      return SOX_EOF;
+    }
+    for (i = 0; i < cache->capacity; ++i)
+    {
+      if (cache->entries[i].filename != NULL)
+      {
+        larger.entries[duration_slot(&larger, cache->entries[i].filename)] = cache->entries[i];
+      }
+    }
+    free(cache->entries);
+    *cache = larger;
+  }
+  entry = &cache->entries[duration_slot(cache, filename)];
+  if (entry->filename == NULL)
+  {
+    entry->filename = _strdup(filename);
+    if (entry->filename == NULL)
+    {
+      return SOX_EOF;
+    }
+    cache->entry_count++;
+  }
+  entry->file_size = file_size;
+  entry->file_time = file_time;
+  entry->seconds = seconds;
+  return SOX_SUCCESS;
+}
+
+void duration_cache_free(duration_cache_t * cache)
+{
+  size_t i;
+
+  for (i = 0; i < cache->capacity; ++i)
+  {
+    free(cache->entries[i].filename);
+  }
+  free(cache->entries);
+  cache->entries = NULL;
+  cache->entry_count = cache->capacity = 0;
+}
+
+/* Run one request and put the reply together. Returns 1 if the server
+ * has been asked to quit. */
+static int serve_request(duration_cache_t * durations, char * request, char * reply,
+  size_t reply_size)
+{
+  WCHAR folder[MAX_PATH];
+  char * job_name = request, * path, message[MAX_PATH + 100];
+  LONG errors = errors_reported;
+  LARGE_INTEGER start, end, frequency;
+  double seconds = 0;
+  uint64_t planned_bytes = PLAN_UNKNOWN;
+  splice_plan_t plan;
+  job_t * job = NULL;
+
+  request[strcspn(request, "\r\n")] = '\0';
+  path = strchr(request, ' ');
+  if (path != NULL)
+  {
+    *path++ = '\0';
+  }
+  if (strcmp(job_name, "quit") == 0)
+  {
+    StringCbCopyA(reply, reply_size, "ok\n");
+    return 1;
+  }
+  if ((strcmp(job_name, "splice") != 0 && strcmp(job_name, "resplice") != 0
+        && strcmp(job_name, "flac") != 0 && strcmp(job_name, "splice16") != 0
+        && strcmp(job_name, "deliver") != 0 && strcmp(job_name, "preview") != 0
+        && strcmp(job_name, "plan") != 0 && strcmp(job_name, "duration") != 0
+        && strcmp(job_name, "verify") != 0)
+      || path == NULL
+      || MultiByteToWideChar(CP_UTF8, 0, path, -1, folder, MAX_PATH) == 0
+      || (job = job_create(folder)) == NULL)
+  {
+    StringCbCopyA(reply, reply_size, "error\n");
+    return 0;
+  }
+  QueryPerformanceCounter(&start);
+  job->durations = durations;
+  if (strcmp(job_name, "flac") == 0 && job_set_output_format(job, OUTPUT_FLAC) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+  else if (strcmp(job_name, "verify") == 0)
+  {
+    /* Needs only the output and its manifest. */
+    verify(job);
+  }
+  else if (load_filenames(job) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+  else if (job->file_count > 0)
+  {
+    if (strcmp(job_name, "resplice") == 0)
+    {
+      resplice(job);
+    }
+    else if (strcmp(job_name, "duration") == 0)
+    {
+      seconds = total_duration(job);
+    }
+    else if (strcmp(job_name, "deliver") == 0)
+    {
+      splice_deliverables(job);
+    }
+    else if (strcmp(job_name, "preview") == 0)
+    {
+      preview_joins(job);
+    }
+    else if (strcmp(job_name, "plan") == 0)
+    {
+      if (plan_splice(job, &plan) == SOX_SUCCESS)
+      {
+        plan_report(job, &plan);
+        planned_bytes = plan.file_bytes;
+      } else {
+        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      }
+      plan_free(&plan);
+    } else {
+      job->output_bits = strcmp(job_name, "splice16") == 0 ? 16 : 0;
+      splice(job);
+    }
+  }
+  /* For sizing MEMORY_BUDGET against what jobs actually use. */
+  StringCbPrintfA(message, sizeof(message),
+    "%s %s: buffers peaked at %.1f MB (all jobs: %.1f MB)", job_name, path,
+    job->memory.high_water / 1048576.0, budget_high_water() / 1048576.0);
+  report_current_action(NULL, message);
+  job_free(job);
+  QueryPerformanceCounter(&end);
+  QueryPerformanceFrequency(&frequency);
+  if (errors_reported != errors)
+  {
+    StringCbCopyA(reply, reply_size, "error\n");
+  }
+  else if (strcmp(job_name, "duration") == 0)
+  {
+    StringCbPrintfA(reply, reply_size, "ok %.3f\n", seconds);
+  }
+  else if (strcmp(job_name, "plan") == 0)
+  {
+    if (planned_bytes == PLAN_UNKNOWN)
+    {
+      StringCbCopyA(reply, reply_size, "ok unknown bytes\n");
+    } else {
+      StringCbPrintfA(reply, reply_size, "ok %" PRIu64 " bytes\n", planned_bytes);
+    }
+  } else {
+    StringCbPrintfA(reply, reply_size, "ok %lu ms\n",
+      (unsigned long)((end.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart));
+  }
+  return 0;
+}
+
+/* Serve requests until one says "quit". libSoX must be initialised. A
+ * second server finds the pipe taken, and gives up. */
+int server_run(void)
+{
+  duration_cache_t durations;
+  char request[SERVER_MESSAGE_BYTES], reply[SERVER_MESSAGE_BYTES];
+  HANDLE pipe;
+  DWORD bytes;
+  int quit = 0;
+
+  memset(&durations, 0, sizeof(durations));
+  pipe = CreateNamedPipeW(SERVER_PIPE_NAME,
+    PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+    PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+    1, SERVER_MESSAGE_BYTES, SERVER_MESSAGE_BYTES, 0, NULL);
+  if (pipe == INVALID_HANDLE_VALUE)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return SOX_EOF;
+  }
+  while (!quit)
+  {
+    if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      break;
+    }
+    if (ReadFile(pipe, request, sizeof(request) - 1, &bytes, NULL))
+    {
+      request[bytes] = '\0';
+      quit = serve_request(&durations, request, reply, sizeof(reply));
+      WriteFile(pipe, reply, (DWORD)strlen(reply), &bytes, NULL);
+      FlushFileBuffers(pipe);
+    }
+    DisconnectNamedPipe(pipe);
+  }
+  CloseHandle(pipe);
+  duration_cache_free(&durations);
+  return quit ? SOX_SUCCESS : SOX_EOF;
+}
+
+/* Send a job to the server and wait for its reply. folder may be NULL
+ * (for "quit"). */
+int server_submit(PCWSTR job_name, PCWSTR folder, char * reply, size_t reply_size)
+{
+  char request[SERVER_MESSAGE_BYTES];
+  int length;
+  DWORD bytes;
+
+  length = WideCharToMultiByte(CP_UTF8, 0, job_name, -1, request, sizeof(request), NULL, NULL);
+  if (length == 0)
+  {
+    return SOX_EOF;
+  }
+  if (folder != NULL)
+  {
+    request[length - 1] = ' ';
+    if (WideCharToMultiByte(CP_UTF8, 0, folder, -1, request + length,
+          sizeof(request) - length, NULL, NULL) == 0)
+    {
+      return SOX_EOF;
+    }
+  }
+  if (!CallNamedPipeW(SERVER_PIPE_NAME, request, (DWORD)strlen(request), reply,
+        (DWORD)reply_size - 1, &bytes, NMPWAIT_WAIT_FOREVER))
+  {
+    StringCbCopyA(reply, reply_size, "error no server\n");
+    return SOX_EOF;
+  }
+  reply[bytes] = '\0';
+  return strncmp(reply, "ok", 2) == 0 ? SOX_SUCCESS : SOX_EOF;
+}
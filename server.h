@@ -0,0 +1,38 @@
+/* server.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the job server, which keeps
+ * libSoX initialised between jobs sent to it over a named pipe.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+
+#define SERVER_PIPE_NAME L"\\\\.\\pipe\\splice-jobs"
+#define SERVER_MESSAGE_BYTES (MAX_PATH * 4)     /* A request: "<job> <folder>" in UTF-8 */
+#define SERVER_LOG_FILENAME "splice-server.log" /* In the temporary folder */
+
+/* The length of an input, for as long as its size and time stay the same. */
+typedef struct {
+  char * filename;
+  uint64_t file_size, file_time;
+  double seconds;
+} duration_entry_t;
+
+/* Open-addressed on the filename; the capacity is a power of two. */
+typedef struct {
+  duration_entry_t * entries;
+  size_t entry_count, capacity;
+} duration_cache_t;
+
+extern LONG volatile errors_reported;   /* Counted by report_error() */
+
+duration_entry_t * duration_cache_find(duration_cache_t * cache, char const * filename);
+int duration_cache_store(duration_cache_t * cache, char const * filename, uint64_t file_size,
+  uint64_t file_time, double seconds);
+void duration_cache_free(duration_cache_t * cache);
+int server_run(void);
+int server_submit(PCWSTR job_name, PCWSTR folder, char * reply, size_t reply_size);
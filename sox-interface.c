@@ -9,6 +9,8 @@
 #include "wt.h"
 #include <strsafe.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "xmalloc.h"
 
@@ -35,20 +37,20 @@ typedef struct {
  *
  */
 
-static sox_format_t * in, * out;
+static LONG sox_quit_called;
 
-TCHAR const * str_time(double seconds)
+TCHAR const * str_time(job_t * job, double seconds)
 {
-  static TCHAR string[16][50];
+  TCHAR (* string)[50] = job->time_strings;
   size_t cchDest = 50;
-  static int i;
+  unsigned i;
   LPCTSTR pszFormatWithHours = L"%02i:%02i:%02.0f";
   LPCTSTR pszFormat = L"%02i:%02.0f";
   int hours, mins = seconds / 60;
   seconds -= mins * 60;
   hours = mins / 60;
   mins -= hours * 60;
-  i = (i+1) & 15;
+  i = job->time_string_index = (job->time_string_index + 1) % JOB_TIME_STRINGS;
   if (hours > 0)
   {
     StringCchPrintfW(string[i], cchDest * sizeof(TCHAR), pszFormatWithHours, hours, mins, seconds);
@@ -58,242 +60,1900 @@ TCHAR const * str_time(double seconds)
   return string[i];
 }
 
-void show_name_and_runtime(sox_format_t * in)
+void show_name_and_runtime(job_t * job, sox_format_t * in)
 {
   double secs;
   uint64_t ws;
   PWSTR msgbuf, filenamebuf;
+  arena_mark_t mark = arena_mark(&job->arena);
 
   TCHAR *msg_template = L"%s ... %-15.15s\n";
-  size_t buffer_size = (MAX_PATH + wcslen(msg_template) + 20) * sizeof(WCHAR);
-  msgbuf = (PWSTR)CoTaskMemAlloc(buffer_size);
   ws = in->signal.length / max(in->signal.channels, 1);
   secs = (double)ws / max(in->signal.rate, 1);
-  int filename_length = MultiByteToWideChar(CP_ACP, 0, in->filename, -1, NULL, 0);
-  filenamebuf = (PWSTR)CoTaskMemAlloc(filename_length * sizeof(WCHAR));
-  MultiByteToWideChar(CP_ACP, 0, in->filename, -1, filenamebuf, filename_length);
-  StringCbPrintfW(msgbuf, buffer_size, msg_template, filenamebuf, str_time(secs));
-  MessageBox(NULL, msgbuf, L"FILE DETAILS", MB_OK);
-  CoTaskMemFree(filenamebuf);
-  CoTaskMemFree(msgbuf);
+  filenamebuf = arena_wide(&job->arena, in->filename);
+  if (filenamebuf != NULL)
+  {
+    size_t buffer_size = (wcslen(filenamebuf) + wcslen(msg_template) + 50) * sizeof(WCHAR);
+    msgbuf = (PWSTR)arena_alloc(&job->arena, buffer_size);
+    if (msgbuf != NULL)
+    {
+      StringCbPrintfW(msgbuf, buffer_size, msg_template, filenamebuf, str_time(job, secs));
+      MessageBox(NULL, msgbuf, L"FILE DETAILS", MB_OK);
+    }
+  }
+  arena_release(&job->arena, mark);
+}
+
+/* Trim with the reverse/silence/reverse/silence chain, for when the
+ * envelope can't be used. The job keeps the chain for the next file. */
+static void trim_silence_with_effects(job_t * job, char const * path, char * duration,
+  char * threshold)
+{
+  char temp_path[MAX_PATH];
+  int result;
+
+  /* Each job trims into its own temporary file. */
+  StringCbPrintfA(temp_path, sizeof(temp_path), "%s\\trim-%lu.tmp",
+    job->directory_name, GetCurrentThreadId());
+  job->in = sox_open_read(path, NULL, NULL, NULL);
+  if (job->in == NULL)
+  {
+    report_error(NULL, errno, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  job->out = sox_open_write(temp_path, &job->in->signal, NULL, job->in->filetype, NULL, NULL);
+  if (job->out == NULL)
+  {
+    report_error(NULL, errno, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  if (job->trim_chain != NULL && !trim_chain_fits(job->trim_chain, job->in, duration, threshold))
+  {
+    trim_chain_free(job->trim_chain);
+    job->trim_chain = NULL;
+  }
+  if (job->trim_chain == NULL)
+  {
+    job->trim_chain = trim_chain_create(job->in, job->out, duration, threshold,
+      job->scratch_directory, &job->memory);
+  }
+  result = job->trim_chain == NULL ? SOX_EOF : trim_chain_run(job->trim_chain, job->in, job->out);
+  job_cleanup(job);
+  if (result != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    DeleteFileA(temp_path);
+    return;
+  }
+  /* Renamed over, rather than copied, so as not to write through a link
+   * into the result store. */
+  if (!MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    DeleteFileA(temp_path);
+  }
+}
+
+/* A threshold as the silence effect takes it: a fraction of full scale,
+ * a percentage ("4%") or a level in dB ("-30d"). */
+int parse_threshold(char const * text, double * threshold)
+{
+  char * end;
+
+  *threshold = strtod(text, &end);
+  if (end == text)
+  {
+    return SOX_EOF;
+  }
+  if (*end == '%')
+  {
+    *threshold /= 100;
+    ++end;
+  }
+  else if (*end == 'd')
+  {
+    *threshold = pow(10, *threshold / 20);
+    ++end;
+  }
+  return *end == '\0' ? SOX_SUCCESS : SOX_EOF;
+}
+
+/* A duration as [[hh:]mm:]ss[.frac], or a number of frames ("8820s"). */
+int parse_duration(char const * text, sox_rate_t rate, uint64_t * frames)
+{
+  double seconds = 0, part;
+  char * end;
+
+  if (strchr(text, 's') != NULL)
+  {
+    *frames = strtoull(text, &end, 10);
+    return (end != text && strcmp(end, "s") == 0) ? SOX_SUCCESS : SOX_EOF;
+  }
+  for (;;)
+  {
+    part = strtod(text, &end);
+    if (end == text)
+    {
+      return SOX_EOF;
+    }
+    seconds = seconds * 60 + part;
+    if (*end != ':')
+    {
+      break;
+    }
+    text = end + 1;
+  }
+  if (*end != '\0')
+  {
+    return SOX_EOF;
+  }
+  *frames = (uint64_t)(seconds * rate + .5);
+  return SOX_SUCCESS;
+}
+
+/* Copy just the frames from start to end of the file over the file, and
+ * hash what is kept. */
+static int cut_file(job_t * job, char const * path, uint64_t start, uint64_t end,
+  uint64_t * fingerprint)
+{
+  char temp_path[MAX_PATH];
+  uint64_t remaining;
+  size_t number_read;
+  int result = SOX_SUCCESS;
+
+  StringCbPrintfA(temp_path, sizeof(temp_path), "%s\\trim-%lu.tmp",
+    job->directory_name, GetCurrentThreadId());
+  job->in = sox_open_read(path, NULL, NULL, NULL);
+  if (job->in == NULL)
+  {
+    return SOX_EOF;
+  }
+  job->out = sox_open_write(temp_path, &job->in->signal, &job->in->encoding,
+    job->in->filetype, NULL, NULL);
+  remaining = (end - start) * job->in->signal.channels;
+  *fingerprint = FINGERPRINT_SEED;
+  if (job->out == NULL
+      || (start > 0 && sox_seek(job->in, start * job->in->signal.channels, SOX_SEEK_SET)
+           != SOX_SUCCESS))
+  {
+    job_cleanup(job);
+    DeleteFileA(temp_path);
+    return SOX_EOF;
+  }
+  while (remaining > 0
+      && (number_read = sox_read(job->in, job->samples,
+            (size_t)min(remaining, (uint64_t)JOB_BUFFER_SAMPLES))))
+  {
+    if (sox_write(job->out, job->samples, number_read) != number_read)
+    {
+      result = SOX_EOF;
+      break;
+    }
+    *fingerprint = fingerprint_samples(*fingerprint, job->samples, number_read);
+    remaining -= number_read;
+  }
+  job_cleanup(job);
+  /* (Renamed over the file, so that a link to it is left alone.) */
+  if (result == SOX_SUCCESS && !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+  {
+    result = SOX_EOF;
+  }
+  DeleteFileA(temp_path);
+  return result;
+}
+
+/* The result store's key for a cut: the samples, how the file stores
+ * them (the same samples may be 16- or 24-bit), and where it falls. */
+static int cut_key(char const * path, envelope_t const * envelope, uint64_t start,
+  uint64_t end, uint64_t * key)
+{
+  char operation[100];
+  sox_format_t * input = sox_open_read(path, NULL, NULL, NULL);
+
+  if (input == NULL)
+  {
+    return SOX_EOF;
+  }
+  StringCbPrintfA(operation, sizeof(operation), "cut %s %u %u %" PRIu64 " %" PRIu64,
+    input->filetype, (unsigned)input->encoding.encoding, input->encoding.bits_per_sample,
+    start, end);
+  sox_close(input);
+  *key = store_key(envelope->header.fingerprint, operation);
+  return SOX_SUCCESS;
+}
+
+/*
+ * Trim the silence from both ends of a file
+ *
+ * The trim points come from the file's envelope, which is worked out the
+ * first time and cached, so trying another threshold or duration does not
+ * mean reading the file again. Only the final cut touches the audio, and
+ * not even that if the same cut of the same audio is in the result store.
+ */
+void trim_silence(job_t * job, TCHAR * filename, char * duration, char * threshold)
+{
+  arena_mark_t mark = arena_mark(&job->arena);
+  char * path = arena_utf8(&job->arena, filename);
+  envelope_t envelope;
+  double threshold_value;
+  uint64_t min_frames, start, end, key, fingerprint;
+  int cut;
+
+  if (path == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return;
+  }
+  if (parse_threshold(threshold, &threshold_value) != SOX_SUCCESS
+      || envelope_get(path, job->samples, JOB_BUFFER_SAMPLES, &envelope) != SOX_SUCCESS)
+  {
+    trim_silence_with_effects(job, path, duration, threshold);
+    arena_release(&job->arena, mark);
+    return;
+  }
+  if (parse_duration(duration, envelope.header.rate, &min_frames) != SOX_SUCCESS)
+  {
+    envelope_free(&envelope);
+    trim_silence_with_effects(job, path, duration, threshold);
+    arena_release(&job->arena, mark);
+    return;
+  }
+  envelope_find_sound(&envelope, threshold_value, min_frames, &start, &end);
+  if (start > 0 || end < envelope.header.frames)
+  {
+    if (cut_key(path, &envelope, start, end, &key) != SOX_SUCCESS)
+    {
+      cut = cut_file(job, path, start, end, &fingerprint);
+    }
+    else if (store_fetch(key, path, &fingerprint) != SOX_SUCCESS)
+    {
+      cut = cut_file(job, path, start, end, &fingerprint);
+      if (cut == SOX_SUCCESS)
+      {
+        store_keep(key, path, fingerprint); /* Only a cache, like the envelope */
+      }
+    } else {
+      cut = SOX_SUCCESS;
+    }
+    if (cut != SOX_SUCCESS)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    }
+    /* The trimmed file's envelope is just the middle of this one. */
+    else if (manifest_stat(path, &envelope.header.file_size,
+               &envelope.header.file_time) == SOX_SUCCESS)
+    {
+      envelope_crop(&envelope, start, end, fingerprint);
+      envelope_write(path, &envelope);
+    }
+  }
+  envelope_free(&envelope);
+  arena_release(&job->arena, mark);
+}
+
+double total_duration(job_t * job)
+{
+  size_t i, sox_result;
+  double secs = 0;
+  uint64_t ws;
+
+  for (i = 0; i < job->file_count; ++i)
+  {
+    sox_format_t * input;
+    duration_entry_t * cached;
+    uint64_t file_size, file_time;
+    int known = job->durations != NULL
+      && manifest_stat(job->filenames[i], &file_size, &file_time) == SOX_SUCCESS;
+    double file_secs;
+
+    /* The job server remembers files it has measured before. */
+    cached = known ? duration_cache_find(job->durations, job->filenames[i]) : NULL;
+    if (cached != NULL && cached->file_size == file_size && cached->file_time == file_time)
+    {
+      secs += cached->seconds;
+      job->stats.files++;
+      continue;
+    }
+    /* Open this input file: */
+    input = sox_open_read(job->filenames[i], NULL, NULL, NULL);
+    if (input == NULL)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      job_cleanup(job);
+      return 0;
+    }
+    ws = input->signal.length / max(input->signal.channels, 1);
+    file_secs = (double)ws / max(input->signal.rate, 1);
+    secs += file_secs;
+    sox_result = sox_close(input);
+    if(sox_result != SOX_SUCCESS)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      job_cleanup(job);
+      return 0;
+    }
+    if (known && ws > 0)
+    {
+      duration_cache_store(job->durations, job->filenames[i], file_size, file_time, file_secs);
+    }
+    job->stats.files++;
+  }
+  return secs;
+}
+
+/* Find the data chunk that libSoX is writing into. */
+static int read_data_offset(job_t * job, uint64_t * data_offset)
+{
+  wav_layout_t layout;
+  HANDLE file;
+  int result;
+
+  file = wav_open_raw(job->output_filename, 0);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return SOX_EOF;
+  }
+  result = wav_read_layout(file, &layout);
+  CloseHandle(file);
+  *data_offset = layout.data_offset;
+  return result;
+}
+
+/* Feed the samples just written to the peak file, if there is one. Running
+ * out of memory for it costs the peak file, not the splice. */
+static void gather_peaks(job_t * job, sox_sample_t const * samples, size_t count)
+{
+  if (job->peaks != NULL && peaks_add(job->peaks, samples, count) != SOX_SUCCESS)
+  {
+    peaks_free(job->peaks);
+    job->peaks = NULL;
+  }
+}
+
+/* Write out the peaks of a finished splice, or drop the old peak file if
+ * we have none that match it. */
+static void finish_peaks(job_t * job)
+{
+  if (job->peaks == NULL || peaks_write(job->peaks, job->output_filename) != SOX_SUCCESS)
+  {
+    peaks_remove(job->output_filename);
+  }
+  peaks_free(job->peaks);
+  job->peaks = NULL;
+}
+
+/* The dither for writing an input's samples as 16-bit output, made the
+ * first time it is needed. NULL if there is nothing to reduce (or no memory
+ * for it, when the writer's own rounding will have to do). */
+static dither_t * output_dither(job_t * job, sox_format_t const * format, unsigned output_bits)
+{
+  if (output_bits != 16 || format->encoding.bits_per_sample <= 16)
+  {
+    return NULL;
+  }
+  if (job->dither == NULL)
+  {
+    job->dither = dither_create(DEFAULT_DITHER, format->signal.channels, format->signal.rate);
+  }
+  return job->dither;
+}
+
+/* wav_pack_samples(), dithering if the samples are being cut to 16 bits. */
+static size_t pack_output(job_t * job, decoder_t * input, sox_sample_t const * samples,
+  size_t count, sox_encoding_t encoding, unsigned bits_per_sample, unsigned char * dest)
+{
+  dither_t * dither = output_dither(job, input->format, bits_per_sample);
+
+  if (dither != NULL && encoding == SOX_ENCODING_SIGN2)
+  {
+    return dither_pack16(dither, samples, count, dest);
+  }
+  return wav_pack_samples(samples, count, encoding, bits_per_sample, dest,
+    &input->format->clips);
+}
+
+/* Read the folder's splice-automation.txt, if it has one, into
+ * job->automation: an entry for each input (gain 1 and no fades, for any
+ * not named in it). A file we can't make sense of fails the job, rather
+ * than splicing without the fades it asks for. */
+static int load_automation(job_t * job, sox_rate_t rate)
+{
+  char path[MAX_PATH], line[MAX_PATH + 200];
+  automation_t automation;
+  FILE * file;
+  size_t i;
+  int result = SOX_SUCCESS;
+
+  job->automation = NULL;
+  if (FAILED(StringCbPrintfA(path, sizeof(path), "%s\\%s", job->directory_name,
+        AUTOMATION_FILENAME)))
+  {
+    return SOX_EOF;
+  }
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    return SOX_SUCCESS;
+  }
+  job->automation = (automation_t *)arena_calloc(&job->arena, job->file_count,
+    sizeof(automation_t));
+  if (job->automation == NULL)
+  {
+    fclose(file);
+    return SOX_EOF;
+  }
+  for (i = 0; i < job->file_count; ++i)
+  {
+    job->automation[i].gain = 1;
+  }
+  while (result == SOX_SUCCESS && fgets(line, sizeof(line), file) != NULL)
+  {
+    /* (File names can't hold a colon, so the first one ends the name.) */
+    char * colon = strchr(line, ':');
+
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+    {
+      continue;
+    }
+    if (colon == NULL)
+    {
+      result = SOX_EOF;
+      break;
+    }
+    *colon = '\0';
+    result = automation_parse(colon + 1, rate, &automation);
+    for (i = 0; i < job->file_count && result == SOX_SUCCESS; ++i)
+    {
+      if (_stricmp(line, job_base_name(job->filenames[i])) == 0)
+      {
+        job->automation[i] = automation;
+      }
+    }
+  }
+  fclose(file);
+  return result;
+}
+
+static automation_t const * track_automation(job_t * job, size_t index)
+{
+  return job->automation != NULL ? &job->automation[index] : NULL;
+}
+
+/* Apply an input's automation to samples decoded from it, `position`
+ * samples in. */
+static void automate_samples(job_t * job, size_t index, sox_format_t const * format,
+  sox_sample_t * samples, size_t count, uint64_t position)
+{
+  automation_t const * automation = track_automation(job, index);
+  unsigned channels = format->signal.channels;
+  native_kernels_t const * kernels = native_kernels(NATIVE_S32, channels);
+
+  if (automation != NULL && kernels != NULL)
+  {
+    automation_apply(automation, kernels, samples, count / channels, channels,
+      position / channels, format->signal.length / channels);
+  }
+}
+
+/* An input on its way into a raw output. A WAV input that is already in the
+ * output's format is copied as it is, a block of frames at a time, and only
+ * looked at (for the fingerprint and the peaks) by the kernels for its
+ * format (see native-pcm.c). Anything else is decoded and packed again.
+ * Either way, the track's automation is applied on the way. */
+typedef struct {
+  decoder_t * decoder;
+  HANDLE file;                        /* Copied as it is... */
+  native_kernels_t const * kernels;
+  uint64_t position, end;             /* ...from here to the end of its data */
+  unsigned char * block;
+  size_t block_bytes;
+  automation_t const * automation;    /* Gain and fades, or NULL */
+  uint64_t frame, track_frames;       /* ...and where we are in the track */
+  int failed;
+  arena_mark_t mark;
+} track_source_t;
+
+/* Open the native route for an input, if it can take it. */
+static int open_native(job_t * job, track_source_t * source, char const * filename,
+  sox_encoding_t encoding, unsigned bits_per_sample, unsigned channels, sox_rate_t rate)
+{
+  native_format_t format;
+  wav_layout_t layout;
+  LARGE_INTEGER file_size;
+  size_t frame_bytes = (size_t)channels * (bits_per_sample / 8);
+
+  if (native_format(encoding, bits_per_sample, &format) != SOX_SUCCESS
+      || (source->kernels = native_kernels(format, channels)) == NULL)
+  {
+    return SOX_EOF;
+  }
+  source->file = wav_open_raw(filename, 0);
+  if (source->file == INVALID_HANDLE_VALUE)
+  {
+    return SOX_EOF;
+  }
+  if (wav_read_layout(source->file, &layout) == SOX_SUCCESS
+      && layout.encoding == encoding
+      && layout.bits_per_sample == bits_per_sample
+      && layout.channels == channels
+      && layout.rate == rate
+      && GetFileSizeEx(source->file, &file_size)
+      && (uint64_t)file_size.QuadPart >= layout.data_offset)
+  {
+    /* A writer that never went back to fill in the size leaves it short
+     * or long; trust the file, and only whole frames. */
+    uint64_t data_bytes = min(layout.data_bytes, file_size.QuadPart - layout.data_offset);
+    source->position = layout.data_offset;
+    source->end = layout.data_offset + data_bytes - data_bytes % frame_bytes;
+    source->track_frames = data_bytes / frame_bytes;
+    source->block_bytes = NATIVE_BLOCK_FRAMES * frame_bytes;
+    source->block = (unsigned char *)arena_alloc(&job->arena, source->block_bytes);
+    if (source->block != NULL)
+    {
+      return SOX_SUCCESS;
+    }
+  }
+  CloseHandle(source->file);
+  source->file = INVALID_HANDLE_VALUE;
+  return SOX_EOF;
+}
+
+/* Open input `index` to be written in the given format, `skip` samples in. */
+static int source_open(job_t * job, track_source_t * source, size_t index,
+  sox_encoding_t encoding, unsigned bits_per_sample, unsigned channels, sox_rate_t rate,
+  uint64_t skip)
+{
+  char const * filename = job->filenames[index];
+
+  memset(source, 0, sizeof(*source));
+  source->file = INVALID_HANDLE_VALUE;
+  source->mark = arena_mark(&job->arena);
+  source->automation = track_automation(job, index);
+  source->frame = skip / channels;
+  if (open_native(job, source, filename, encoding, bits_per_sample, channels, rate)
+      == SOX_SUCCESS)
+  {
+    source->position = min(source->position + skip * (bits_per_sample / 8), source->end);
+    return SOX_SUCCESS;
+  }
+  source->decoder = decoder_open(filename, &job->memory);
+  if (source->decoder == NULL)
+  {
+    return SOX_EOF;
+  }
+  source->kernels = native_kernels(NATIVE_S32, channels); /* For the automation */
+  source->track_frames = source->decoder->format->signal.length / channels;
+  if (source->decoder->format->signal.channels != channels
+      || source->decoder->format->signal.rate != rate
+      || (skip > 0 && decoder_seek(source->decoder, skip) != SOX_SUCCESS))
+  {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Read the next block of an input, ready to write. Returns its length in
+ * bytes (0 at the end, or on failure) and the samples in it in *count,
+ * having added them to the fingerprint (as read) and the peaks (as
+ * written). */
+static size_t source_read(job_t * job, track_source_t * source, sox_encoding_t encoding,
+  unsigned bits_per_sample, unsigned channels, unsigned char const ** block, size_t * count,
+  uint64_t * fingerprint)
+{
+  size_t number_read, length;
+
+  if (source->decoder != NULL)
+  {
+    number_read = decoder_read(source->decoder, job->samples, JOB_BUFFER_SAMPLES);
+    *fingerprint = fingerprint_samples(*fingerprint, job->samples, number_read);
+    if (source->automation != NULL && source->kernels != NULL)
+    {
+      automation_apply(source->automation, source->kernels, job->samples,
+        number_read / channels, channels, source->frame, source->track_frames);
+    }
+    source->frame += number_read / channels;
+    gather_peaks(job, job->samples, number_read);
+    *block = job->packed;
+    *count = number_read;
+    return pack_output(job, source->decoder, job->samples, number_read, encoding,
+      bits_per_sample, job->packed);
+  }
+  length = (size_t)min(source->block_bytes, source->end - source->position);
+  *count = 0;
+  if (length == 0)
+  {
+    return 0;
+  }
+  if (wav_read_at(source->file, source->position, source->block, length) != SOX_SUCCESS)
+  {
+    source->failed = 1;
+    return 0;
+  }
+  source->position += length;
+  number_read = length / source->kernels->sample_bytes;
+  *fingerprint = source->kernels->fingerprint(*fingerprint, source->block, number_read);
+  if (source->automation != NULL)
+  {
+    automation_apply(source->automation, source->kernels, source->block,
+      number_read / channels, channels, source->frame, source->track_frames);
+  }
+  source->frame += number_read / channels;
+  if (job->peaks != NULL
+      && peaks_add_native(job->peaks, source->block, number_read, source->kernels) != SOX_SUCCESS)
+  {
+    peaks_free(job->peaks);
+    job->peaks = NULL;
+  }
+  *block = source->block;
+  *count = number_read;
+  return length;
+}
+
+/* Close an input, returning SOX_EOF if any of it could not be read. */
+static int source_close(job_t * job, track_source_t * source)
+{
+  int result = source->failed ? SOX_EOF : SOX_SUCCESS;
+
+  if (source->decoder != NULL)
+  {
+    if (source->decoder->failed)
+    {
+      result = SOX_EOF;
+    }
+    decoder_close(source->decoder);
+  }
+  if (source->file != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(source->file);
+  }
+  arena_release(&job->arena, source->mark);
+  return result;
+}
+
+/* Check that the output really holds what the journal says it does: same
+ * inputs, untouched since, and the last block written is intact. Returns
+ * the output, truncated to the checkpoint, ready for writing. */
+static HANDLE open_completed_prefix(job_t * job, manifest_t const * manifest,
+  journal_cursor_t const * cursor, wav_layout_t * layout)
+{
+  unsigned char * tail = job->packed;
+  LARGE_INTEGER file_size, prefix_end;
+  uint64_t size, time;
+  HANDLE output;
+  size_t i;
+
+  if (cursor->track >= job->file_count
+      || cursor->tail_bytes > sizeof(job->packed)
+      || cursor->tail_bytes > cursor->data_bytes
+      || !wav_can_pack(manifest->encoding, manifest->bits_per_sample))
+  {
+    return INVALID_HANDLE_VALUE;
+  }
+  for (i = 0; i <= cursor->track; ++i)
+  {
+    if (strcmp(manifest->tracks[i].filename, job_base_name(job->filenames[i])) != 0
+        || manifest_stat(job->filenames[i], &size, &time) != SOX_SUCCESS
+        || size != manifest->tracks[i].file_size
+        || time != manifest->tracks[i].file_time
+        || automation_key(track_automation(job, i)) != manifest->tracks[i].automation)
+    {
+      return INVALID_HANDLE_VALUE;
+    }
+  }
+  output = wav_open_raw(job->output_filename, 1);
+  if (output == INVALID_HANDLE_VALUE)
+  {
+    return INVALID_HANDLE_VALUE;
+  }
+  prefix_end.QuadPart = (LONGLONG)(manifest->data_offset + cursor->data_bytes);
+  if (wav_read_layout(output, layout) != SOX_SUCCESS
+      || layout->data_offset != manifest->data_offset
+      || !GetFileSizeEx(output, &file_size)
+      || file_size.QuadPart < prefix_end.QuadPart
+      || wav_read_at(output, prefix_end.QuadPart - cursor->tail_bytes,
+           tail, (size_t)cursor->tail_bytes) != SOX_SUCCESS
+      || fingerprint_bytes(FINGERPRINT_SEED, tail, (size_t)cursor->tail_bytes)
+           != cursor->tail_fingerprint
+      || !SetFilePointerEx(output, prefix_end, NULL, FILE_BEGIN)
+      || !SetEndOfFile(output))
+  {
+    CloseHandle(output);
+    return INVALID_HANDLE_VALUE;
+  }
+  return output;
+}
+
+/* Append the input files, from file `first` on, to an output that we
+ * write ourselves rather than through libSoX, checkpointing as we go. On
+ * entry *data_bytes is where the first file's samples go; on return it is
+ * the length of the data written. */
+static int copy_tracks_raw(job_t * job, HANDLE output, wav_layout_t const * layout,
+  manifest_t * manifest, size_t first, uint64_t * data_bytes)
+{
+  unsigned bytes_per_sample = manifest->bits_per_sample / 8;
+  uint64_t last_checkpoint = *data_bytes;
+  journal_cursor_t cursor;
+  aio_t aio;
+  size_t i, file_count = manifest->track_count;
+  int result;
+
+  result = aio_open(&aio, output, &job->memory);
+  aio_seek(&aio, layout->data_offset + *data_bytes);
+  for (i = first; i < file_count && result == SOX_SUCCESS; ++i)
+  {
+    manifest_track_t * track = &manifest->tracks[i];
+    track_source_t source;
+    unsigned char const * block;
+    size_t number_read, number_packed;
+
+    if (track->filename == NULL)
+    {
+      track->filename = _strdup(job_base_name(job->filenames[i]));
+      track->byte_offset = *data_bytes;
+      track->fingerprint = FINGERPRINT_SEED;
+      track->automation = automation_key(track_automation(job, i));
+      manifest_stat(job->filenames[i], &track->file_size, &track->file_time);
+    }
+    result = source_open(job, &source, i, manifest->encoding, manifest->bits_per_sample,
+      manifest->channels, manifest->rate, track->samples);
+    while (result == SOX_SUCCESS
+        && (number_packed = source_read(job, &source, manifest->encoding,
+              manifest->bits_per_sample, manifest->channels, &block, &number_read,
+              &track->fingerprint)))
+    {
+      result = aio_append(&aio, block, number_packed);
+      *data_bytes += number_packed;
+      job->stats.samples += number_read;
+      job->stats.bytes_written += number_packed;
+      track->samples += number_read;
+      track->checksum = checksum_bytes(track->checksum, block, number_packed);
+      if (result == SOX_SUCCESS && *data_bytes - last_checkpoint >= CHECKPOINT_INTERVAL
+          && track->samples % manifest->channels == 0)
+      {
+        /* (No more of the tail than a resumed run has room to check.) */
+        size_t tail_bytes = min(number_packed, sizeof(job->packed));
+        cursor.track = i;
+        cursor.track_samples = track->samples;
+        cursor.data_bytes = *data_bytes;
+        cursor.tail_bytes = tail_bytes;
+        cursor.tail_fingerprint = fingerprint_bytes(FINGERPRINT_SEED,
+          block + number_packed - tail_bytes, tail_bytes);
+        if (aio_flush(&aio) != SOX_SUCCESS || !FlushFileBuffers(output)
+            || journal_checkpoint(job->output_filename, manifest, &cursor) != SOX_SUCCESS)
+        {
+          result = SOX_EOF;
+        }
+        last_checkpoint = *data_bytes;
+      }
+    }
+    track->byte_length = track->samples * bytes_per_sample;
+    if (source_close(job, &source) != SOX_SUCCESS)
+    {
+      result = SOX_EOF;
+    }
+    job->stats.files++;
+  }
+  if (aio_close(&aio) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = wav_update_sizes(output, layout, *data_bytes);
+  }
+  return result;
+}
+
+/* Whether the journal's output is the one this job would write: a crashed
+ * full-width splice is no start on a 16-bit one, or the other way round. */
+static int journal_fits_job(job_t * job, manifest_t const * manifest)
+{
+  splice_plan_t plan;
+  int fits;
+
+  if (plan_splice(job, &plan) != SOX_SUCCESS)
+  {
+    plan_free(&plan);
+    return 0;
+  }
+  fits = plan.encoding.encoding == manifest->encoding
+    && plan.encoding.bits_per_sample == manifest->bits_per_sample
+    && plan.signal.channels == manifest->channels
+    && plan.signal.rate == manifest->rate;
+  plan_free(&plan);
+  return fits;
+}
+
+/* Pick up an interrupted splice from its last checkpoint. Returns 0 if
+ * there was nothing usable to resume, and a full splice is needed. */
+static int resume_splice(job_t * job)
+{
+  manifest_t manifest;
+  journal_cursor_t cursor;
+  wav_layout_t layout;
+  manifest_track_t * tracks;
+  HANDLE output;
+  uint64_t data_bytes;
+  size_t file_count = job->file_count;
+  int result;
+
+  if (journal_read(job->output_filename, &manifest, &cursor) != SOX_SUCCESS)
+  {
+    return 0;
+  }
+  /* The peaks of the part already written went with the crashed run. */
+  peaks_remove(job->output_filename);
+  output = INVALID_HANDLE_VALUE;
+  if (journal_fits_job(job, &manifest) && load_automation(job, manifest.rate) == SOX_SUCCESS)
+  {
+    output = open_completed_prefix(job, &manifest, &cursor, &layout);
+  }
+  tracks = (manifest_track_t *)realloc(manifest.tracks, file_count * sizeof(manifest_track_t));
+  if (output == INVALID_HANDLE_VALUE || tracks == NULL)
+  {
+    if (output != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(output);
+    }
+    manifest_free(&manifest);
+    journal_remove(job->output_filename);
+    return 0;
+  }
+  manifest.tracks = tracks;
+  memset(&tracks[manifest.track_count], 0,
+    (file_count - manifest.track_count) * sizeof(manifest_track_t));
+  manifest.track_count = file_count;
+  data_bytes = cursor.data_bytes;
+
+  result = copy_tracks_raw(job, output, &layout, &manifest, cursor.track, &data_bytes);
+  CloseHandle(output);
+  if (result == SOX_SUCCESS)
+  {
+    manifest_write(job->output_filename, &manifest);
+    journal_remove(job->output_filename);
+  } else {
+    /* The journal still points at the last good checkpoint. */
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+  manifest_free(&manifest);
+  return 1;
+}
+
+/* The output's signal, PCM encoding and data length, as planned (see
+ * plan.c); the length is UINT64_MAX if any input's isn't known. */
+static int probe_inputs(job_t * job, sox_signalinfo_t * signal, sox_encodinginfo_t * encoding,
+  uint64_t * data_bytes)
+{
+  splice_plan_t plan;
+
+  if (plan_splice(job, &plan) != SOX_SUCCESS)
+  {
+    plan_free(&plan);
+    return SOX_EOF;
+  }
+  *signal = plan.signal;
+  *encoding = plan.encoding;
+  *data_bytes = plan.data_bytes;
+  plan_free(&plan);
+  return SOX_SUCCESS;
+}
+
+/* Write the whole splice ourselves, rather than through libSoX, in the
+ * container the plan asks for: so that inputs already in the output's
+ * format go straight through, and for outputs too big for RIFF. The whole
+ * file is set aside before anything is written, when its size is known. */
+static void splice_raw(job_t * job, splice_plan_t const * plan)
+{
+  manifest_t manifest;
+  wav_layout_t layout = plan->layout;
+  HANDLE output;
+  uint64_t data_bytes = 0;
+  int result;
+
+  memset(&manifest, 0, sizeof(manifest));
+  manifest.tracks = (manifest_track_t *)calloc(job->file_count, sizeof(manifest_track_t));
+  if (manifest.tracks == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  manifest.track_count = job->file_count;
+  manifest.rate = layout.rate;
+  manifest.channels = layout.channels;
+  manifest.bits_per_sample = layout.bits_per_sample;
+  manifest.encoding = layout.encoding;
+  manifest.checksummed = 1;
+
+  output = wav_create_raw(job->output_filename);
+  if (output == INVALID_HANDLE_VALUE)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    manifest_free(&manifest);
+    job_cleanup(job);
+    return;
+  }
+  result = wav_write_header(output, &layout);
+  if (result == SOX_SUCCESS && plan->file_bytes != PLAN_UNKNOWN)
+  {
+    result = wav_preallocate(output, plan->file_bytes);
+  }
+  manifest.data_offset = layout.data_offset;
+  if (job->write_peaks)
+  {
+    job->peaks = peaks_create(layout.channels);
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = copy_tracks_raw(job, output, &layout, &manifest, 0, &data_bytes);
+  }
+  CloseHandle(output);
+  if (result != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    manifest_free(&manifest);
+    job_cleanup(job);
+    return;
+  }
+  journal_remove(job->output_filename);
+  if (manifest_write(job->output_filename, &manifest) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+  manifest_free(&manifest);
+  finish_peaks(job);
+}
+
+/* Splice straight to FLAC, with no WAV in between. The frames are encoded
+ * on all the cores as the samples come in (see flac-encode.c). */
+static void splice_flac(job_t * job)
+{
+  flac_encoder_t * encoder;
+  dither_t * dither;
+  sox_signalinfo_t signal;
+  sox_encodinginfo_t encoding;
+  uint64_t data_bytes, expected_samples = 0, position;
+  unsigned bits;
+  size_t i, number_read;
+  int result = SOX_SUCCESS;
+
+  if (probe_inputs(job, &signal, &encoding, &data_bytes) != SOX_SUCCESS
+      || load_automation(job, signal.rate) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  /* FLAC goes up to 24 bits here, so 32-bit and float inputs are rounded
+   * to 24 bits, without dither. A job that asks for 16 bits gets them,
+   * dithered. */
+  bits = encoding.bits_per_sample <= 8 ? 8 : encoding.bits_per_sample <= 16 ? 16 : 24;
+  if (job->output_bits == 16 && bits > 16)
+  {
+    bits = 16;
+  }
+  if (data_bytes != UINT64_MAX && encoding.bits_per_sample >= 8)
+  {
+    expected_samples = data_bytes / (encoding.bits_per_sample / 8) / signal.channels;
+  }
+  encoder = flac_open(job->output_filename, (unsigned)signal.rate, signal.channels, bits,
+    expected_samples);
+  if (encoder == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  if (job->write_peaks)
+  {
+    job->peaks = peaks_create(signal.channels);
+  }
+  for (i = 0; i < job->file_count && result == SOX_SUCCESS; ++i)
+  {
+    job->decoder = decoder_open(job->filenames[i], &job->memory);
+    if (job->decoder == NULL
+        || job->decoder->format->signal.channels != signal.channels
+        || job->decoder->format->signal.rate != signal.rate)
+    {
+      result = SOX_EOF;
+      break;
+    }
+    dither = output_dither(job, job->decoder->format, bits);
+    position = 0;
+    while ((number_read = decoder_read(job->decoder, job->samples, JOB_BUFFER_SAMPLES)))
+    {
+      automate_samples(job, i, job->decoder->format, job->samples, number_read, position);
+      position += number_read;
+      job->stats.samples += number_read;
+      gather_peaks(job, job->samples, number_read);
+      if (dither != NULL)
+      {
+        dither_apply(dither, job->samples, number_read);
+      }
+      if (flac_write(encoder, job->samples, number_read) != SOX_SUCCESS)
+      {
+        result = SOX_EOF;
+        break;
+      }
+    }
+    if (job->decoder->failed)
+    {
+      result = SOX_EOF;
+    }
+    decoder_close(job->decoder);
+    job->decoder = NULL;
+    job->stats.files++;
+  }
+  if (flac_close(encoder) != SOX_SUCCESS || result != SOX_SUCCESS)
+  {
+    DeleteFileA(job->output_filename);
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    peaks_remove(job->output_filename);
+    return;
+  }
+  finish_peaks(job);
+}
+
+/*
+ * Splice audio files
+ *
+ * This is how I got it to work in zsh, with the Linux/MacOS sox executable...
+ *
+ *  sox babayaga.wav greatgate.wav _merged.wav splice -q `soxi -D babayaga.wav`,0.1
+ *
+ * NOTE: The sample files are from Mussorgsky's _Pictures_at_an_Exhibition_, at
+ * the transition from "The Hut on Fowl's Legs" to "The Great Gate at Kiev."
+ *
+ * I think example4.c in the libsox package is closest to what I am trying to do.
+ */
+void splice(job_t * job)
+{
+  size_t i, sox_result;
+  manifest_t manifest;
+  uint64_t byte_offset = 0;
+  splice_plan_t plan;
+  sox_signalinfo_t signal;
+  sox_encodinginfo_t first_encoding;
+
+  if (job->output_format == OUTPUT_FLAC)
+  {
+    splice_flac(job);
+    return;
+  }
+  if (resume_splice(job))
+  {
+    return;
+  }
+  for (i = 0; i < job->file_count; ++i)
+  {
+    report_current_action(NULL, job_base_name(job->filenames[i]));
+  }
+
+  if (plan_splice(job, &plan) != SOX_SUCCESS
+      || load_automation(job, plan.signal.rate) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    plan_free(&plan);
+    job_cleanup(job);
+    return;
+  }
+  /* Any output we can pack, we write ourselves, in the container the plan
+   * chose for its size. */
+  if (plan.raw)
+  {
+    splice_raw(job, &plan);
+    plan_free(&plan);
+    return;
+  }
+  plan_free(&plan);
+  if (plan.data_bytes > RIFF_MAX_DATA_BYTES)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  first_encoding = plan.encoding;
+
+  /* Record where each track lands, so that resplice() can patch it later. */
+  memset(&manifest, 0, sizeof(manifest));
+  manifest.tracks = (manifest_track_t *)calloc(job->file_count, sizeof(manifest_track_t));
+  if (manifest.tracks == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    return;
+  }
+  manifest.track_count = job->file_count;
+
+  for (i = 0; i < job->file_count; ++i)
+  {
+    manifest_track_t * track = &manifest.tracks[i];
+    size_t number_read, number_written;
+    dither_t * dither;
+
+    /* Open this input file: */
+
+    job->decoder = decoder_open(job->filenames[i], &job->memory);
+    if (job->decoder == NULL)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      free(manifest.tracks);
+      job_cleanup(job);
+      return;
+    }
+    if (i == 0) /* If this is the first input file... */
+    {
+      /* report_current_action(NULL, "First file"); */
+      /* Open the output file using the same signal and encoding character-
+       * istics as the first input file.  Note that here, input->signal.length
+       * will not be equal to the output file length so we are relying on
+       * libSoX to set the output length correctly (i.e. non-seekable output
+       * is not catered for). The encoding is the input's, or plain PCM
+       * if the input is compressed (see plan.c). */
+      job->out = sox_open_write(job->output_filename,
+        &job->decoder->format->signal, &first_encoding, NULL, NULL, NULL);
+      if (job->out == NULL)
+      {
+        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+        free(manifest.tracks);
+        job_cleanup(job);
+        return;
+      }
+      /* Also, we'll store the signal characteristics of the first file
+       * so that we can check that these match those of the other inputs: */
+      signal = job->decoder->format->signal;
+      manifest.rate = job->out->signal.rate;
+      manifest.channels = job->out->signal.channels;
+      manifest.bits_per_sample = job->out->encoding.bits_per_sample;
+      manifest.encoding = job->out->encoding.encoding;
+      if (job->write_peaks)
+      {
+        job->peaks = peaks_create(signal.channels);
+      }
+    } else { /* Second or subsequent input file... */
+      /* report_current_action(NULL, "Second file"); */
+      /* Check that this input file's signal matches that of the first file: */
+      if ((job->decoder->format->signal.channels != signal.channels) ||
+                          (job->decoder->format->signal.rate != signal.rate))
+      {
+        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+        free(manifest.tracks);
+        job_cleanup(job);
+        return;
+      }
+    }
+    track->filename = (char *)job_base_name(job->filenames[i]);
+    track->byte_offset = byte_offset;
+    track->fingerprint = FINGERPRINT_SEED;
+    track->automation = automation_key(track_automation(job, i));
+    manifest_stat(job->filenames[i], &track->file_size, &track->file_time);
+    dither = output_dither(job, job->decoder->format, manifest.bits_per_sample);
+    /* Copy all of the audio from this input file to the output file: */
+    while ((number_read = decoder_read(job->decoder, job->samples, JOB_BUFFER_SAMPLES)))
+    {
+      track->samples += number_read;
+      track->fingerprint = fingerprint_samples(track->fingerprint, job->samples, number_read);
+      automate_samples(job, i, job->decoder->format, job->samples, number_read,
+        track->samples - number_read);
+      job->stats.samples += number_read;
+      gather_peaks(job, job->samples, number_read);
+      if (dither != NULL)
+      {
+        dither_apply(dither, job->samples, number_read);
+      }
+      number_written = sox_write(job->out, job->samples, number_read);
+      if(number_written != number_read)
+      {
+        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+        free(manifest.tracks);
+        job_cleanup(job);
+        return;
+      }
+    }
+    track->byte_length = track->samples * (job->out->encoding.bits_per_sample / 8);
+    byte_offset += track->byte_length;
+    job->stats.bytes_written += track->byte_length;
+    job->stats.files++;
+    sox_result = job->decoder->failed ? SOX_EOF : SOX_SUCCESS;
+    if (decoder_close(job->decoder) != SOX_SUCCESS)
+    {
+      sox_result = SOX_EOF;
+    }
+    job->decoder = NULL;
+    if(sox_result != SOX_SUCCESS)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      free(manifest.tracks);
+      job_cleanup(job);
+      return;
+    }
+  }
+  sox_result = sox_close(job->out);
+  job->out = NULL;
+  if(sox_result != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    free(manifest.tracks);
+    job_cleanup(job);
+    return;
+  }
+  journal_remove(job->output_filename);
+  if ((manifest.data_offset == 0 && read_data_offset(job, &manifest.data_offset) != SOX_SUCCESS)
+      || manifest_write(job->output_filename, &manifest) != SOX_SUCCESS)
+  {
+    /* The splice itself is fine; only a later resplice() will suffer. */
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+  free(manifest.tracks);
+  finish_peaks(job);
 }
 
-void trim_silence(TCHAR * filename, char * duration, char * threshold)
+/*
+ * Splice to every deliverable at once
+ *
+ * The inputs are decoded once, and each block goes to all of the outputs
+ * (see fan-out.c): spliced-audio.wav as the inputs are, spliced-audio-cd.wav
+ * at 16 bits and CD_OUTPUT_RATE, and spliced-audio.flac. No manifest is
+ * written, so a later resplice() of the WAV is a full splice().
+ */
+void splice_deliverables(job_t * job)
 {
-  TCHAR szNewPath[MAX_PATH * sizeof(TCHAR)];
-  unsigned long sample_count = 0L;
-  sox_effects_chain_t * chain;
-  sox_effect_t * e;
-  int sox_result = SOX_SUCCESS;
-  char * args[10];
+  fanout_t * fanout;
+  sox_signalinfo_t signal;
+  sox_encodinginfo_t encoding;
+  uint64_t data_bytes, position;
+  char cd_path[MAX_PATH], flac_path[MAX_PATH];
+  sox_sample_t * block = NULL;
+  size_t i, number_read, ring_bytes;
+  int result = SOX_SUCCESS;
 
-  in = sox_open_read(convert_pwstr_to_const_char(filename), NULL, NULL, NULL);
-  if (in == NULL)
+  job->output_bits = 0;
+  fanout = NULL;
+  if (job_set_output_format(job, OUTPUT_WAV) != SOX_SUCCESS
+      || probe_inputs(job, &signal, &encoding, &data_bytes) != SOX_SUCCESS
+      || load_automation(job, signal.rate) != SOX_SUCCESS
+      || (data_bytes != UINT64_MAX && data_bytes > RIFF_MAX_DATA_BYTES)
+      || FAILED(StringCbPrintfA(cd_path, sizeof(cd_path), "%s\\%s", job->directory_name,
+           CD_OUTPUT_FILENAME))
+      || FAILED(StringCbPrintfA(flac_path, sizeof(flac_path), "%s\\%s", job->directory_name,
+           FLAC_OUTPUT_FILENAME))
+      || (fanout = fanout_create(&signal, &encoding)) == NULL)
   {
-    report_error(NULL, errno, __FILE__, __LINE__);
-    cleanup();
+    /* (Outputs past 4 GB are left to splice(), which can promote them.) */
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
     return;
   }
-  out = sox_open_write("temp.wav", &in->signal, NULL, NULL, NULL, NULL);
-  if (out == NULL)
+  /* The ring can't make do with less, so this only counts it. */
+  ring_bytes = FANOUT_DEPTH * FANOUT_BLOCK_SAMPLES * sizeof(sox_sample_t);
+  ring_bytes = budget_charge(&job->memory, ring_bytes, ring_bytes);
+  if (fanout_add_sink(fanout, job->output_filename, 0, 0, 0) != SOX_SUCCESS
+      || fanout_add_sink(fanout, cd_path, 0, CD_OUTPUT_RATE, 16) != SOX_SUCCESS
+      || fanout_add_sink(fanout, flac_path, 1, 0, 0) != SOX_SUCCESS
+      || fanout_start(fanout) != SOX_SUCCESS)
   {
-    report_error(NULL, errno, __FILE__, __LINE__);
-    cleanup();
+    result = SOX_EOF;
+  }
+  if (job->write_peaks)
+  {
+    job->peaks = peaks_create(signal.channels);
+  }
+  for (i = 0; i < job->file_count && result == SOX_SUCCESS; ++i)
+  {
+    job->decoder = decoder_open(job->filenames[i], &job->memory);
+    if (job->decoder == NULL
+        || job->decoder->format->signal.channels != signal.channels
+        || job->decoder->format->signal.rate != signal.rate)
+    {
+      result = SOX_EOF;
+      break;
+    }
+    /* Decode straight into the fan-out's blocks. */
+    position = 0;
+    while ((block = fanout_block(fanout)) != NULL
+        && (number_read = decoder_read(job->decoder, block, FANOUT_BLOCK_SAMPLES)))
+    {
+      automate_samples(job, i, job->decoder->format, block, number_read, position);
+      position += number_read;
+      job->stats.samples += number_read;
+      gather_peaks(job, block, number_read);
+      fanout_commit(fanout, number_read);
+    }
+    if (block == NULL || job->decoder->failed)
+    {
+      /* (No block means every output has already failed.) */
+      result = SOX_EOF;
+    }
+    decoder_close(job->decoder);
+    job->decoder = NULL;
+    job->stats.files++;
+  }
+  if (fanout_finish(fanout, result != SOX_SUCCESS) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  }
+  fanout_free(fanout);
+  budget_release(&job->memory, ring_bytes);
+  /* Whatever the sidecars said about the old WAV no longer holds. */
+  journal_remove(job->output_filename);
+  manifest_remove(job->output_filename);
+  if (result != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+    peaks_remove(job->output_filename);
     return;
   }
-  chain = sox_create_effects_chain(&in->encoding, &out->encoding);
-  e = sox_create_effect(sox_find_effect("input"));
-  args[0] = (char *)in, assert(sox_effect_options(e, 1, args) == SOX_SUCCESS);
-  assert(sox_add_effect(chain, e, &in->signal, &in->signal) == SOX_SUCCESS);
-  free(e);
-  e = sox_create_effect(sox_find_effect("reverse"));
-  assert(sox_add_effect(chain, e, &in->signal, &in->signal) == SOX_SUCCESS);
-  free(e);
-  e = sox_create_effect(sox_find_effect("silence"));
-  args[0] = "1";
-  args[1] = duration;
-  args[2] = threshold;
-  assert(sox_effect_options(e, 3, args) == SOX_SUCCESS);
-  sox_result = sox_add_effect(chain, e, &in->signal, &in->signal);
-  if (sox_result != SOX_SUCCESS)
-  {
-    report_error(NULL, sox_result, __FILE__, __LINE__);
-    cleanup();
+  finish_peaks(job);
+}
+
+/* Open an input for the preview, as job->in, checking it against the
+ * first. */
+static int open_preview_input(job_t * job, char const * path, sox_signalinfo_t const * signal)
+{
+  job->in = sox_open_read(path, NULL, NULL, NULL);
+  if (job->in == NULL
+      || job->in->signal.channels != signal->channels
+      || job->in->signal.rate != signal->rate)
+  {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Write samples to the preview, dithered as the splice would be. */
+static int write_preview(job_t * job, dither_t * dither, sox_sample_t * samples, size_t count)
+{
+  if (dither != NULL)
+  {
+    dither_apply(dither, samples, count);
+  }
+  return sox_write(job->out, samples, count) == count ? SOX_SUCCESS : SOX_EOF;
+}
+
+/* The end of an input, into the preview: its last ring_samples samples, or
+ * all of it if it is shorter. An input that knows its length is sought to
+ * near the end; any other is read through, round the ring. */
+static int preview_tail(job_t * job, size_t index, sox_signalinfo_t const * signal,
+  unsigned bits_per_sample, sox_sample_t * ring, size_t ring_samples)
+{
+  uint64_t total = 0, start = 0;
+  size_t number_read, kept, position = 0;
+  dither_t * dither;
+  int result;
+
+  if (open_preview_input(job, job->filenames[index], signal) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  dither = output_dither(job, job->in, bits_per_sample);
+  /* (An input that can't seek after all is read from the start.) */
+  if (job->in->signal.length > ring_samples
+      && sox_seek(job->in, job->in->signal.length - ring_samples, SOX_SEEK_SET) == SOX_SUCCESS)
+  {
+    start = job->in->signal.length - ring_samples;
+  }
+  while ((number_read = sox_read(job->in, ring + position, ring_samples - position)))
+  {
+    job->stats.samples += number_read;
+    total += number_read;
+    position = (position + number_read) % ring_samples;
+  }
+  kept = (size_t)min(total, (uint64_t)ring_samples);
+  start += total - kept;
+  if (total <= ring_samples)
+  {
+    position = 0;
+  }
+  /* The track's fade out, and gain, as the splice will apply them. */
+  automate_samples(job, index, job->in, ring + position, kept - position, start);
+  automate_samples(job, index, job->in, ring, position, start + kept - position);
+  result = write_preview(job, dither, ring + position, kept - position);
+  if (result == SOX_SUCCESS)
+  {
+    result = write_preview(job, dither, ring, position);
+  }
+  sox_close(job->in);
+  job->in = NULL;
+  return result;
+}
+
+/* The start of an input, into the preview: its first `samples` samples. */
+static int preview_head(job_t * job, size_t index, sox_signalinfo_t const * signal,
+  unsigned bits_per_sample, size_t samples)
+{
+  uint64_t position = 0;
+  size_t number_read;
+  dither_t * dither;
+  int result = SOX_SUCCESS;
+
+  if (open_preview_input(job, job->filenames[index], signal) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  dither = output_dither(job, job->in, bits_per_sample);
+  while (position < samples && result == SOX_SUCCESS
+      && (number_read = sox_read(job->in, job->samples,
+            (size_t)min(samples - position, JOB_BUFFER_SAMPLES))))
+  {
+    job->stats.samples += number_read;
+    automate_samples(job, index, job->in, job->samples, number_read, position);
+    result = write_preview(job, dither, job->samples, number_read);
+    position += number_read;
+  }
+  sox_close(job->in);
+  job->in = NULL;
+  return result;
+}
+
+/*
+ * Preview the joins
+ *
+ * For checking a splice by ear without rendering all of it. Only
+ * PREVIEW_SECONDS either side of each join are decoded, seeking to the end
+ * of each input, and the joins are written one after another to
+ * spliced-audio-preview.wav, PREVIEW_GAP_SECONDS of silence apart. The
+ * inputs have already been trimmed, the tracks' gain and fades are applied
+ * here too, and the splice butts them together, so each join sounds just as
+ * it will in spliced-audio.wav.
+ */
+void preview_joins(job_t * job)
+{
+  sox_signalinfo_t signal;
+  sox_encodinginfo_t encoding;
+  uint64_t data_bytes;
+  char path[MAX_PATH];
+  sox_sample_t * ring;
+  size_t i, ring_samples, gap_samples, n;
+  arena_mark_t mark;
+  int result = SOX_SUCCESS;
+
+  if (job->file_count < 2)
+  {
+    return; /* No joins */
+  }
+  if (probe_inputs(job, &signal, &encoding, &data_bytes) != SOX_SUCCESS
+      || load_automation(job, signal.rate) != SOX_SUCCESS
+      || FAILED(StringCbPrintfA(path, sizeof(path), "%s\\%s", job->directory_name,
+           PREVIEW_OUTPUT_FILENAME)))
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
     return;
   }
-  free(e);
-  e = sox_create_effect(sox_find_effect("reverse"));
-  assert(sox_add_effect(chain, e, &in->signal, &in->signal) == SOX_SUCCESS);
-  free(e);
-  // Now, trim silence from the beginning of the file...
-  e = sox_create_effect(sox_find_effect("silence"));
-  assert(sox_effect_options(e, 3, args) == SOX_SUCCESS);
-  sox_result = sox_add_effect(chain, e, &in->signal, &in->signal);
-  if (sox_result != SOX_SUCCESS)
-  {
-    report_error(NULL, sox_result, __FILE__, __LINE__);
-    cleanup();
+  /* (After the automation, which lives in the arena as long as the job.) */
+  mark = arena_mark(&job->arena);
+  ring_samples = (size_t)(PREVIEW_SECONDS * signal.rate) * signal.channels;
+  gap_samples = (size_t)(PREVIEW_GAP_SECONDS * signal.rate) * signal.channels;
+  ring = (sox_sample_t *)arena_alloc(&job->arena, ring_samples * sizeof(sox_sample_t));
+  if (ring == NULL
+      || (job->out = sox_open_write(path, &signal, &encoding, NULL, NULL, NULL)) == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    arena_release(&job->arena, mark);
+    job_cleanup(job);
     return;
   }
-  free(e);
-  e = sox_create_effect(sox_find_effect("output"));
-  args[0] = (char *)out, assert(sox_effect_options(e, 1, args) == SOX_SUCCESS);
-  assert(sox_add_effect(chain, e, &in->signal, &in->signal) == SOX_SUCCESS);
-  free(e);
+  for (i = 0; i + 1 < job->file_count && result == SOX_SUCCESS; ++i)
+  {
+    result = preview_tail(job, i, &signal, encoding.bits_per_sample, ring, ring_samples);
+    if (result == SOX_SUCCESS)
+    {
+      result = preview_head(job, i + 1, &signal, encoding.bits_per_sample, ring_samples);
+    }
+    if (i + 2 < job->file_count)
+    {
+      memset(job->samples, 0, sizeof(job->samples));
+      for (n = gap_samples; n > 0 && result == SOX_SUCCESS; n -= min(n, JOB_BUFFER_SAMPLES))
+      {
+        result = write_preview(job, NULL, job->samples, min(n, JOB_BUFFER_SAMPLES));
+      }
+    }
+  }
+  arena_release(&job->arena, mark);
+  if (sox_close(job->out) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  }
+  job->out = NULL;
+  if (result != SOX_SUCCESS)
+  {
+    DeleteFileA(path);
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    job_cleanup(job);
+  }
+}
+
+/* Stream input `index` into the output at the given byte offset. */
+static int write_track_at(job_t * job, aio_t * output, uint64_t offset, size_t index,
+  manifest_t const * manifest, uint64_t * samples_written, uint64_t * fingerprint,
+  uint32_t * checksum)
+{
+  track_source_t source;
+  unsigned char const * block;
+  size_t number_read, number_packed;
+  int result;
+
+  *samples_written = 0;
+  *fingerprint = FINGERPRINT_SEED;
+  *checksum = 0;
+  result = source_open(job, &source, index, manifest->encoding, manifest->bits_per_sample,
+    manifest->channels, manifest->rate, 0);
+  aio_seek(output, offset);
+  while (result == SOX_SUCCESS
+      && (number_packed = source_read(job, &source, manifest->encoding,
+            manifest->bits_per_sample, manifest->channels, &block, &number_read,
+            fingerprint)))
+  {
+    result = aio_append(output, block, number_packed);
+    *samples_written += number_read;
+    *checksum = checksum_bytes(*checksum, block, number_packed);
+    job->stats.samples += number_read;
+    job->stats.bytes_written += number_packed;
+  }
+  if (source_close(job, &source) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  }
+  job->stats.files++;
+  return result;
+}
+
+/* Hash every sample of an input file, without writing anything. */
+static int fingerprint_file(job_t * job, char const * filename, uint64_t * fingerprint)
+{
+  decoder_t * input;
+  size_t number_read;
+  int failed;
 
-  sox_flow_effects(chain, NULL, NULL);
-  sox_delete_effects_chain(chain);
-  sox_close(out);
-  sox_close(in);
-  StringCchPrintf(szNewPath, sizeof(szNewPath)/sizeof(szNewPath[0]), TEXT("%s"), convert_pwstr_to_const_char(filename));
-  CopyFileA("temp.wav", szNewPath, FALSE);
-  DeleteFileA("temp.wav");
+  *fingerprint = FINGERPRINT_SEED;
+  input = decoder_open(filename, &job->memory);
+  if (input == NULL)
+  {
+    return SOX_EOF;
+  }
+  while ((number_read = decoder_read(input, job->samples, JOB_BUFFER_SAMPLES)))
+  {
+    *fingerprint = fingerprint_samples(*fingerprint, job->samples, number_read);
+  }
+  failed = input->failed;
+  return decoder_close(input) == SOX_SUCCESS && !failed ? SOX_SUCCESS : SOX_EOF;
 }
 
-double total_duration()
+/* Patch the existing output in place, following the manifest from the last
+ * splice. Returns SOX_EOF if the output had to be left alone (or, once we
+ * have started writing, could not be finished) and a full splice is needed. */
+static int resplice_in_place(job_t * job, manifest_t * manifest)
 {
-  size_t i, sox_result;
-  double secs = 0;
-  uint64_t ws;
+  size_t i, file_count = job->file_count;
+  unsigned bytes_per_sample = manifest->bits_per_sample / 8;
+  uint64_t * new_samples, * new_offsets, data_bytes = 0, old_data_bytes = 0;
+  char * changed;
+  wav_layout_t layout;
+  HANDLE output;
+  aio_t aio;
+  int result = SOX_SUCCESS, aio_opened = 0;
+  arena_mark_t mark;
+
+  if (manifest->track_count != file_count
+      || !wav_can_pack(manifest->encoding, manifest->bits_per_sample)
+      || load_automation(job, manifest->rate) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  /* (After the automation, which lives in the arena as long as the job.) */
+  mark = arena_mark(&job->arena);
+  new_samples = (uint64_t *)arena_calloc(&job->arena, file_count, sizeof(uint64_t));
+  new_offsets = (uint64_t *)arena_calloc(&job->arena, file_count, sizeof(uint64_t));
+  changed = (char *)arena_calloc(&job->arena, file_count, sizeof(char));
+  if (new_samples == NULL || new_offsets == NULL || changed == NULL)
+  {
+    arena_release(&job->arena, mark);
+    return SOX_EOF;
+  }
 
-  for (i = 0; i < count_files(); ++i)
+  /* First decide which tracks have really changed, and by how much. */
+  for (i = 0; i < file_count && result == SOX_SUCCESS; ++i)
   {
+    manifest_track_t * track = &manifest->tracks[i];
+    uint64_t file_size, file_time, fingerprint;
+    uint64_t automation = automation_key(track_automation(job, i));
     sox_format_t * input;
 
-    /* Open this input file: */
-    input = sox_open_read(filenames[i], NULL, NULL, NULL);
+    new_samples[i] = track->samples;
+    if (strcmp(track->filename, job_base_name(job->filenames[i])) != 0
+        || manifest_stat(job->filenames[i], &file_size, &file_time) != SOX_SUCCESS)
+    {
+      result = SOX_EOF;
+      break;
+    }
+    /* New gain or fades mean rewriting the track, even if its file is
+     * untouched. */
+    changed[i] = (automation != track->automation);
+    track->automation = automation;
+    if (file_size == track->file_size && file_time == track->file_time)
+    {
+      continue;
+    }
+    input = sox_open_read(job->filenames[i], NULL, NULL, NULL);
     if (input == NULL)
     {
-      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-      cleanup();
-      return 0;
+      result = SOX_EOF;
+      break;
     }
-    ws = input->signal.length / max(input->signal.channels, 1);
-    secs += (double)ws / max(input->signal.rate, 1);
-    sox_result = sox_close(input);
-    if(sox_result != SOX_SUCCESS)
+    if (input->signal.channels != manifest->channels
+        || input->signal.rate != manifest->rate
+        || input->signal.length == 0)
     {
-      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-      cleanup();
-      return 0;
+      result = SOX_EOF;
     }
+    new_samples[i] = input->signal.length;
+    sox_close(input);
+    if (result == SOX_SUCCESS && new_samples[i] == track->samples)
+    {
+      /* Same length: only rewrite it if the samples differ (the file may
+       * just have been re-saved). */
+      result = fingerprint_file(job, job->filenames[i], &fingerprint);
+      changed[i] |= (fingerprint != track->fingerprint);
+    } else {
+      changed[i] = 1;
+    }
+    track->file_size = file_size;
+    track->file_time = file_time;
   }
-  return secs;
+  for (i = 0; i < file_count; ++i)
+  {
+    new_offsets[i] = data_bytes;
+    data_bytes += new_samples[i] * bytes_per_sample;
+    old_data_bytes += manifest->tracks[i].byte_length;
+  }
+
+  output = INVALID_HANDLE_VALUE;
+  if (result == SOX_SUCCESS)
+  {
+    output = wav_open_raw(job->output_filename, 1);
+  }
+  if (output == INVALID_HANDLE_VALUE
+      || wav_read_layout(output, &layout) != SOX_SUCCESS
+      || layout.data_offset != manifest->data_offset
+      || layout.data_bytes != old_data_bytes
+      || (layout.container == WAV_CONTAINER_RIFF && data_bytes > RIFF_MAX_DATA_BYTES))
+  {
+    /* (A RIFF output that would outgrow 4 GB is promoted by a full splice.) */
+    result = SOX_EOF;
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = aio_open(&aio, output, &job->memory);
+    aio_opened = 1;
+  }
+
+  /* Unchanged tracks that now sit further along the file are moved last
+   * first, and those that move back are moved first first, so that no
+   * move overwrites a track that has yet to be moved. Changed tracks are
+   * then written into their new places. */
+  for (i = file_count; i-- > 0 && result == SOX_SUCCESS; )
+  {
+    if (!changed[i] && new_offsets[i] > manifest->tracks[i].byte_offset)
+    {
+      result = aio_move(&aio, layout.data_offset + manifest->tracks[i].byte_offset,
+        layout.data_offset + new_offsets[i], manifest->tracks[i].byte_length);
+    }
+  }
+  for (i = 0; i < file_count && result == SOX_SUCCESS; ++i)
+  {
+    if (!changed[i] && new_offsets[i] < manifest->tracks[i].byte_offset)
+    {
+      result = aio_move(&aio, layout.data_offset + manifest->tracks[i].byte_offset,
+        layout.data_offset + new_offsets[i], manifest->tracks[i].byte_length);
+    }
+  }
+  for (i = 0; i < file_count && result == SOX_SUCCESS; ++i)
+  {
+    manifest_track_t * track = &manifest->tracks[i];
+    uint64_t samples_written;
+
+    if (changed[i])
+    {
+      result = write_track_at(job, &aio, layout.data_offset + new_offsets[i], i,
+        manifest, &samples_written, &track->fingerprint, &track->checksum);
+      if (samples_written != new_samples[i])
+      {
+        result = SOX_EOF;
+      }
+    }
+    track->samples = new_samples[i];
+    track->byte_offset = new_offsets[i];
+    track->byte_length = new_samples[i] * bytes_per_sample;
+  }
+  if (aio_opened && aio_close(&aio) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = wav_update_sizes(output, &layout, data_bytes);
+  }
+  if (output != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(output);
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = manifest_write(job->output_filename, manifest);
+    /* Tracks have moved under the old peaks. */
+    peaks_remove(job->output_filename);
+  }
+  arena_release(&job->arena, mark);
+  return result;
 }
 
 /*
- * Splice audio files
- *
- * This is how I got it to work in zsh, with the Linux/MacOS sox executable...
- *
- *  sox babayaga.wav greatgate.wav _merged.wav splice -q `soxi -D babayaga.wav`,0.1
- *
- * NOTE: The sample files are from Mussorgsky's _Pictures_at_an_Exhibition_, at
- * the transition from "The Hut on Fowl's Legs" to "The Great Gate at Kiev."
+ * Re-splice after some of the input files have been edited
  *
- * I think example4.c in the libsox package is closest to what I am trying to do.
+ * Rather than rewriting everything, use the manifest from the last splice()
+ * to overwrite changed tracks where they sit, moving only the tracks after
+ * any whose length has changed. If there is no usable manifest, or the set
+ * of files is different, this is just a full splice().
  */
-void splice()
+void resplice(job_t * job)
 {
-  sox_format_t * output = NULL;
-  size_t i, sox_result;
-  for (i = 0; i < count_files(); ++i)
+  manifest_t manifest;
+
+  if (manifest_read(job->output_filename, &manifest) != SOX_SUCCESS)
   {
-    report_current_action(NULL, filenames[i]);
+    splice(job);
+    return;
   }
-
-  for (i = 0; i < count_files(); ++i)
+  if (resplice_in_place(job, &manifest) != SOX_SUCCESS)
   {
-    sox_format_t * input;
-    static sox_signalinfo_t signal; /* static quashes 'uninitialized' warning. */
-
-    /* The (maximum) number of samples that we shall read/write at a time;
-     * chosen as a rough match to typical operating system I/O buffer size: */
-    #define MAX_SAMPLES (size_t)2048
-    sox_sample_t samples[MAX_SAMPLES]; /* Temporary store whilst copying */
-    size_t number_read, number_written;
+    splice(job);
+  }
+  manifest_free(&manifest);
+}
 
-    /* Open this input file: */
+/*
+ * Bring the splice up to date with one file, job->filenames[index], that
+ * has just been added to the list (or has changed), as watch mode does for
+ * each new take. The file gets an empty track in the manifest, which
+ * resplice_in_place() then fills; only the tracks after it move, so a take
+ * added at the end costs no more than writing that one file.
+ */
+void splice_track(job_t * job, size_t index, int added)
+{
+  manifest_t manifest;
+  manifest_track_t * tracks;
 
-    input = sox_open_read(filenames[i], NULL, NULL, NULL);
-    if (input == NULL)
+  if (manifest_read(job->output_filename, &manifest) != SOX_SUCCESS)
+  {
+    splice(job);
+    return;
+  }
+  if (added && index < job->file_count && manifest.track_count + 1 == job->file_count)
+  {
+    tracks = (manifest_track_t *)realloc(manifest.tracks,
+      job->file_count * sizeof(manifest_track_t));
+    if (tracks == NULL)
     {
-      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-      cleanup();
+      manifest_free(&manifest);
+      splice(job);
       return;
     }
-    if (i == 0) /* If this is the first input file... */
+    manifest.tracks = tracks;
+    memmove(&tracks[index + 1], &tracks[index],
+      (manifest.track_count - index) * sizeof(manifest_track_t));
+    memset(&tracks[index], 0, sizeof(manifest_track_t));
+    manifest.track_count++;
+    tracks[index].filename = _strdup(job_base_name(job->filenames[index]));
+    if (tracks[index].filename == NULL)
     {
-      /* report_current_action(NULL, "First file"); */
-      /* Open the output file using the same signal and encoding character-
-       * istics as the first input file.  Note that here, input->signal.length
-       * will not be equal to the output file length so we are relying on
-       * libSoX to set the output length correctly (i.e. non-seekable output
-       * is not catered for) */
-      output = sox_open_write(DEFAULT_OUTPUT_FILENAME, 
-        &input->signal, &input->encoding, NULL, NULL, NULL);
-      if (output == NULL)
-      {
-        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-        cleanup();
-        return;
-      }
-      /* Also, we'll store the signal characteristics of the first file
-       * so that we can check that these match those of the other inputs: */
-      signal = input->signal;
-    } else { /* Second or subsequent input file... */
-      /* report_current_action(NULL, "Second file"); */
-      /* Check that this input file's signal matches that of the first file: */
-      if ((input->signal.channels != signal.channels) ||
-                          (input->signal.rate != signal.rate))
-      {
-        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-        cleanup();
-        return;
-      }
+      manifest_free(&manifest);
+      splice(job);
+      return;
     }
-    /* Copy all of the audio from this input file to the output file: */
-    while ((number_read = sox_read(input, samples, MAX_SAMPLES)))
+  }
+  if (resplice_in_place(job, &manifest) != SOX_SUCCESS)
+  {
+    splice(job);
+  }
+  manifest_free(&manifest);
+}
+
+/*
+ * Check the output against the checksums in its manifest
+ *
+ * This reads the output once, and none of the inputs. A track whose bytes
+ * are not what was written is reported by name, as is an output that has
+ * changed anywhere else.
+ */
+void verify(job_t * job)
+{
+  manifest_t manifest;
+  wav_layout_t layout;
+  HANDLE output;
+  aio_t aio;
+  unsigned char const * data = NULL;
+  uint64_t offset = 0, end, total = 0;
+  uint32_t whole = 0, checksum;
+  size_t i, length, available = 0;
+  int result = SOX_SUCCESS, damaged = 0, aio_opened = 0;
+
+  if (manifest_read(job->output_filename, &manifest) != SOX_SUCCESS || !manifest.checksummed)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return;
+  }
+  for (i = 0; i < manifest.track_count; ++i)
+  {
+    total += manifest.tracks[i].byte_length;
+  }
+  output = wav_open_raw(job->output_filename, 0);
+  if (output == INVALID_HANDLE_VALUE
+      || wav_read_layout(output, &layout) != SOX_SUCCESS
+      || layout.data_offset != manifest.data_offset
+      || total > layout.data_bytes
+      || aio_open(&aio, output, &job->memory) != SOX_SUCCESS)
+  {
+    result = SOX_EOF;
+  } else {
+    aio_opened = 1;
+    /* Read the whole data chunk ahead, and split it into tracks here. */
+    result = aio_scan(&aio, layout.data_offset, total);
+  }
+  for (i = 0; i < manifest.track_count && result == SOX_SUCCESS; ++i)
+  {
+    manifest_track_t const * track = &manifest.tracks[i];
+
+    if (track->byte_offset != offset)
     {
-      number_written = sox_write(output, samples, number_read);
-      if(number_written != number_read)
+      result = SOX_EOF;
+      break;
+    }
+    checksum = 0;
+    for (end = offset + track->byte_length; offset < end; offset += length)
+    {
+      if (available == 0 && (available = aio_next(&aio, &data)) == 0)
       {
-        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-        cleanup();
-        return;
+        result = SOX_EOF;
+        break;
       }
+      length = (size_t)min(end - offset, (uint64_t)available);
+      checksum = checksum_bytes(checksum, data, length);
+      data += length;
+      available -= length;
     }
-    sox_result = sox_close(input);
-    if(sox_result != SOX_SUCCESS)
+    if (result == SOX_SUCCESS && checksum != track->checksum)
     {
+      damaged = 1;
+      report_current_action(NULL, track->filename);
       report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-      cleanup();
-      return;
     }
+    whole = checksum_combine(whole, checksum, track->byte_length);
   }
-  sox_result = sox_close(output);
-  if(sox_result != SOX_SUCCESS)
+  if (result != SOX_SUCCESS || offset != layout.data_bytes
+      || (!damaged && whole != manifest.checksum))
   {
     report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-    cleanup();
-    return;
   }
-  output = NULL;
+  if (aio_opened)
+  {
+    aio_close(&aio);
+  }
+  if (output != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(output);
+  }
+  manifest_free(&manifest);
 }
 
-/* All done; tidy up... */
+/* All done; tidy up... (Each job closes its own files, see job_cleanup().) */
 int cleanup()
 {
-  STRSAFE_LPSTR sox_wildcard = L"libSoX.tmp*";
-  TCHAR szTempFileWildcard[MAX_PATH * sizeof(TCHAR)];
-  TCHAR szCurrentTempFileName[MAX_PATH * sizeof(TCHAR)];
-  WIN32_FIND_DATA fdFile;
-  HANDLE hFind = NULL;
   size_t i;
 
-  if (in != NULL) sox_close(in);
-  if (out != NULL) sox_close(out);
-
   /* Close the input and output files before exiting. */
   /*
   for (i = 0; i < input_count; i++)
@@ -325,38 +1985,9 @@ int cleanup()
   }
   */
 
-  if (sox_quit_called == 0)
+  if (InterlockedCompareExchange(&sox_quit_called, 1, 0) == 0)
   {
     sox_quit();
-    sox_quit_called = 1;
-  }
-  GetTempPathW(MAX_PATH, szTempFileWildcard);
-  StringCbCatW(szTempFileWildcard, MAX_PATH, sox_wildcard);
-  if((hFind = FindFirstFile(szTempFileWildcard, &fdFile)) != INVALID_HANDLE_VALUE)
-  {
-    do
-    {
-      /* FindFirstFile will always return "." and ".."
-       * as the first two directories. */
-      if(strcmp(fdFile.cFileName, ".") != 0
-        && strcmp(fdFile.cFileName, "..") != 0)
-      {
-        GetTempPathW(MAX_PATH, szCurrentTempFileName);
-        StringCbCatW(szCurrentTempFileName, MAX_PATH, fdFile.cFileName);
-        DeleteFileW(szCurrentTempFileName);
-      }
-    }
-    while(FindNextFile(hFind, &fdFile)); /* Find the next file. */
-  }
-
-  if (filenames != NULL)
-  {
-    while (*filenames != NULL)
-    {
-      CoTaskMemFree(*filenames);
-      ++filenames;
-    }
-    CoTaskMemFree(filenames);
   }
   return 0;
 }
@@ -23,9 +23,9 @@
 #include <stdio.h>
 #include <assert.h>
 
-static char *starting_directory[sizeof(TCHAR) * MAX_PATH + 1];
-static char *working_directory[sizeof(TCHAR) * MAX_PATH + 1];
-char ** filenames;
+/* Set in watch and server modes, where there is nobody to click OK:
+ * messages are appended to a log file instead. */
+static FILE * headless_log;
 
 /**
  * General Utilities
@@ -34,7 +34,8 @@ char ** filenames;
 int compare_filenames(const void* a, const void* b)
 {
   size_t digits_to_compare = DEFAULT_TRACK_NUMER_WIDTH;
-  return strncmp(*(const char**)a, *(const char**)b, digits_to_compare);
+  return strncmp(job_base_name(*(const char**)a), job_base_name(*(const char**)b),
+    digits_to_compare);
 }
 
 int ends_with(const TCHAR *str, const TCHAR *suffix)
@@ -55,78 +56,55 @@ int is_wav_file(const TCHAR *str)
   return 0;
 }
 
-const char* convert_pwstr_to_const_char(PWSTR wideString)
+/* Find the audio files in the job's folder, in track order. */
+int load_filenames(job_t * job)
 {
-  int length = WideCharToMultiByte(CP_UTF8, 0, wideString, -1, NULL, 0, NULL, NULL);
-  char* buffer = (char*)malloc(length * sizeof(char) + 1);
-  if (buffer == NULL)
-  {
-    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-    cleanup();
-    exit(1);
-  }
-  if (WideCharToMultiByte(CP_UTF8, 0, wideString, -1, buffer, length, NULL, NULL) == 0)
-  {
-    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-    free(buffer);
-    cleanup();
-    exit(1);
-  }
-  return buffer;
-}
-
-size_t count_files()
-{
-  size_t count = 0;
-  char **current = filenames;
-
-  while (*current != NULL)
-  {
-    ++count;
-    ++current;
-  }
-  return count;
-}
-
-void load_filenames(PWSTR directory_path)
-{
-  STRSAFE_LPSTR wav_wildcard = L"*.wav";
+  TCHAR wildcard[MAX_PATH];
   WIN32_FIND_DATA fdFile;
   HANDLE hFind = NULL;
-  filenames = (char**)CoTaskMemAlloc(1 * sizeof(char*));
+  int result = SOX_SUCCESS;
 
-  int file_count = 0;
-  sox_format_t * current_sound_file;
-  PWSTR buffer = NULL;
-  if((hFind = FindFirstFile(wav_wildcard, &fdFile)) != INVALID_HANDLE_VALUE)
+  StringCchPrintfW(wildcard, MAX_PATH, L"%s\\*", job->directory);
+  if((hFind = FindFirstFile(wildcard, &fdFile)) != INVALID_HANDLE_VALUE)
   {
     do {
       /* FindFirstFile will always return "." and ".."
        * as the first two directories. */
-      if(strcmp(fdFile.cFileName, ".") != 0
-          && strcmp(fdFile.cFileName, "..") != 0)
+      if(wcscmp(fdFile.cFileName, L".") != 0
+          && wcscmp(fdFile.cFileName, L"..") != 0
+          && _wcsicmp(fdFile.cFileName, L"" DEFAULT_OUTPUT_FILENAME) != 0
+          && _wcsicmp(fdFile.cFileName, L"" FLAC_OUTPUT_FILENAME) != 0
+          && _wcsicmp(fdFile.cFileName, L"" CD_OUTPUT_FILENAME) != 0
+          && _wcsicmp(fdFile.cFileName, L"" PREVIEW_OUTPUT_FILENAME) != 0)
       {
-        file_count++;
-        filenames = (char**)CoTaskMemRealloc(filenames, file_count * sizeof(char *));
-        filenames[file_count - 1] = (char *)malloc(wcslen(fdFile.cFileName) + 1);
-        StringCbPrintfA(filenames[file_count - 1], (wcslen(fdFile.cFileName) + 1), 
-          "%s", convert_pwstr_to_const_char(fdFile.cFileName));
+        arena_mark_t mark = arena_mark(&job->arena);
+        char * path = job_path(job, fdFile.cFileName);
+
+        if (path == NULL)
+        {
+          result = SOX_EOF;
+        }
+        else if (decoder_accepts(path))
+        {
+          result = job_add_file(job, path);
+        } else {
+          arena_release(&job->arena, mark);
+        }
       }
     }
-    while(FindNextFile(hFind, &fdFile));
+    while(result == SOX_SUCCESS && FindNextFile(hFind, &fdFile));
     FindClose(hFind);
   }
 
-  size_t buffer_size = (wcslen(L"File Count: ") + 10) * sizeof(WCHAR);
-  PWSTR msgbuf = (PWSTR)CoTaskMemAlloc(buffer_size);
-  StringCbPrintfW(msgbuf, buffer_size, L"File Count: %d", file_count);
-  MessageBox(NULL, msgbuf, L"SANITY CHECK", MB_OK);
-  CoTaskMemFree(msgbuf);
-
-  qsort(filenames, file_count, sizeof(char *), compare_filenames);
+  if (headless_log == NULL)
+  {
+    TCHAR msgbuf[40];
+    StringCchPrintfW(msgbuf, ARRAYSIZE(msgbuf), L"File Count: %d", (int)job->file_count);
+    MessageBox(NULL, msgbuf, L"SANITY CHECK", MB_OK);
+  }
 
-  /* Add a final null terminator so we can calculate the number of files */
-  filenames[file_count] = NULL;
+  qsort(job->filenames, job->file_count, sizeof(char *), compare_filenames);
+  return result;
 }
 
 /**
@@ -142,7 +120,15 @@ IFileDialog* pFileOpenDialog;
 #define TEXT_MARGIN_VERTICAL      10
 #define TEXT_MARGIN_HORIZONTAL    10
 #define IDM_FILE_OPEN             1
-#define IDM_FILE_EXIT             3
+#define IDM_FILE_RESPLICE         2
+#define IDM_FILE_FLAC             3
+#define IDM_FILE_16BIT            4
+#define IDM_FILE_DELIVER          5
+#define IDM_FILE_PREVIEW          6
+#define IDM_FILE_PLAN             7
+#define IDM_FILE_SPLIT            8
+#define IDM_FILE_VERIFY           9
+#define IDM_FILE_EXIT             10
 
 HCURSOR original_cursor;
 
@@ -157,52 +143,365 @@ void restore_cursor()
   SetCursor(original_cursor);
 }
 
+/* These may be called from any job's thread, with no job to hand, so the
+ * messages are put together on the stack rather than allocated. */
 void report_error(HWND hwnd, int errcode, char * file, int line_number)
 {
-  PWSTR filenamebuf;
-
-  TCHAR *msg_template = L"ERROR %d at line %d in %s\n";
-  int filename_length = MultiByteToWideChar(CP_ACP, 0, file, -1, NULL, 0);
-  filenamebuf = (PWSTR)CoTaskMemAlloc(filename_length * sizeof(WCHAR));
-  MultiByteToWideChar(CP_ACP, 0, file, -1, filenamebuf, filename_length);
-  size_t buffer_size = (wcslen(msg_template) + 20 + filename_length) * sizeof(WCHAR);
-  PWSTR msgbuf = (PWSTR)CoTaskMemAlloc(buffer_size);
-  StringCbPrintfW(msgbuf, buffer_size, msg_template, errcode, line_number, filenamebuf);
+  TCHAR filenamebuf[MAX_PATH];
+  TCHAR msgbuf[MAX_PATH + 64];
+
+  if (MultiByteToWideChar(CP_ACP, 0, file, -1, filenamebuf, MAX_PATH) == 0)
+  {
+    filenamebuf[0] = L'\0';
+  }
+  StringCchPrintfW(msgbuf, ARRAYSIZE(msgbuf), L"ERROR %d at line %d in %s\n",
+    errcode, line_number, filenamebuf);
+  InterlockedIncrement(&errors_reported);
+  if (headless_log != NULL)
+  {
+    fwprintf(headless_log, L"%s", msgbuf);
+    fflush(headless_log);
+    return;
+  }
   MessageBox(hwnd, msgbuf, L"ERROR", MB_OK);
-  CoTaskMemFree(filenamebuf);
-  CoTaskMemFree(msgbuf);
 }
 
 void report_current_action(HWND hwnd, const char* message)
 {
-  PWSTR msgbuf;
-  int message_length = MultiByteToWideChar(CP_ACP, 0, message, -1, NULL, 0);
-  msgbuf = (PWSTR)CoTaskMemAlloc((message_length * sizeof(WCHAR) + 1));
-  MultiByteToWideChar(CP_ACP, 0, message, -1, msgbuf, message_length);
+  TCHAR msgbuf[1024];
+
+  /* Too long a message is cut short. */
+  msgbuf[0] = L'\0';
+  if (MultiByteToWideChar(CP_UTF8, 0, message, -1, msgbuf, ARRAYSIZE(msgbuf)) == 0)
+  {
+    msgbuf[ARRAYSIZE(msgbuf) - 1] = L'\0';
+  }
+  if (headless_log != NULL)
+  {
+    fwprintf(headless_log, L"%s\n", msgbuf);
+    fflush(headless_log);
+    return;
+  }
   MessageBox(hwnd, msgbuf, L"CURRENT ACTION", MB_OK);
-  CoTaskMemFree(msgbuf);
 }
 
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
-/* Splice the audio files using SoX */
-DWORD WINAPI SpliceThreadProc()
+/* Splice the audio files using SoX. The thread owns the job it is given. */
+DWORD WINAPI SpliceThreadProc(LPVOID parameter)
 {
-  load_filenames(working_directory);
-  if (filenames != NULL)
+  job_t * job = (job_t *)parameter;
+
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
   {
-    splice();
+    splice(job);
   }
+  job_free(job);
   return 0;
 }
 
+/* Splice the audio files into a FLAC file instead */
+DWORD WINAPI SpliceFlacThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+
+  if (job_set_output_format(job, OUTPUT_FLAC) == SOX_SUCCESS
+      && load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    splice(job);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Splice the audio files, dithering them down to 16 bits */
+DWORD WINAPI Splice16ThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+
+  job->output_bits = 16;
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    splice(job);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Splice the audio files into every deliverable, decoding them once */
+DWORD WINAPI SpliceDeliverablesThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    splice_deliverables(job);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Write just the few seconds around each join, to listen to */
+DWORD WINAPI PreviewThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    preview_joins(job);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Report what a splice would write, from the files' headers alone */
+DWORD WINAPI PlanThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+  splice_plan_t plan;
+
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    if (plan_splice(job, &plan) == SOX_SUCCESS)
+    {
+      plan_report(job, &plan);
+    } else {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    }
+    plan_free(&plan);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Patch an earlier splice after some of its files have been edited */
+DWORD WINAPI RespliceThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
+  {
+    resplice(job);
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Check an earlier splice against the checksums in its manifest */
+DWORD WINAPI VerifyThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+  LONG errors = errors_reported;
+
+  verify(job);
+  if (errors_reported == errors)
+  {
+    report_current_action(NULL, "Splice verified");
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Split each long capture in the folder into tracks at its silences */
+DWORD WINAPI SplitThreadProc(LPVOID parameter)
+{
+  job_t * job = (job_t *)parameter;
+  char message[MAX_PATH + 32];
+  unsigned tracks;
+  size_t i;
+
+  if (load_filenames(job) == SOX_SUCCESS)
+  {
+    for (i = 0; i < job->file_count; ++i)
+    {
+      if (split_file(job, job->filenames[i], DEFAULT_SPLIT_GAP, DEFAULT_NOISE_DURATION,
+            DEFAULT_SILENCE_THRESHOLD, &tracks) != SOX_SUCCESS)
+      {
+        report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+        break;
+      }
+      StringCbPrintfA(message, sizeof(message), "%s: %u tracks",
+        job_base_name(job->filenames[i]), tracks);
+      report_current_action(NULL, message);
+    }
+  }
+  job_free(job);
+  return 0;
+}
+
+/* Ask for a folder and start thread_proc on a new job for it. Any number
+ * of jobs may be running at once. */
+void select_folder_and_run(HWND hwnd, LPTHREAD_START_ROUTINE thread_proc)
+{
+  HRESULT hr = CoCreateInstance(&CLSID_FileOpenDialog, NULL, CLSCTX_ALL, &IID_IFileDialog, (void**)&pFileOpenDialog);
+  if (SUCCEEDED(hr))
+  {
+    DWORD dwOptions;
+    pFileOpenDialog->lpVtbl->GetOptions(pFileOpenDialog, &dwOptions);
+    pFileOpenDialog->lpVtbl->SetOptions(pFileOpenDialog, dwOptions | FOS_PICKFOLDERS | FOS_FILEMUSTEXIST);
+    pFileOpenDialog->lpVtbl->SetOkButtonLabel(pFileOpenDialog, L"Select Folder");
+    hr = pFileOpenDialog->lpVtbl->Show(pFileOpenDialog, hwnd);
+    if (SUCCEEDED(hr))
+    {
+      IShellItem* pSelectedItem = NULL;
+      TCHAR *pszFolderPath = NULL;
+      hr = pFileOpenDialog->lpVtbl->GetResult(pFileOpenDialog, &pSelectedItem);
+      if (SUCCEEDED(hr))
+      {
+        hr = pSelectedItem->lpVtbl->GetDisplayName(pSelectedItem, SIGDN_FILESYSPATH, &pszFolderPath);
+        if (SUCCEEDED(hr))
+        {
+          int filePathLength = (wcslen(pszFolderPath) + 1) * sizeof(TCHAR);
+          job_t * job = NULL;
+          if (filePathLength < MAX_PATH)
+          {
+            job = job_create(pszFolderPath);
+          }
+          if (job != NULL)
+          {
+            DWORD dwThreadId;
+            set_wait_cursor();
+            HANDLE hThread = CreateThread(NULL, 0, thread_proc, job, 0, &dwThreadId);
+            if (hThread != NULL)
+            {
+              CloseHandle(hThread);
+            } else {
+              report_error(hwnd, ST_ERROR, __FILE__, __LINE__);
+              job_free(job);
+            }
+            restore_cursor();
+          } else {
+            report_error(hwnd, filePathLength, __FILE__, __LINE__);
+          }
+          CoTaskMemFree(pszFolderPath);
+        }
+        pSelectedItem->lpVtbl->Release(pSelectedItem);
+      }
+    }
+    pFileOpenDialog->lpVtbl->Release(pFileOpenDialog);
+    pFileOpenDialog = NULL;
+  }
+}
+
+/* Start running with no window, logging to log_path. */
+static int start_headless(PCWSTR log_path)
+{
+  int result;
+
+  headless_log = _wfopen(log_path, L"a");
+  if (headless_log == NULL)
+  {
+    return SOX_EOF;
+  }
+  result = sox_init();
+  if (result != SOX_SUCCESS)
+  {
+    report_error(NULL, result, __FILE__, __LINE__);
+    fclose(headless_log);
+    headless_log = NULL;
+  }
+  return result;
+}
+
+static void stop_headless(void)
+{
+  cleanup();
+  fclose(headless_log);
+  headless_log = NULL;
+}
+
+/* Headless watch mode, "splice /watch <folder>": splice the folder, then
+ * keep the splice up to date as takes are added, until the process is
+ * ended. */
+int run_watch(PCWSTR folder)
+{
+  TCHAR log_path[MAX_PATH];
+  job_t * job;
+  int result;
+
+  if (FAILED(StringCchPrintfW(log_path, MAX_PATH, L"%s\\%s", folder, L"" WATCH_LOG_FILENAME))
+      || start_headless(log_path) != SOX_SUCCESS)
+  {
+    return 1;
+  }
+  job = job_create(folder);
+  if (job == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    result = SOX_EOF;
+  } else {
+    result = watch_folder(job);
+    job_free(job);
+  }
+  stop_headless();
+  return result == SOX_SUCCESS ? 0 : 1;
+}
+
+/* Job server mode, "splice /serve": run the jobs sent by "splice /submit"
+ * (see server.c) until one says "quit". */
+int run_serve(void)
+{
+  TCHAR log_path[MAX_PATH];
+  int result;
+
+  if (GetTempPathW(MAX_PATH, log_path) == 0
+      || FAILED(StringCchCatW(log_path, MAX_PATH, L"" SERVER_LOG_FILENAME))
+      || start_headless(log_path) != SOX_SUCCESS)
+  {
+    return 1;
+  }
+  result = server_run();
+  stop_headless();
+  return result == SOX_SUCCESS ? 0 : 1;
+}
+
+/* "splice /submit <job> [<folder>]": hand a job to the server, and pass
+ * its reply on to whoever is reading our output. */
+int run_submit(PCWSTR job_name, PCWSTR folder)
+{
+  char reply[SERVER_MESSAGE_BYTES];
+  HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+  int result = server_submit(job_name, folder, reply, sizeof(reply));
+  DWORD written;
+
+  if (output != NULL && output != INVALID_HANDLE_VALUE)
+  {
+    WriteFile(output, reply, (DWORD)strlen(reply), &written, NULL);
+  }
+  return result == SOX_SUCCESS ? 0 : 1;
+}
+
 #define NOMINMAX // from example on stackoverflow.com
 
 int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
   const TCHAR CLASS_NAME[] = L"Splicing Audio Files";
+  int argc;
+  LPWSTR * argv = CommandLineToArgvW(GetCommandLineW(), &argc);
 
-  filenames = NULL;
+  if (argv != NULL && argc >= 2)
+  {
+    int result = -1;
+
+    if (argc == 3 && _wcsicmp(argv[1], L"/watch") == 0)
+    {
+      result = run_watch(argv[2]);
+    }
+    else if (argc == 2 && _wcsicmp(argv[1], L"/serve") == 0)
+    {
+      result = run_serve();
+    }
+    else if ((argc == 3 || argc == 4) && _wcsicmp(argv[1], L"/submit") == 0)
+    {
+      result = run_submit(argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    if (result != -1)
+    {
+      LocalFree(argv);
+      return result;
+    }
+  }
+  LocalFree(argv);
 
   WNDCLASS wc = { };
 
@@ -245,6 +544,14 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 
   AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hFileMenu, L"Folder");
   AppendMenu(hFileMenu, MF_STRING, IDM_FILE_OPEN, L"Select");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_RESPLICE, L"Re-splice Changes");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_FLAC, L"Splice to FLAC");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_16BIT, L"Splice to 16-bit");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_DELIVER, L"Splice Deliverables");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_PLAN, L"Plan Splice");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_PREVIEW, L"Preview Joins");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_SPLIT, L"Split Captures");
+  AppendMenu(hFileMenu, MF_STRING, IDM_FILE_VERIFY, L"Verify Splice");
   AppendMenu(hFileMenu, MF_STRING, IDM_FILE_EXIT, L"Exit");
 
   SetMenu(hwnd, hMenu);
@@ -275,7 +582,6 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
       CREATESTRUCT *pCreate = (CREATESTRUCT*)(lParam);
       sox_result = sox_init();
-      sox_quit_called = 0;
       if (sox_result != SOX_SUCCESS)
       {
         report_error(hwnd, sox_result, __FILE__, __LINE__);
@@ -287,53 +593,31 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     switch(LOWORD(wParam))
     {
       case IDM_FILE_OPEN:
-        {
-          HRESULT hr = CoCreateInstance(&CLSID_FileOpenDialog, NULL, CLSCTX_ALL, &IID_IFileDialog, (void**)&pFileOpenDialog);
-          if (SUCCEEDED(hr))
-          {
-            DWORD dwOptions;
-            pFileOpenDialog->lpVtbl->GetOptions(pFileOpenDialog, &dwOptions);
-            pFileOpenDialog->lpVtbl->SetOptions(pFileOpenDialog, dwOptions | FOS_PICKFOLDERS | FOS_FILEMUSTEXIST);
-            pFileOpenDialog->lpVtbl->SetOkButtonLabel(pFileOpenDialog, L"Select Folder");
-            GetCurrentDirectory((sizeof(TCHAR) * MAX_PATH), starting_directory);
-            hr = pFileOpenDialog->lpVtbl->Show(pFileOpenDialog, hwnd);
-            if (SUCCEEDED(hr))
-            {
-              IShellItem* pSelectedItem = NULL;
-              TCHAR *pszFolderPath = NULL;
-              hr = pFileOpenDialog->lpVtbl->GetResult(pFileOpenDialog, &pSelectedItem);
-              if (SUCCEEDED(hr))
-              {
-                hr = pSelectedItem->lpVtbl->GetDisplayName(pSelectedItem, SIGDN_FILESYSPATH, &pszFolderPath);
-                if (SUCCEEDED(hr))
-                {
-                  int filePathLength = (wcslen(pszFolderPath) + 1) * sizeof(TCHAR);
-                  wcscpy_s(working_directory, filePathLength, pszFolderPath);
-                  if (filePathLength < MAX_PATH)
-                  {
-                    SetCurrentDirectory(working_directory);
-                    DWORD dwThreadId;
-                    set_wait_cursor();
-                    HANDLE hThread = CreateThread(NULL, 0, SpliceThreadProc, NULL, 0, &dwThreadId);
-                    if (hThread != NULL)
-                    {
-                      CloseHandle(hThread);
-                    } else {
-                      report_error(hwnd, ST_ERROR, __FILE__, __LINE__);
-                    }
-                    restore_cursor();
-                    CoTaskMemFree(pszFolderPath);
-                  } else {
-                    report_error(hwnd, filePathLength, __FILE__, __LINE__);
-                  }
-                }
-                pSelectedItem->lpVtbl->Release(pSelectedItem);
-              }
-            }
-            pFileOpenDialog->lpVtbl->Release(pFileOpenDialog);
-            pFileOpenDialog = NULL;
-          }
-        }
+        select_folder_and_run(hwnd, SpliceThreadProc);
+        break;
+      case IDM_FILE_RESPLICE:
+        select_folder_and_run(hwnd, RespliceThreadProc);
+        break;
+      case IDM_FILE_FLAC:
+        select_folder_and_run(hwnd, SpliceFlacThreadProc);
+        break;
+      case IDM_FILE_16BIT:
+        select_folder_and_run(hwnd, Splice16ThreadProc);
+        break;
+      case IDM_FILE_DELIVER:
+        select_folder_and_run(hwnd, SpliceDeliverablesThreadProc);
+        break;
+      case IDM_FILE_PREVIEW:
+        select_folder_and_run(hwnd, PreviewThreadProc);
+        break;
+      case IDM_FILE_PLAN:
+        select_folder_and_run(hwnd, PlanThreadProc);
+        break;
+      case IDM_FILE_SPLIT:
+        select_folder_and_run(hwnd, SplitThreadProc);
+        break;
+      case IDM_FILE_VERIFY:
+        select_folder_and_run(hwnd, VerifyThreadProc);
         break;
       case IDM_FILE_EXIT:
         DestroyWindow(hwnd);
@@ -342,7 +626,6 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     break;
   case WM_CLOSE:
     {
-      SetCurrentDirectory(starting_directory);
       DestroyWindow(hwnd);
     }
     break;
@@ -381,11 +664,26 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
       GetClientRect(hwnd, &rect);
       InflateRect(&rect, -TEXT_MARGIN_HORIZONTAL, -TEXT_MARGIN_VERTICAL);
       DrawTextEx(hdc,
-        L"FILE SPLICER\n\nThis application splices all the .wav audio files in a directory. "\
+        L"FILE SPLICER\n\nThis application splices all the audio files (.wav, .flac, .aiff...) in a directory. "\
           "The ordering of the files' contents in the output is determined by "\
           "the names of the files, so please make sure each filename starts with the correct track number. "\
           "File names for tracks 1 through 9 must be zero-padded. You can splice up to fifty files in a single directory.\n\n"\
           "The output file (spliced-audio.wav) will be placed in the same folder as the input files.\n\n"\
+          "If you later edit some of the files, 'Folder | Re-splice Changes' updates the output "\
+          "without rewriting the tracks that have not changed.\n\n"\
+          "'Folder | Splice to FLAC' writes a compressed spliced-audio.flac instead, and "\
+          "'Folder | Splice to 16-bit' dithers 24-bit sources down to 16 bits. "\
+          "'Folder | Splice Deliverables' writes spliced-audio.wav, a 16-bit 44.1 kHz "\
+          "spliced-audio-cd.wav and spliced-audio.flac together, reading the files only once. "\
+          "'Folder | Plan Splice' reports the length and size of the splice, and where "\
+          "each track will start, from the files' headers alone. "\
+          "'Folder | Preview Joins' writes spliced-audio-preview.wav, just the few seconds "\
+          "either side of each join, to check them by ear without a full splice. "\
+          "'Folder | Split Captures' does the opposite, cutting each long recording in the folder "\
+          "into tracks at its silences. 'Folder | Verify Splice' checks an earlier "\
+          "splice against the checksums recorded when it was written.\n\n"\
+          "Run 'splice /watch <folder>' to keep a folder's splice up to date as new takes arrive, "\
+          "or 'splice /serve' to run jobs sent with 'splice /submit <job> <folder>' from scripts.\n\n"\
           "To get started, click 'Folder | Select' on the menu above.",
         -1, &rect,
         DT_EDITCONTROL | DT_WORDBREAK,
@@ -0,0 +1,335 @@
+/* split.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Splitting a long capture into tracks at its silences, the other way
+ * round from splice(). The capture is read once. Each block of 64 frames
+ * is judged loud or quiet against the threshold, as for the envelope. A
+ * track starts with the first run of `duration` above the threshold and
+ * ends with the last such run before a quiet stretch of at least `gap`, so
+ * each track comes out as trim_silence() would leave it.
+ *
+ * The tracks are written by a pool of OpenMP tasks while the reader gets
+ * on with the rest of the capture. The chunks of one track depend on each
+ * other, so they are written in order, but different tracks are written at
+ * the same time. (The reader being inside that pool, a compressed capture
+ * is decoded on one thread; encoding the tracks is where its time goes.)
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+static int split_failed(split_t * split)
+{
+  int failed;
+
+  #pragma omp atomic read
+  failed = split->failed;
+  return failed;
+}
+
+static void write_chunk(split_t * split, split_segment_t * segment, split_chunk_t * chunk)
+{
+  if (segment->out == NULL && !segment->failed)
+  {
+    segment->out = sox_open_write(segment->path, &split->signal, &split->encoding,
+      split->filetype, NULL, NULL);
+    segment->failed = segment->out == NULL;
+  }
+  if (!segment->failed && sox_write(segment->out, chunk->samples, chunk->count) != chunk->count)
+  {
+    segment->failed = 1;
+  }
+  free(chunk);
+  #pragma omp atomic
+  split->chunks_in_flight--;
+}
+
+static void close_segment(split_t * split, split_segment_t * segment)
+{
+  if (segment->out != NULL && sox_close(segment->out) != SOX_SUCCESS)
+  {
+    segment->failed = 1;
+  }
+  if (segment->failed)
+  {
+    DeleteFileA(segment->path);
+    #pragma omp atomic write
+    split->failed = 1;
+  }
+  free(segment);
+}
+
+static void submit_chunk(split_t * split)
+{
+  split_segment_t * segment = split->segment;
+  split_chunk_t * chunk = split->chunk;
+
+  split->chunk = NULL;
+  #pragma omp atomic
+  split->chunks_in_flight++;
+  #pragma omp task firstprivate(segment, chunk) depend(inout: segment[0:1])
+  write_chunk(split, segment, chunk);
+}
+
+/* Append samples to the track being read. */
+static void commit(split_t * split, sox_sample_t const * samples, size_t count)
+{
+  while (count > 0)
+  {
+    size_t n;
+
+    if (split->chunk == NULL)
+    {
+      int in_flight;
+
+      #pragma omp atomic read
+      in_flight = split->chunks_in_flight;
+      if (in_flight >= SPLIT_MAX_CHUNKS)
+      {
+        /* The writers are behind; let them catch up. */
+        #pragma omp taskwait
+      }
+      split->chunk = (split_chunk_t *)malloc(sizeof(split_chunk_t));
+      if (split->chunk == NULL)
+      {
+        #pragma omp atomic write
+        split->failed = 1;
+        return;
+      }
+      split->chunk->count = 0;
+    }
+    n = min(count, SPLIT_CHUNK_SAMPLES - split->chunk->count);
+    memcpy(split->chunk->samples + split->chunk->count, samples, n * sizeof(sox_sample_t));
+    split->chunk->count += n;
+    samples += n;
+    count -= n;
+    if (split->chunk->count == SPLIT_CHUNK_SAMPLES)
+    {
+      submit_chunk(split);
+    }
+  }
+}
+
+static void commit_pending(split_t * split)
+{
+  commit(split, split->pending, split->pending_count);
+  split->pending_count = 0;
+}
+
+static int open_segment(split_t * split)
+{
+  split_segment_t * segment = (split_segment_t *)calloc(1, sizeof(split_segment_t));
+
+  if (segment == NULL
+      || FAILED(StringCbPrintfA(segment->path, sizeof(segment->path), "%s\\%0*u-%s",
+           split->directory, DEFAULT_TRACK_NUMER_WIDTH, split->segment_count + 1,
+           split->base_name)))
+  {
+    free(segment);
+    return SOX_EOF;
+  }
+  split->segment = segment;
+  split->segment_count++;
+  return SOX_SUCCESS;
+}
+
+/* Hand the rest of the track to the writers, and have them close it. */
+static void finish_segment(split_t * split)
+{
+  split_segment_t * segment = split->segment;
+
+  if (split->chunk != NULL)
+  {
+    submit_chunk(split);
+  }
+  split->segment = NULL;
+  #pragma omp task firstprivate(segment) depend(inout: segment[0:1])
+  close_segment(split, segment);
+}
+
+static void add_pending(split_t * split, sox_sample_t const * samples, size_t count)
+{
+  /* Only the last track can run out of room (it has no gap to end it);
+   * the quiet part of it we are holding back is kept after all. */
+  if (split->pending_count + count > split->pending_capacity)
+  {
+    commit_pending(split);
+  }
+  memcpy(split->pending + split->pending_count, samples, count * sizeof(sox_sample_t));
+  split->pending_count += count;
+}
+
+static void split_block(split_t * split, sox_sample_t const * block, size_t count)
+{
+  unsigned peak = 0;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+  {
+    sox_sample_t sample = block[i];
+    unsigned level = (unsigned)(sample < 0 ? -(sample >> 16) : sample >> 16);
+    if (level > peak) peak = level;
+  }
+  if (peak > split->level)
+  {
+    split->run++;
+    split->run_samples += count;
+  } else {
+    split->run = 0;
+    split->run_samples = 0;
+  }
+  if (split->segment == NULL)
+  {
+    /* Between tracks, only a run of sound in progress is worth keeping. */
+    if (split->run == 0)
+    {
+      split->pending_count = 0;
+      return;
+    }
+    add_pending(split, block, count);
+    if (split->run >= split->needed)
+    {
+      if (open_segment(split) != SOX_SUCCESS)
+      {
+        #pragma omp atomic write
+        split->failed = 1;
+        return;
+      }
+      commit_pending(split);
+    }
+    return;
+  }
+  add_pending(split, block, count);
+  if (split->run >= split->needed)
+  {
+    /* Still the same track: the pause behind us was part of it. */
+    commit_pending(split);
+  }
+  else if (split->segment_count < split->max_segments
+      && split->pending_count - split->run_samples >= split->gap_samples)
+  {
+    /* A gap: the track ended with the last run of sound. Any sound since
+     * may be the start of the next. */
+    finish_segment(split);
+    memmove(split->pending, split->pending + split->pending_count - split->run_samples,
+      split->run_samples * sizeof(sox_sample_t));
+    split->pending_count = split->run_samples;
+  }
+}
+
+/* Read the capture, a whole number of blocks at a time, and split it. */
+static void split_stream(split_t * split, decoder_t * input, sox_sample_t * buffer,
+  size_t buffer_samples, size_t block_samples)
+{
+  size_t fill, number_read, i;
+
+  do {
+    fill = 0;
+    while (fill < buffer_samples
+        && (number_read = decoder_read(input, buffer + fill, buffer_samples - fill)))
+    {
+      fill += number_read;
+    }
+    for (i = 0; i < fill && !split_failed(split); i += block_samples)
+    {
+      split_block(split, buffer + i, min(block_samples, fill - i));
+    }
+  } while (fill == buffer_samples && !split_failed(split));
+  if (split->segment != NULL)
+  {
+    finish_segment(split);
+  }
+}
+
+/* The folder for a capture's tracks: concert.wav's go in concert-tracks. */
+static int track_folder(char const * filename, char * directory, size_t directory_size)
+{
+  char const * extension = strrchr(job_base_name(filename), '.');
+  size_t length = extension == NULL ? strlen(filename) : (size_t)(extension - filename);
+
+  if (length + sizeof(SPLIT_FOLDER_SUFFIX) > directory_size)
+  {
+    return SOX_EOF;
+  }
+  memcpy(directory, filename, length);
+  memcpy(directory + length, SPLIT_FOLDER_SUFFIX, sizeof(SPLIT_FOLDER_SUFFIX));
+  return SOX_SUCCESS;
+}
+
+/*
+ * Split a capture into tracks at its silences
+ *
+ * The tracks go in a folder next to it (see track_folder()), as
+ * 01-concert.wav, 02-concert.wav and so on, numbered so that a splice of that
+ * folder puts them back in order. A capture with more gaps than there are
+ * track numbers keeps the rest in its last track.
+ */
+int split_file(job_t * job, char const * filename, char const * gap, char const * duration,
+  char const * threshold, unsigned * track_count)
+{
+  split_t split;
+  decoder_t * input;
+  double threshold_value;
+  uint64_t min_frames, gap_frames;
+  size_t block_samples, buffer_samples;
+  sox_sample_t * buffer;
+  unsigned i;
+
+  *track_count = 0;
+  memset(&split, 0, sizeof(split));
+  input = decoder_open(filename, &job->memory);
+  if (input == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (parse_threshold(threshold, &threshold_value) != SOX_SUCCESS
+      || parse_duration(duration, input->format->signal.rate, &min_frames) != SOX_SUCCESS
+      || parse_duration(gap, input->format->signal.rate, &gap_frames) != SOX_SUCCESS
+      || track_folder(filename, split.directory, sizeof(split.directory)) != SOX_SUCCESS
+      || (!CreateDirectoryA(split.directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS))
+  {
+    decoder_close(input);
+    return SOX_EOF;
+  }
+  split.signal = input->format->signal;
+  split.signal.length = 0;
+  split.encoding = input->format->encoding;
+  split.filetype = input->format->filetype;
+  split.base_name = job_base_name(filename);
+  split.level = threshold_value * 32768;
+  split.needed = (unsigned)max((min_frames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES, 1);
+  block_samples = ENVELOPE_BLOCK_FRAMES * split.signal.channels;
+  split.gap_samples = (size_t)((gap_frames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES)
+    * block_samples;
+  split.pending_capacity = split.gap_samples + (split.needed + 1) * block_samples;
+  for (split.max_segments = 1, i = 0; i < DEFAULT_TRACK_NUMER_WIDTH; ++i)
+  {
+    split.max_segments *= 10;
+  }
+  split.max_segments--;
+  buffer_samples = SPLIT_READ_BLOCKS * block_samples;
+  split.pending = (sox_sample_t *)malloc(split.pending_capacity * sizeof(sox_sample_t));
+  buffer = (sox_sample_t *)malloc(buffer_samples * sizeof(sox_sample_t));
+  if (split.pending == NULL || buffer == NULL)
+  {
+    split.failed = 1;
+  } else {
+    #pragma omp parallel
+    #pragma omp single
+    split_stream(&split, input, buffer, buffer_samples, block_samples);
+  }
+  if (input->failed)
+  {
+    split.failed = 1;
+  }
+  job->stats.files++;
+  decoder_close(input);
+  free(buffer);
+  free(split.pending);
+  *track_count = split.segment_count;
+  return split.failed ? SOX_EOF : SOX_SUCCESS;
+}
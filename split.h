@@ -0,0 +1,57 @@
+/* split.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the splitter, which cuts a long
+ * capture into tracks at its silences.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+#include "job.h"
+
+#define SPLIT_CHUNK_SAMPLES ((size_t)256 * 1024) /* Handed to a writer at a time */
+#define SPLIT_MAX_CHUNKS 64                      /* In flight before the reader waits */
+#define SPLIT_READ_BLOCKS 64                     /* Envelope blocks read at a time */
+#define SPLIT_FOLDER_SUFFIX "-tracks"
+
+/* A track being written. Its chunks are written in order, by whichever
+ * writer is free, and it is closed after the last. */
+typedef struct {
+  sox_format_t * out;
+  char path[MAX_PATH];
+  int failed;
+} split_segment_t;
+
+typedef struct {
+  size_t count;
+  sox_sample_t samples[SPLIT_CHUNK_SAMPLES];
+} split_chunk_t;
+
+/* The reader's state: which blocks are sound, and the ones it cannot yet
+ * place (the start of a run of sound, or a pause that may become a gap). */
+typedef struct {
+  sox_signalinfo_t signal;                 /* What the tracks are written as */
+  sox_encodinginfo_t encoding;
+  char const * filetype;
+  char directory[MAX_PATH];                /* Where they go... */
+  char const * base_name;                  /* ...and what they are called */
+  double level;                            /* Threshold, as a 16-bit level */
+  unsigned needed;                         /* Blocks of sound that make a run */
+  size_t gap_samples;                      /* Quiet between runs that ends a track */
+  unsigned run;                            /* Loud blocks in a row so far... */
+  size_t run_samples;                      /* ...and their samples */
+  sox_sample_t * pending;
+  size_t pending_count, pending_capacity;
+  split_segment_t * segment;               /* The track being read, or NULL */
+  split_chunk_t * chunk;                   /* ...and its next chunk */
+  unsigned segment_count, max_segments;
+  int chunks_in_flight;
+  int failed;
+} split_t;
+
+int split_file(job_t * job, char const * filename, char const * gap, char const * duration,
+  char const * threshold, unsigned * track_count);
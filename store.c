@@ -0,0 +1,430 @@
+/* store.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The result store (splice-store, in the temporary folder). Stems are
+ * shared between albums, so the same file gets the same trim in folder
+ * after folder. Each trim's result is kept here under a key made from the
+ * input's samples and the operation done to them, and the next time that
+ * key comes up the result is cloned (or copied) into place instead of
+ * being worked out again. It is never linked: a folder's copy is its own,
+ * to edit without changing any other folder's (or the store's).
+ *
+ * The index lists the results with the size and time of each, and when
+ * each was last used. Past STORE_MAX_BYTES, the least recently used go.
+ * Every job (and process) goes through a named mutex to read or change it.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+#define STORE_LINE_LENGTH 200
+
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE /* Older headers don't know block cloning. */
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#endif
+#ifndef FILE_SUPPORTS_BLOCK_REFCOUNTING
+#define FILE_SUPPORTS_BLOCK_REFCOUNTING 0x08000000
+#endif
+
+/* DUPLICATE_EXTENTS_DATA, which the same headers may not have. */
+typedef struct {
+  HANDLE source;
+  LARGE_INTEGER source_offset;
+  LARGE_INTEGER target_offset;
+  LARGE_INTEGER byte_count;
+} duplicate_extents_t;
+
+uint64_t store_key(uint64_t fingerprint, char const * operation)
+{
+  return fingerprint_bytes(fingerprint, operation, strlen(operation));
+}
+
+static void entry_path(store_index_t const * index, store_entry_t const * entry,
+  char * path, size_t path_size)
+{
+  StringCbPrintfA(path, path_size, "%s\\%016" PRIx64 "%s", index->directory, entry->key,
+    entry->extension);
+}
+
+static HANDLE store_lock(void)
+{
+  HANDLE mutex = CreateMutexW(NULL, FALSE, STORE_MUTEX_NAME);
+  DWORD wait;
+
+  if (mutex == NULL)
+  {
+    return NULL;
+  }
+  wait = WaitForSingleObject(mutex, INFINITE);
+  if (wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED)
+  {
+    CloseHandle(mutex);
+    return NULL;
+  }
+  return mutex;
+}
+
+static void store_unlock(HANDLE mutex)
+{
+  ReleaseMutex(mutex);
+  CloseHandle(mutex);
+}
+
+/* Read the index (an empty one if there is none yet). */
+static int index_read(store_index_t * index)
+{
+  char path[MAX_PATH], line[STORE_LINE_LENGTH];
+  FILE * file;
+  int version = 0;
+
+  memset(index, 0, sizeof(*index));
+  if (GetTempPathA(sizeof(index->directory), index->directory) == 0
+      || FAILED(StringCbCatA(index->directory, sizeof(index->directory), STORE_FOLDER))
+      || (!CreateDirectoryA(index->directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS))
+  {
+    return SOX_EOF;
+  }
+  StringCbPrintfA(path, sizeof(path), "%s\\%s", index->directory, STORE_INDEX_FILENAME);
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    return SOX_SUCCESS;
+  }
+  if (fgets(line, sizeof(line), file) == NULL
+      || sscanf(line, "splice-store %d", &version) != 1 || version != STORE_VERSION
+      || fgets(line, sizeof(line), file) == NULL
+      || sscanf(line, "clock %" SCNu64, &index->clock) != 1)
+  {
+    /* Not one we understand; start again. */
+    fclose(file);
+    return SOX_SUCCESS;
+  }
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    store_entry_t entry, * entries;
+
+    memset(&entry, 0, sizeof(entry));
+    if (sscanf(line, "entry %" SCNx64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNx64 " %15s",
+          &entry.key, &entry.file_size, &entry.file_time, &entry.last_used,
+          &entry.fingerprint, entry.extension) != 6)
+    {
+      continue;
+    }
+    entries = (store_entry_t *)realloc(index->entries,
+      (index->entry_count + 1) * sizeof(store_entry_t));
+    if (entries == NULL)
+    {
+      break;
+    }
+    index->entries = entries;
+    index->entries[index->entry_count++] = entry;
+  }
+  fclose(file);
+  return SOX_SUCCESS;
+}
+
+/* Replace the index, by way of a temporary file as the journal does. */
+static int index_write(store_index_t const * index)
+{
+  char path[MAX_PATH], temp_path[MAX_PATH];
+  FILE * file;
+  size_t i;
+  int result = SOX_SUCCESS;
+
+  StringCbPrintfA(path, sizeof(path), "%s\\%s", index->directory, STORE_INDEX_FILENAME);
+  StringCbPrintfA(temp_path, sizeof(temp_path), "%s.tmp", path);
+  file = fopen(temp_path, "w");
+  if (file == NULL)
+  {
+    return SOX_EOF;
+  }
+  fprintf(file, "splice-store %d\n", STORE_VERSION);
+  fprintf(file, "clock %" PRIu64 "\n", index->clock);
+  for (i = 0; i < index->entry_count; ++i)
+  {
+    store_entry_t const * entry = &index->entries[i];
+    fprintf(file, "entry %016" PRIx64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %016" PRIx64 " %s\n",
+      entry->key, entry->file_size, entry->file_time, entry->last_used,
+      entry->fingerprint, entry->extension);
+  }
+  if (ferror(file))
+  {
+    result = SOX_EOF;
+  }
+  if (fclose(file) != 0 || result != SOX_SUCCESS
+      || !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+  {
+    DeleteFileA(temp_path);
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+static store_entry_t * index_find(store_index_t * index, uint64_t key)
+{
+  size_t i;
+
+  for (i = 0; i < index->entry_count; ++i)
+  {
+    if (index->entries[i].key == key)
+    {
+      return &index->entries[i];
+    }
+  }
+  return NULL;
+}
+
+/* Drop an entry, and its file (other links to it are left alone). */
+static void index_remove(store_index_t * index, store_entry_t * entry)
+{
+  char path[MAX_PATH];
+
+  entry_path(index, entry, path, sizeof(path));
+  DeleteFileA(path);
+  *entry = index->entries[--index->entry_count];
+}
+
+/* Make room, least recently used first. */
+static void index_trim(store_index_t * index)
+{
+  uint64_t total = 0;
+  size_t i;
+
+  for (i = 0; i < index->entry_count; ++i)
+  {
+    total += index->entries[i].file_size;
+  }
+  while (total > STORE_MAX_BYTES && index->entry_count > 0)
+  {
+    store_entry_t * oldest = &index->entries[0];
+
+    for (i = 1; i < index->entry_count; ++i)
+    {
+      if (index->entries[i].last_used < oldest->last_used)
+      {
+        oldest = &index->entries[i];
+      }
+    }
+    total -= oldest->file_size;
+    index_remove(index, oldest);
+  }
+}
+
+/* The cluster size of the volume that both from and to are on, if it can
+ * clone blocks; 0 if it can't (or they are on different volumes). */
+static uint64_t clone_cluster(char const * from, char const * to)
+{
+  char from_root[MAX_PATH], to_root[MAX_PATH];
+  DWORD flags, sectors_per_cluster, bytes_per_sector, free_clusters, total_clusters;
+
+  if (!GetVolumePathNameA(from, from_root, sizeof(from_root))
+      || !GetVolumePathNameA(to, to_root, sizeof(to_root))
+      || _stricmp(from_root, to_root) != 0
+      || !GetVolumeInformationA(to_root, NULL, 0, NULL, NULL, &flags, NULL, 0)
+      || !(flags & FILE_SUPPORTS_BLOCK_REFCOUNTING)
+      || !GetDiskFreeSpaceA(to_root, &sectors_per_cluster, &bytes_per_sector, &free_clusters,
+           &total_clusters))
+  {
+    return 0;
+  }
+  return (uint64_t)sectors_per_cluster * bytes_per_sector;
+}
+
+/* A new file at to that shares from's blocks until either is written (so
+ * no data is copied), and that keeps from's time, as CopyFileA would. */
+static int clone_file(char const * from, char const * to)
+{
+  uint64_t cluster = clone_cluster(from, to), size, offset;
+  BY_HANDLE_FILE_INFORMATION info;
+  duplicate_extents_t extents;
+  LARGE_INTEGER end;
+  HANDLE source, target;
+  DWORD returned;
+  int result = SOX_SUCCESS;
+
+  if (cluster == 0)
+  {
+    return SOX_EOF;
+  }
+  source = CreateFileA(from, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+  if (source == INVALID_HANDLE_VALUE)
+  {
+    return SOX_EOF;
+  }
+  target = CreateFileA(to, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+  if (target == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(source, &info))
+  {
+    if (target != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(target);
+      DeleteFileA(to);
+    }
+    CloseHandle(source);
+    return SOX_EOF;
+  }
+  size = (uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+  /* Clones are of whole clusters, so the file takes its length first, and
+   * that cuts the last cluster short. A sparse file clones only to one. */
+  end.QuadPart = (LONGLONG)size;
+  if (((info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE)
+        && !DeviceIoControl(target, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL))
+      || !SetFilePointerEx(target, end, NULL, FILE_BEGIN)
+      || !SetEndOfFile(target))
+  {
+    result = SOX_EOF;
+  }
+  for (offset = 0; offset < size && result == SOX_SUCCESS; offset += STORE_CLONE_CHUNK)
+  {
+    extents.source = source;
+    extents.source_offset.QuadPart = (LONGLONG)offset;
+    extents.target_offset.QuadPart = (LONGLONG)offset;
+    extents.byte_count.QuadPart =
+      (LONGLONG)((min(size - offset, STORE_CLONE_CHUNK) + cluster - 1) / cluster * cluster);
+    if (!DeviceIoControl(target, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents),
+          NULL, 0, &returned, NULL))
+    {
+      result = SOX_EOF;
+    }
+  }
+  if (result == SOX_SUCCESS && !SetFileTime(target, NULL, NULL, &info.ftLastWriteTime))
+  {
+    result = SOX_EOF;
+  }
+  CloseHandle(target);
+  CloseHandle(source);
+  if (result != SOX_SUCCESS)
+  {
+    DeleteFileA(to);
+  }
+  return result;
+}
+
+/* A copy of from at to: a clone where the volume makes them, and where it
+ * doesn't, every byte written again (see store.h). */
+static int copy_file(char const * from, char const * to)
+{
+  if (clone_file(from, to) == SOX_SUCCESS)
+  {
+    return SOX_SUCCESS;
+  }
+  return CopyFileA(from, to, FALSE) ? SOX_SUCCESS : SOX_EOF;
+}
+
+/* A copy of from, at to, without writing through any link that `to` may
+ * already be. */
+static int place_file(char const * from, char const * to)
+{
+  char temp_path[MAX_PATH];
+
+  if (FAILED(StringCbPrintfA(temp_path, sizeof(temp_path), "%s.store.tmp", to)))
+  {
+    return SOX_EOF;
+  }
+  DeleteFileA(temp_path);
+  if (copy_file(from, temp_path) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  if (!MoveFileExA(temp_path, to, MOVEFILE_REPLACE_EXISTING))
+  {
+    DeleteFileA(temp_path);
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/*
+ * Replace the file at path with the stored result for key
+ *
+ * Returns SOX_EOF, leaving the file alone, if there is no such result (or
+ * it has been changed since it was stored). fingerprint is the hash of the
+ * result's samples.
+ */
+int store_fetch(uint64_t key, char const * path, uint64_t * fingerprint)
+{
+  store_index_t index;
+  store_entry_t * entry;
+  char stored_path[MAX_PATH];
+  uint64_t file_size, file_time;
+  HANDLE mutex = store_lock();
+  int result = SOX_EOF;
+
+  if (mutex == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (index_read(&index) == SOX_SUCCESS && (entry = index_find(&index, key)) != NULL)
+  {
+    entry_path(&index, entry, stored_path, sizeof(stored_path));
+    if (manifest_stat(stored_path, &file_size, &file_time) != SOX_SUCCESS
+        || file_size != entry->file_size || file_time != entry->file_time)
+    {
+      index_remove(&index, entry);
+    }
+    else if (place_file(stored_path, path) == SOX_SUCCESS)
+    {
+      entry->last_used = ++index.clock;
+      *fingerprint = entry->fingerprint;
+      result = SOX_SUCCESS;
+    }
+    index_write(&index);
+  }
+  free(index.entries);
+  store_unlock(mutex);
+  return result;
+}
+
+/* Keep the file at path as the result for key. */
+int store_keep(uint64_t key, char const * path, uint64_t fingerprint)
+{
+  store_index_t index;
+  store_entry_t entry;
+  char stored_path[MAX_PATH];
+  char const * extension = strrchr(job_base_name(path), '.');
+  store_entry_t * entries;
+  HANDLE mutex;
+  int result = SOX_EOF;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.key = key;
+  entry.fingerprint = fingerprint;
+  if (extension == NULL
+      || FAILED(StringCbCopyA(entry.extension, sizeof(entry.extension), extension)))
+  {
+    return SOX_EOF;
+  }
+  mutex = store_lock();
+  if (mutex == NULL)
+  {
+    return SOX_EOF;
+  }
+  if (index_read(&index) == SOX_SUCCESS && index_find(&index, key) == NULL)
+  {
+    entry_path(&index, &entry, stored_path, sizeof(stored_path));
+    DeleteFileA(stored_path); /* Left over from a lost index */
+    entries = (store_entry_t *)realloc(index.entries,
+      (index.entry_count + 1) * sizeof(store_entry_t));
+    if (entries != NULL)
+    {
+      index.entries = entries;
+    }
+    if (entries != NULL
+        && copy_file(path, stored_path) == SOX_SUCCESS
+        && manifest_stat(stored_path, &entry.file_size, &entry.file_time) == SOX_SUCCESS)
+    {
+      entry.last_used = ++index.clock;
+      index.entries[index.entry_count++] = entry;
+      index_trim(&index);
+      result = index_write(&index);
+    }
+  }
+  free(index.entries);
+  store_unlock(mutex);
+  return result;
+}
@@ -0,0 +1,47 @@
+/* store.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the result store, which keeps
+ * the results of trims so that the same trim of the same audio, in this
+ * folder or any other, does not have to be done again.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+
+/* Results go into place (and into the store) as block clones where the
+ * volume can make them: ReFS, with the folder on the same volume as the
+ * store. A clone writes no data and is a file of its own. Anywhere else,
+ * including NTFS, each is copied in full, so a hit still writes the whole
+ * file (and so does keeping a result), though no trim is done again. */
+#define STORE_FOLDER "splice-store"           /* In the temporary folder */
+#define STORE_INDEX_FILENAME "index"
+#define STORE_VERSION 1
+#define STORE_MAX_BYTES ((uint64_t)4 << 30)   /* Least recently used results go beyond this */
+#define STORE_CLONE_CHUNK ((uint64_t)1 << 30) /* ReFS clones less than 4 GB a call */
+#define STORE_MUTEX_NAME L"splice-store"      /* Shared by every job and process */
+#define STORE_EXTENSION_LENGTH 16
+
+/* One stored result, named after its key. The size and time tell us if
+ * it has been changed since it was stored. */
+typedef struct {
+  uint64_t key;
+  uint64_t file_size, file_time;
+  uint64_t last_used;       /* The index's clock, when it was last stored or fetched */
+  uint64_t fingerprint;     /* Hash of the result's samples */
+  char extension[STORE_EXTENSION_LENGTH];
+} store_entry_t;
+
+typedef struct {
+  char directory[MAX_PATH];
+  uint64_t clock;
+  size_t entry_count;
+  store_entry_t * entries;
+} store_index_t;
+
+uint64_t store_key(uint64_t fingerprint, char const * operation);
+int store_fetch(uint64_t key, char const * path, uint64_t * fingerprint);
+int store_keep(uint64_t key, char const * path, uint64_t fingerprint);
@@ -0,0 +1,266 @@
+/* trim-chain.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * The effects chain for trimming silence when the envelope can't be used:
+ * input, reverse, silence, reverse, silence, output. Building it means
+ * looking up five effect handlers and parsing the silence options each
+ * time, which for a folder of short clips costs more than the trimming.
+ * So the handlers are looked up once, and each job keeps its chain: for
+ * the next file with the same signal and options, only the input and
+ * output effects are pointed at the new handles, and the other effects
+ * are stopped and started again around each run.
+ *
+ * The reverse is our own rather than libSoX's, which keeps the audio in
+ * libSoX.tmp* files in the temp folder (shared by every job, and left
+ * behind for cleanup() to sweep up). Ours keeps it in a scratch_t: in
+ * memory, up to a budget, and past that in the job's own scratch folder.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+static sox_effect_handler_t const * input_handler, * silence_handler, * output_handler;
+
+typedef struct {
+  char const * scratch_directory;
+  budget_account_t * account;
+  scratch_t scratch;                /* Everything it has been given... */
+  uint64_t position;                /* ...and how much of it (in samples) is yet to go back */
+  int draining;
+} reverse_t;
+
+/* The reverse is given the job's scratch folder and its share of the
+ * memory budget as the input effect is given its file. */
+static int reverse_getopts(sox_effect_t * effp, int argc, char * argv[])
+{
+  if (argc != 3)
+  {
+    return SOX_EOF;
+  }
+  ((reverse_t *)effp->priv)->scratch_directory = argv[1];
+  ((reverse_t *)effp->priv)->account = (budget_account_t *)argv[2];
+  return SOX_SUCCESS;
+}
+
+static int reverse_start(sox_effect_t * effp)
+{
+  reverse_t * reverse = (reverse_t *)effp->priv;
+
+  scratch_init(&reverse->scratch, reverse->scratch_directory, SCRATCH_MEMORY_BUDGET,
+    reverse->account);
+  reverse->position = 0;
+  reverse->draining = 0;
+  return SOX_SUCCESS;
+}
+
+static int reverse_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * obuf,
+  size_t * isamp, size_t * osamp)
+{
+  *osamp = 0;
+  return scratch_write(&((reverse_t *)effp->priv)->scratch, ibuf,
+    *isamp * sizeof(sox_sample_t));
+}
+
+/* Hand it all back from the end, a frame at a time. */
+static int reverse_drain(sox_effect_t * effp, sox_sample_t * obuf, size_t * osamp)
+{
+  reverse_t * reverse = (reverse_t *)effp->priv;
+  unsigned channels = effp->out_signal.channels;
+  size_t frames, i, j;
+  unsigned c;
+
+  if (!reverse->draining)
+  {
+    reverse->draining = 1;
+    reverse->position = reverse->scratch.size / sizeof(sox_sample_t);
+    reverse->position -= reverse->position % channels;
+  }
+  frames = (size_t)min(*osamp / channels, reverse->position / channels);
+  *osamp = frames * channels;
+  reverse->position -= *osamp;
+  if (scratch_read_at(&reverse->scratch, reverse->position * sizeof(sox_sample_t), obuf,
+        *osamp * sizeof(sox_sample_t)) != SOX_SUCCESS)
+  {
+    *osamp = 0;
+    return SOX_EOF;
+  }
+  for (i = 0, j = frames; i + 1 < j; ++i, --j)
+  {
+    for (c = 0; c < channels; ++c)
+    {
+      sox_sample_t sample = obuf[i * channels + c];
+      obuf[i * channels + c] = obuf[(j - 1) * channels + c];
+      obuf[(j - 1) * channels + c] = sample;
+    }
+  }
+  return reverse->position > 0 ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int reverse_stop(sox_effect_t * effp)
+{
+  scratch_free(&((reverse_t *)effp->priv)->scratch);
+  return SOX_SUCCESS;
+}
+
+static sox_effect_handler_t const reverse_handler = {
+  "reverse", NULL, SOX_EFF_MCHAN | SOX_EFF_MODIFY, reverse_getopts, reverse_start,
+  reverse_flow, reverse_drain, reverse_stop, NULL, sizeof(reverse_t)
+};
+
+/* Looking the same handler up twice (in two jobs at once) does no harm. */
+static sox_effect_handler_t const * find_handler(sox_effect_handler_t const ** handler,
+  char const * name)
+{
+  if (*handler == NULL)
+  {
+    *handler = sox_find_effect(name);
+  }
+  return *handler;
+}
+
+static int add_effect(sox_effects_chain_t * chain, sox_effect_handler_t const * handler,
+  int argc, char * argv[], sox_signalinfo_t * signal)
+{
+  sox_effect_t * e = sox_create_effect(handler);
+  int result;
+
+  if (e == NULL)
+  {
+    return SOX_EOF;
+  }
+  result = argc == 0 ? SOX_SUCCESS : sox_effect_options(e, argc, argv);
+  if (result == SOX_SUCCESS)
+  {
+    result = sox_add_effect(chain, e, signal, signal);
+  }
+  free(e);
+  return result;
+}
+
+trim_chain_t * trim_chain_create(sox_format_t * in, sox_format_t * out, char const * duration,
+  char const * threshold, char const * scratch_directory, budget_account_t * account)
+{
+  trim_chain_t * trim;
+  sox_signalinfo_t signal = in->signal;
+  char * args[3], * reverse_args[2];
+  int result;
+
+  if (find_handler(&input_handler, "input") == NULL
+      || find_handler(&silence_handler, "silence") == NULL
+      || find_handler(&output_handler, "output") == NULL)
+  {
+    return NULL;
+  }
+  trim = (trim_chain_t *)calloc(1, sizeof(trim_chain_t));
+  if (trim == NULL)
+  {
+    return NULL;
+  }
+  trim->signal = in->signal;
+  if (FAILED(StringCbCopyA(trim->duration, sizeof(trim->duration), duration))
+      || FAILED(StringCbCopyA(trim->threshold, sizeof(trim->threshold), threshold))
+      || (trim->chain = sox_create_effects_chain(&in->encoding, &out->encoding)) == NULL)
+  {
+    free(trim);
+    return NULL;
+  }
+  args[0] = (char *)in;
+  result = add_effect(trim->chain, input_handler, 1, args, &signal);
+  /* Trim the end (the start of the reversed audio), then the start. */
+  reverse_args[0] = (char *)scratch_directory;
+  reverse_args[1] = (char *)account;
+  args[0] = "1";
+  args[1] = trim->duration;
+  args[2] = trim->threshold;
+  if (result == SOX_SUCCESS)
+  {
+    result = add_effect(trim->chain, &reverse_handler, 2, reverse_args, &signal);
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = add_effect(trim->chain, silence_handler, 3, args, &signal);
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = add_effect(trim->chain, &reverse_handler, 2, reverse_args, &signal);
+  }
+  if (result == SOX_SUCCESS)
+  {
+    result = add_effect(trim->chain, silence_handler, 3, args, &signal);
+  }
+  args[0] = (char *)out;
+  if (result == SOX_SUCCESS)
+  {
+    result = add_effect(trim->chain, output_handler, 1, args, &signal);
+  }
+  if (result != SOX_SUCCESS)
+  {
+    trim_chain_free(trim);
+    return NULL;
+  }
+  return trim;
+}
+
+/* Can the chain trim this file as it stands? */
+int trim_chain_fits(trim_chain_t const * trim, sox_format_t const * in, char const * duration,
+  char const * threshold)
+{
+  return trim->signal.rate == in->signal.rate
+    && trim->signal.channels == in->signal.channels
+    && trim->signal.precision == in->signal.precision
+    && strcmp(trim->duration, duration) == 0
+    && strcmp(trim->threshold, threshold) == 0;
+}
+
+/* Trim from in to out, then restart the effects ready for the next file
+ * (so the chain is always left started, as sox_delete_effects_chain()
+ * expects). */
+int trim_chain_run(trim_chain_t * trim, sox_format_t * in, sox_format_t * out)
+{
+  sox_effects_chain_t * chain = trim->chain;
+  char * args[1];
+  size_t i, flow;
+  int result;
+
+  args[0] = (char *)in;
+  if (sox_effect_options(chain->effects[0], 1, args) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  args[0] = (char *)out;
+  if (sox_effect_options(chain->effects[chain->length - 1], 1, args) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  chain->in_enc = &in->encoding;
+  chain->out_enc = &out->encoding;
+  result = sox_flow_effects(chain, NULL, NULL);
+  for (i = 0; i < chain->length; ++i)
+  {
+    sox_effect_t * effect = chain->effects[i];
+
+    for (flow = 0; flow < effect->flows; ++flow)
+    {
+      effect[flow].handler.stop(&effect[flow]);
+      effect[flow].handler.start(&effect[flow]);
+    }
+  }
+  return result;
+}
+
+void trim_chain_free(trim_chain_t * trim)
+{
+  if (trim == NULL)
+  {
+    return;
+  }
+  if (trim->chain != NULL)
+  {
+    sox_delete_effects_chain(trim->chain);
+  }
+  free(trim);
+}
@@ -0,0 +1,30 @@
+/* trim-chain.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for the reusable silence-trimming
+ * effects chain.
+ *
+ */
+#pragma once
+
+#include "sox.h"
+#include "budget.h"
+
+#define TRIM_OPTION_LENGTH 32
+
+/* A built reverse/silence/reverse/silence chain, kept started between
+ * files so that the next file only has to be bound to it. */
+typedef struct {
+  sox_effects_chain_t * chain;
+  sox_signalinfo_t signal;                /* The signal it was built for... */
+  char duration[TRIM_OPTION_LENGTH];      /* ...and the silence options */
+  char threshold[TRIM_OPTION_LENGTH];
+} trim_chain_t;
+
+trim_chain_t * trim_chain_create(sox_format_t * in, sox_format_t * out, char const * duration,
+  char const * threshold, char const * scratch_directory, budget_account_t * account);
+int trim_chain_fits(trim_chain_t const * trim, sox_format_t const * in, char const * duration,
+  char const * threshold);
+int trim_chain_run(trim_chain_t * trim, sox_format_t * in, sox_format_t * out);
+void trim_chain_free(trim_chain_t * trim);
@@ -0,0 +1,464 @@
+/* watch.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Watch mode ("splice /watch <folder>"). The recorders drop takes into a
+ * folder all day; instead of someone re-splicing by hand, Windows tells us
+ * about each file as it is written (ReadDirectoryChangesW). Once a file has
+ * held still for a few seconds and nobody has it open for writing, we trim
+ * it, write it into the existing splice (see splice_track()) and update the
+ * durations index. The rest of the folder is not looked at again.
+ *
+ */
+
+#include "wt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strsafe.h>
+
+static int stat_file(job_t * job, WCHAR const * name, uint64_t * file_size, uint64_t * file_time)
+{
+  WCHAR path[MAX_PATH];
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+  if (FAILED(StringCchPrintfW(path, MAX_PATH, L"%s\\%s", job->directory, name))
+      || !GetFileAttributesExW(path, GetFileExInfoStandard, &attributes))
+  {
+    return SOX_EOF;
+  }
+  *file_size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+  *file_time = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32)
+    | attributes.ftLastWriteTime.dwLowDateTime;
+  return SOX_SUCCESS;
+}
+
+/* Whether a name in the folder is an input, rather than our own output,
+ * its sidecars, or a temporary file. */
+static int is_input_name(WCHAR const * name)
+{
+  char filename[MAX_PATH * 3];
+
+  if (_wcsicmp(name, L"" DEFAULT_OUTPUT_FILENAME) == 0
+      || _wcsicmp(name, L"" FLAC_OUTPUT_FILENAME) == 0
+      || _wcsicmp(name, L"" CD_OUTPUT_FILENAME) == 0
+      || _wcsicmp(name, L"" PREVIEW_OUTPUT_FILENAME) == 0
+      || WideCharToMultiByte(CP_UTF8, 0, name, -1, filename, sizeof(filename), NULL, NULL) == 0)
+  {
+    return 0;
+  }
+  return decoder_accepts(filename);
+}
+
+static watch_file_t * find_file(watch_t * watch, WCHAR const * name)
+{
+  size_t i;
+
+  for (i = 0; i < watch->file_count; ++i)
+  {
+    if (_wcsicmp(watch->files[i].name, name) == 0)
+    {
+      return &watch->files[i];
+    }
+  }
+  return NULL;
+}
+
+static watch_file_t * add_file(watch_t * watch, WCHAR const * name)
+{
+  watch_file_t * file;
+
+  if (watch->file_count == watch->file_capacity)
+  {
+    size_t capacity = watch->file_capacity < 16 ? 32 : watch->file_capacity * 2;
+    watch_file_t * files = (watch_file_t *)realloc(watch->files, capacity * sizeof(watch_file_t));
+    if (files == NULL)
+    {
+      return NULL;
+    }
+    watch->files = files;
+    watch->file_capacity = capacity;
+  }
+  file = &watch->files[watch->file_count++];
+  memset(file, 0, sizeof(*file));
+  StringCchCopyW(file->name, MAX_PATH, name);
+  return file;
+}
+
+/* Mark everything in the job's list as spliced, as it is now. */
+static void remember_files(job_t * job, watch_t * watch)
+{
+  size_t i;
+
+  for (i = 0; i < watch->file_count; ++i)
+  {
+    watch->files[i].spliced = 0;
+  }
+  for (i = 0; i < job->file_count; ++i)
+  {
+    WCHAR name[MAX_PATH];
+    watch_file_t * file;
+
+    if (MultiByteToWideChar(CP_UTF8, 0, job_base_name(job->filenames[i]), -1,
+          name, MAX_PATH) == 0)
+    {
+      continue;
+    }
+    file = find_file(watch, name);
+    if (file == NULL)
+    {
+      file = add_file(watch, name);
+    }
+    if (file != NULL)
+    {
+      file->spliced = 1;
+      stat_file(job, name, &file->file_size, &file->file_time);
+    }
+  }
+}
+
+/* Splice whatever is in the folder now, as when we start, or after
+ * notifications were lost or a take was deleted. Files still settling
+ * are left out until they are ready. */
+static void rescan(job_t * job, watch_t * watch)
+{
+  size_t i, kept = 0;
+
+  watch->rescan = 0;
+  arena_release(&job->arena, watch->files_mark);
+  job->file_count = 0;
+  job->filenames[0] = NULL;
+  if (load_filenames(job) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return;
+  }
+  for (i = 0; i < job->file_count; ++i)
+  {
+    WCHAR name[MAX_PATH];
+    watch_file_t * file = NULL;
+
+    if (MultiByteToWideChar(CP_UTF8, 0, job_base_name(job->filenames[i]), -1,
+          name, MAX_PATH) != 0)
+    {
+      file = find_file(watch, name);
+    }
+    if (file == NULL || !file->pending)
+    {
+      job->filenames[kept++] = job->filenames[i];
+    }
+  }
+  job->file_count = kept;
+  job->filenames[kept] = NULL;
+  if (job->file_count > 0)
+  {
+    resplice(job);
+    watch_write_durations(job);
+  }
+  remember_files(job, watch);
+}
+
+/* Note a file that has been written to, unless what we see is what we
+ * spliced (our own trim, say). */
+static void note_file(job_t * job, watch_t * watch, watch_file_t * file)
+{
+  uint64_t file_size, file_time;
+
+  if (stat_file(job, file->name, &file_size, &file_time) != SOX_SUCCESS
+      || (!file->pending && file_size == file->file_size && file_time == file->file_time))
+  {
+    return;
+  }
+  if (!file->pending)
+  {
+    file->pending = 1;
+    watch->pending_count++;
+  }
+  file->file_size = file_size;
+  file->file_time = file_time;
+  file->settled_since = GetTickCount();
+}
+
+static void forget_file(watch_t * watch, watch_file_t * file)
+{
+  if (file->pending)
+  {
+    watch->pending_count--;
+  }
+  file->pending = 0;
+  file->spliced = 0;
+  file->file_size = 0;
+  file->file_time = 0;
+}
+
+static void note_changes(job_t * job, watch_t * watch, unsigned char const * buffer)
+{
+  FILE_NOTIFY_INFORMATION const * change;
+  size_t offset = 0;
+
+  do {
+    WCHAR name[MAX_PATH];
+    size_t length;
+    watch_file_t * file;
+
+    change = (FILE_NOTIFY_INFORMATION const *)(buffer + offset);
+    offset += change->NextEntryOffset;
+    length = change->FileNameLength / sizeof(WCHAR);
+    if (length >= MAX_PATH)
+    {
+      continue;
+    }
+    memcpy(name, change->FileName, length * sizeof(WCHAR));
+    name[length] = L'\0';
+    if (!is_input_name(name))
+    {
+      continue;
+    }
+    file = find_file(watch, name);
+    if (change->Action == FILE_ACTION_REMOVED || change->Action == FILE_ACTION_RENAMED_OLD_NAME)
+    {
+      if (file != NULL)
+      {
+        if (file->spliced)
+        {
+          watch->rescan = 1;
+        }
+        forget_file(watch, file);
+      }
+      continue;
+    }
+    if (file == NULL && (file = add_file(watch, name)) == NULL)
+    {
+      watch->rescan = 1;
+      continue;
+    }
+    note_file(job, watch, file);
+  } while (change->NextEntryOffset != 0);
+}
+
+/* Whether a file has stopped growing: the same size and time for
+ * WATCH_SETTLE_MS, and nobody still has it open for writing. */
+static int file_settled(job_t * job, watch_t * watch, watch_file_t * file)
+{
+  WCHAR path[MAX_PATH];
+  uint64_t file_size, file_time;
+  HANDLE handle;
+
+  if (stat_file(job, file->name, &file_size, &file_time) != SOX_SUCCESS)
+  {
+    forget_file(watch, file);
+    return 0;
+  }
+  if (file_size != file->file_size || file_time != file->file_time)
+  {
+    file->file_size = file_size;
+    file->file_time = file_time;
+    file->settled_since = GetTickCount();
+    return 0;
+  }
+  if (GetTickCount() - file->settled_since < WATCH_SETTLE_MS
+      || FAILED(StringCchPrintfW(path, MAX_PATH, L"%s\\%s", job->directory, file->name)))
+  {
+    return 0;
+  }
+  handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+  {
+    file->settled_since = GetTickCount();
+    return 0;
+  }
+  CloseHandle(handle);
+  return 1;
+}
+
+/* Trim a settled file and write it into the splice. */
+static void ingest(job_t * job, watch_t * watch, watch_file_t * file)
+{
+  WCHAR path[MAX_PATH];
+  arena_mark_t mark = arena_mark(&job->arena);
+  char * filename;
+  size_t index;
+  int added = 0;
+
+  file->pending = 0;
+  watch->pending_count--;
+  if (FAILED(StringCchPrintfW(path, MAX_PATH, L"%s\\%s", job->directory, file->name))
+      || (filename = job_path(job, file->name)) == NULL)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    return;
+  }
+  report_current_action(NULL, job_base_name(filename));
+  trim_silence(job, path, DEFAULT_NOISE_DURATION, DEFAULT_SILENCE_THRESHOLD);
+  for (index = 0; index < job->file_count; ++index)
+  {
+    if (_stricmp(job->filenames[index], filename) == 0)
+    {
+      break;
+    }
+  }
+  if (index < job->file_count)
+  {
+    arena_release(&job->arena, mark);
+  } else {
+    if (job_add_file(job, filename) != SOX_SUCCESS)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      arena_release(&job->arena, mark);
+      return;
+    }
+    qsort(job->filenames, job->file_count, sizeof(char *), compare_filenames);
+    for (index = 0; job->filenames[index] != filename; ++index)
+    {
+    }
+    added = 1;
+  }
+  splice_track(job, index, added);
+  /* Trimming rewrote the file, so what is there now is our own doing. */
+  file->spliced = 1;
+  stat_file(job, file->name, &file->file_size, &file->file_time);
+  if (watch_write_durations(job) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+  }
+}
+
+static int read_changes(HANDLE directory, DWORD * buffer, OVERLAPPED * overlapped)
+{
+  ResetEvent(overlapped->hEvent);
+  return ReadDirectoryChangesW(directory, buffer, WATCH_BUFFER_BYTES, FALSE,
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+    NULL, overlapped, NULL) ? SOX_SUCCESS : SOX_EOF;
+}
+
+/* Keep the job's folder spliced until something goes wrong with the
+ * watch itself (errors splicing a file are reported, and we carry on). */
+int watch_folder(job_t * job)
+{
+  watch_t watch;
+  OVERLAPPED overlapped;
+  HANDLE directory;
+  DWORD * buffer, bytes;    /* (ReadDirectoryChangesW() wants it DWORD-aligned) */
+  int reading = 0, result = SOX_SUCCESS;
+
+  memset(&watch, 0, sizeof(watch));
+  memset(&overlapped, 0, sizeof(overlapped));
+  buffer = (DWORD *)malloc(WATCH_BUFFER_BYTES);
+  directory = CreateFileW(job->directory, FILE_LIST_DIRECTORY,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  /* Start listening before the first look at the folder, so that nothing
+   * written in between is missed. */
+  if (buffer == NULL || directory == INVALID_HANDLE_VALUE || overlapped.hEvent == NULL
+      || read_changes(directory, buffer, &overlapped) != SOX_SUCCESS)
+  {
+    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+    result = SOX_EOF;
+  } else {
+    reading = 1;
+    watch.files_mark = arena_mark(&job->arena);
+    watch.rescan = 1;
+  }
+  while (result == SOX_SUCCESS)
+  {
+    size_t i;
+    DWORD wait;
+
+    if (watch.rescan)
+    {
+      rescan(job, &watch);
+    }
+    for (i = 0; i < watch.file_count; ++i)
+    {
+      if (watch.files[i].pending && file_settled(job, &watch, &watch.files[i]))
+      {
+        ingest(job, &watch, &watch.files[i]);
+      }
+    }
+    wait = WaitForSingleObject(overlapped.hEvent,
+      watch.pending_count > 0 ? WATCH_POLL_MS : INFINITE);
+    if (wait == WAIT_TIMEOUT)
+    {
+      continue;
+    }
+    reading = 0;
+    if (wait != WAIT_OBJECT_0 || !GetOverlappedResult(directory, &overlapped, &bytes, FALSE))
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      result = SOX_EOF;
+      break;
+    }
+    if (bytes == 0)
+    {
+      /* More happened than the buffer could describe. */
+      watch.rescan = 1;
+    } else {
+      note_changes(job, &watch, (unsigned char const *)buffer);
+    }
+    if (read_changes(directory, buffer, &overlapped) != SOX_SUCCESS)
+    {
+      report_error(NULL, ST_ERROR, __FILE__, __LINE__);
+      result = SOX_EOF;
+    }
+    reading = 1;
+  }
+  if (reading)
+  {
+    CancelIo(directory);
+    GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+  }
+  if (directory != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(directory);
+  }
+  if (overlapped.hEvent != NULL)
+  {
+    CloseHandle(overlapped.hEvent);
+  }
+  free(buffer);
+  free(watch.files);
+  return result;
+}
+
+/* Write the durations index (spliced-audio.wav.durations): the length of
+ * every track in the splice, and their total. It is worked out from the
+ * manifest, so keeping it current opens no audio. */
+int watch_write_durations(job_t * job)
+{
+  char path[MAX_PATH];
+  manifest_t manifest;
+  double seconds, total = 0;
+  FILE * file;
+  size_t i;
+  int result;
+
+  if (manifest_read(job->output_filename, &manifest) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  StringCbPrintfA(path, sizeof(path), "%s%s", job->output_filename, DURATIONS_SUFFIX);
+  file = fopen(path, "w");
+  if (file == NULL)
+  {
+    manifest_free(&manifest);
+    return SOX_EOF;
+  }
+  fprintf(file, "splice-durations %d\n", DURATIONS_VERSION);
+  for (i = 0; i < manifest.track_count; ++i)
+  {
+    seconds = (double)manifest.tracks[i].samples / max(manifest.channels, 1)
+      / max(manifest.rate, 1);
+    total += seconds;
+    fprintf(file, "track %.3f %s\n", seconds, manifest.tracks[i].filename);
+  }
+  fprintf(file, "total %.3f\n", total);
+  result = ferror(file) ? SOX_EOF : SOX_SUCCESS;
+  if (fclose(file) != 0)
+  {
+    result = SOX_EOF;
+  }
+  manifest_free(&manifest);
+  return result;
+}
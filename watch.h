@@ -0,0 +1,40 @@
+/* watch.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for watch mode, which keeps the
+ * splice of a folder up to date as new takes are dropped into it.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "job.h"
+
+#define WATCH_SETTLE_MS 3000              /* How long a file must hold still before we take it */
+#define WATCH_POLL_MS 500                 /* How often settling files are looked at */
+#define WATCH_BUFFER_BYTES 65536          /* Notifications; a burst bigger than this means a rescan */
+#define WATCH_LOG_FILENAME "splice-watch.log"
+#define DURATIONS_SUFFIX ".durations"
+#define DURATIONS_VERSION 1
+
+/* An audio file the watch has heard of. */
+typedef struct {
+  WCHAR name[MAX_PATH];                   /* In the job's folder */
+  uint64_t file_size, file_time;          /* As last seen... */
+  DWORD settled_since;                    /* ...and since when */
+  int pending;                            /* Waiting to settle before it is spliced */
+  int spliced;                            /* In the splice (and the job's list) */
+} watch_file_t;
+
+typedef struct {
+  watch_file_t * files;
+  size_t file_count, file_capacity;
+  size_t pending_count;
+  arena_mark_t files_mark;                /* Where the job's list of paths starts */
+  int rescan;                             /* Notifications were lost, or a file went away */
+} watch_t;
+
+int watch_folder(job_t * job);
+int watch_write_durations(job_t * job);
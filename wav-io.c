@@ -0,0 +1,504 @@
+/* wav-io.c
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Raw WAV file access supporting the Splice application. libSoX only
+ * knows how to stream a file from start to finish; these functions let
+ * us patch an existing output file in place instead.
+ *
+ */
+
+#include "wt.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t read_le32(unsigned char const * p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_le64(unsigned char const * p)
+{
+  return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static void write_le16(unsigned char * p, unsigned value)
+{
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+}
+
+static void write_le32(unsigned char * p, uint32_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+  p[3] = (value >> 24) & 0xff;
+}
+
+static void write_le64(unsigned char * p, uint64_t value)
+{
+  write_le32(p, (uint32_t)value);
+  write_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+/* Wave64 identifies chunks by GUID. The standard chunks' GUIDs are their
+ * four-character code followed by a common tail. */
+static unsigned char const w64_riff_guid[16] = {
+  'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00
+};
+static unsigned char const w64_guid_tail[12] = {
+  0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A
+};
+
+static int is_w64_chunk(unsigned char const * guid, char const * fourcc)
+{
+  return memcmp(guid, fourcc, 4) == 0 && memcmp(guid + 4, w64_guid_tail, 12) == 0;
+}
+
+static void write_w64_guid(unsigned char * p, char const * fourcc)
+{
+  memcpy(p, fourcc, 4);
+  memcpy(p + 4, w64_guid_tail, 12);
+}
+
+/* WAVE_FORMAT_EXTENSIBLE sub-format GUIDs, after the two-byte format tag. */
+static unsigned char const subformat_tail[14] = {
+  0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+static void parse_format(unsigned char const * format, size_t size, wav_layout_t * layout)
+{
+  unsigned tag = format[0] | (format[1] << 8);
+
+  layout->channels = format[2] | (format[3] << 8);
+  layout->rate = read_le32(format + 4);
+  layout->bits_per_sample = format[14] | (format[15] << 8);
+  if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26)
+  {
+    tag = format[24] | (format[25] << 8);
+  }
+  if (tag == WAVE_FORMAT_IEEE_FLOAT)
+  {
+    layout->encoding = SOX_ENCODING_FLOAT;
+  }
+  else if (tag == WAVE_FORMAT_PCM)
+  {
+    layout->encoding = layout->bits_per_sample == 8 ? SOX_ENCODING_UNSIGNED : SOX_ENCODING_SIGN2;
+  }
+}
+
+/* The body of a "fmt " chunk; returns its length. Like libSoX, we use the
+ * extensible form for more than two channels or more than 16 bits. */
+static size_t format_chunk(wav_layout_t const * layout, unsigned char * p)
+{
+  unsigned block_align = layout->channels * (layout->bits_per_sample / 8);
+  unsigned tag = layout->encoding == SOX_ENCODING_FLOAT ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+  int extensible = layout->channels > 2 || layout->bits_per_sample > 16;
+
+  write_le16(p, extensible ? WAVE_FORMAT_EXTENSIBLE : tag);
+  write_le16(p + 2, layout->channels);
+  write_le32(p + 4, (uint32_t)layout->rate);
+  write_le32(p + 8, (uint32_t)layout->rate * block_align);
+  write_le16(p + 12, block_align);
+  write_le16(p + 14, layout->bits_per_sample);
+  if (!extensible)
+  {
+    return 16;
+  }
+  write_le16(p + 16, 22);                       /* Size of the extension */
+  write_le16(p + 18, layout->bits_per_sample);  /* Valid bits per sample */
+  write_le32(p + 20, 0);                        /* No particular speaker layout */
+  write_le16(p + 24, tag);
+  memcpy(p + 26, subformat_tail, sizeof(subformat_tail));
+  return 40;
+}
+
+/* A read-only handle may be opened while libSoX is still writing the file.
+ * (Opened for overlapped I/O, so that async-io.c can keep several requests
+ * in flight; on their own, the functions here still do one at a time.) */
+HANDLE wav_open_raw(char const * path, int writable)
+{
+  DWORD access = writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+  DWORD share = writable ? FILE_SHARE_READ : (FILE_SHARE_READ | FILE_SHARE_WRITE);
+  return CreateFileA(path, access, share, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | (OVERLAPPED_IO ? FILE_FLAG_OVERLAPPED : 0), NULL);
+}
+
+/* Create (or replace) a file for us to write a header and samples into. */
+HANDLE wav_create_raw(char const * path)
+{
+  return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+    CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | (OVERLAPPED_IO ? FILE_FLAG_OVERLAPPED : 0), NULL);
+}
+
+/* Positional read: the file pointer is neither used nor moved. */
+int wav_read_at(HANDLE file, uint64_t offset, void * buffer, size_t length)
+{
+  OVERLAPPED position;
+  DWORD transferred = 0;
+
+  memset(&position, 0, sizeof(position));
+  position.Offset = (DWORD)offset;
+  position.OffsetHigh = (DWORD)(offset >> 32);
+  if ((!ReadFile(file, buffer, (DWORD)length, &transferred, &position)
+       && (GetLastError() != ERROR_IO_PENDING
+           || !GetOverlappedResult(file, &position, &transferred, TRUE)))
+      || transferred != length)
+  {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Positional write: the file pointer is neither used nor moved. */
+int wav_write_at(HANDLE file, uint64_t offset, void const * buffer, size_t length)
+{
+  OVERLAPPED position;
+  DWORD transferred = 0;
+
+  memset(&position, 0, sizeof(position));
+  position.Offset = (DWORD)offset;
+  position.OffsetHigh = (DWORD)(offset >> 32);
+  if ((!WriteFile(file, buffer, (DWORD)length, &transferred, &position)
+       && (GetLastError() != ERROR_IO_PENDING
+           || !GetOverlappedResult(file, &position, &transferred, TRUE)))
+      || transferred != length)
+  {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+static int read_w64_layout(HANDLE file, wav_layout_t * layout)
+{
+  unsigned char header[24], format[40];
+  uint64_t position = 40;
+  int have_format = 0;
+
+  layout->container = WAV_CONTAINER_W64;
+  while (wav_read_at(file, position, header, 24) == SOX_SUCCESS)
+  {
+    uint64_t chunk_size = read_le64(header + 16); /* Includes this header */
+    if (chunk_size < 24)
+    {
+      return SOX_EOF;
+    }
+    if (is_w64_chunk(header, "fmt "))
+    {
+      size_t format_size = (size_t)min(chunk_size - 24, (uint64_t)sizeof(format));
+      if (format_size < 16
+          || wav_read_at(file, position + 24, format, format_size) != SOX_SUCCESS)
+      {
+        return SOX_EOF;
+      }
+      parse_format(format, format_size, layout);
+      have_format = 1;
+    }
+    else if (is_w64_chunk(header, "data"))
+    {
+      layout->data_offset = position + 24;
+      layout->data_bytes = chunk_size - 24;
+      return have_format ? SOX_SUCCESS : SOX_EOF;
+    }
+    /* Wave64 chunks are aligned to eight bytes. */
+    position += (chunk_size + 7) & ~(uint64_t)7;
+  }
+  return SOX_EOF;
+}
+
+/* Walk the chunks until we find "fmt " and "data". */
+int wav_read_layout(HANDLE file, wav_layout_t * layout)
+{
+  unsigned char header[40], format[40];
+  uint64_t position = 12, rf64_data_bytes = 0;
+  int have_format = 0;
+
+  memset(layout, 0, sizeof(*layout));
+  if (wav_read_at(file, 0, header, 40) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  if (memcmp(header, w64_riff_guid, 16) == 0 && memcmp(header + 24, "wave", 4) == 0)
+  {
+    return read_w64_layout(file, layout);
+  }
+  if ((memcmp(header, "RIFF", 4) != 0 && memcmp(header, "RF64", 4) != 0)
+      || memcmp(header + 8, "WAVE", 4) != 0)
+  {
+    return SOX_EOF;
+  }
+  layout->container = memcmp(header, "RF64", 4) == 0 ? WAV_CONTAINER_RF64 : WAV_CONTAINER_RIFF;
+  while (wav_read_at(file, position, header, 8) == SOX_SUCCESS)
+  {
+    uint32_t chunk_size = read_le32(header + 4);
+    if (memcmp(header, "ds64", 4) == 0)
+    {
+      if (chunk_size < 24
+          || wav_read_at(file, position + 8, header, 24) != SOX_SUCCESS)
+      {
+        return SOX_EOF;
+      }
+      layout->ds64_offset = position + 8;
+      rf64_data_bytes = read_le64(header + 8);
+    }
+    else if (memcmp(header, "fmt ", 4) == 0)
+    {
+      size_t format_size = min(chunk_size, sizeof(format));
+      if (format_size < 16
+          || wav_read_at(file, position + 8, format, format_size) != SOX_SUCCESS)
+      {
+        return SOX_EOF;
+      }
+      parse_format(format, format_size, layout);
+      have_format = 1;
+    }
+    else if (memcmp(header, "data", 4) == 0)
+    {
+      layout->data_offset = position + 8;
+      layout->data_bytes = chunk_size;
+      if (layout->container == WAV_CONTAINER_RF64 && chunk_size == 0xFFFFFFFF)
+      {
+        layout->data_bytes = rf64_data_bytes;
+      }
+      return have_format ? SOX_SUCCESS : SOX_EOF;
+    }
+    /* Chunks are word-aligned; odd sizes carry a pad byte. */
+    position += 8 + (uint64_t)chunk_size + (chunk_size & 1);
+  }
+  return SOX_EOF;
+}
+
+/* Put together the header for the container, format and no data yet.
+ * Returns its length, and fills in layout->data_offset (and ds64_offset). */
+static size_t build_header(wav_layout_t * layout, unsigned char * header)
+{
+  size_t format_size, length = 0;
+
+  memset(header, 0, WAV_HEADER_MAX_BYTES);
+  if (layout->container == WAV_CONTAINER_W64)
+  {
+    memcpy(header, w64_riff_guid, 16);            /* File size goes at 16 */
+    write_w64_guid(header + 24, "wave");
+    write_w64_guid(header + 40, "fmt ");
+    format_size = format_chunk(layout, header + 64);
+    write_le64(header + 56, 24 + format_size);
+    length = 64 + format_size;
+    write_w64_guid(header + length, "data");      /* Data size goes at length + 16 */
+    length += 24;
+  } else {
+    memcpy(header, layout->container == WAV_CONTAINER_RF64 ? "RF64" : "RIFF", 4);
+    memcpy(header + 8, "WAVE", 4);
+    length = 12;
+    if (layout->container == WAV_CONTAINER_RF64)
+    {
+      /* The real sizes live in ds64; the 32-bit ones are all ones. */
+      write_le32(header + 4, 0xFFFFFFFF);
+      memcpy(header + length, "ds64", 4);
+      write_le32(header + length + 4, 28);
+      layout->ds64_offset = length + 8;
+      length += 8 + 28;
+    }
+    memcpy(header + length, "fmt ", 4);
+    format_size = format_chunk(layout, header + length + 8);
+    write_le32(header + length + 4, (uint32_t)format_size);
+    length += 8 + format_size;
+    memcpy(header + length, "data", 4);
+    if (layout->container == WAV_CONTAINER_RF64)
+    {
+      write_le32(header + length + 4, 0xFFFFFFFF);
+    }
+    length += 8;
+  }
+  layout->data_offset = length;
+  layout->data_bytes = 0;
+  return length;
+}
+
+/* Start a new file: header for the container, format and no data yet.
+ * Fills in layout->data_offset (and ds64_offset). */
+int wav_write_header(HANDLE file, wav_layout_t * layout)
+{
+  unsigned char header[WAV_HEADER_MAX_BYTES];
+  size_t length = build_header(layout, header);
+
+  if (wav_write_at(file, 0, header, length) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  return wav_update_sizes(file, layout, 0);
+}
+
+/* The pad byte(s) after the data: RIFF chunks are word-aligned, Wave64
+ * chunks eight-byte aligned. */
+static size_t data_padding(wav_layout_t const * layout, uint64_t data_bytes)
+{
+  uint64_t end = layout->data_offset + data_bytes;
+
+  return (layout->container == WAV_CONTAINER_W64) ? (size_t)((8 - (end & 7)) & 7)
+    : (size_t)(data_bytes & 1);
+}
+
+/* How big a file in this layout would be with data_bytes of samples,
+ * without writing anything. Fills in layout->data_offset, as
+ * wav_write_header() would. */
+uint64_t wav_file_bytes(wav_layout_t * layout, uint64_t data_bytes)
+{
+  unsigned char header[WAV_HEADER_MAX_BYTES];
+
+  build_header(layout, header);
+  return layout->data_offset + data_bytes + data_padding(layout, data_bytes);
+}
+
+/* Set aside room for the whole file before writing it, so that running
+ * out of disk shows up now rather than gigabytes in, and the file system
+ * can give it one run of clusters. Only the allocation grows, not the
+ * file, and what isn't written is given back when the file is closed. A
+ * file system that can't do this just grows the file as it is written;
+ * only a full disk is an error. */
+int wav_preallocate(HANDLE file, uint64_t file_bytes)
+{
+  FILE_ALLOCATION_INFO allocation;
+
+  allocation.AllocationSize.QuadPart = (LONGLONG)file_bytes;
+  if (!SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation)))
+  {
+    DWORD error = GetLastError();
+    return (error == ERROR_DISK_FULL || error == ERROR_HANDLE_DISK_FULL) ? SOX_EOF : SOX_SUCCESS;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Rewrite the container and data chunk sizes after the data has changed
+ * length, and trim the file so that the data chunk is the last thing in it. */
+int wav_update_sizes(HANDLE file, wav_layout_t const * layout, uint64_t data_bytes)
+{
+  unsigned char field[24];
+  unsigned char const padding[8] = {0};
+  uint64_t end = layout->data_offset + data_bytes;
+  unsigned block_align = max(layout->channels * (layout->bits_per_sample / 8), 1);
+  size_t pad = data_padding(layout, data_bytes);
+  LARGE_INTEGER file_end;
+
+  if (pad > 0 && wav_write_at(file, end, padding, pad) != SOX_SUCCESS)
+  {
+    return SOX_EOF;
+  }
+  switch (layout->container)
+  {
+  case WAV_CONTAINER_RIFF:
+    if (end + pad - 8 > UINT32_MAX)
+    {
+      return SOX_EOF;
+    }
+    write_le32(field, (uint32_t)(end + pad - 8));
+    write_le32(field + 4, (uint32_t)data_bytes);
+    if (wav_write_at(file, 4, field, 4) != SOX_SUCCESS
+        || wav_write_at(file, layout->data_offset - 4, field + 4, 4) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+    break;
+  case WAV_CONTAINER_RF64:
+    write_le64(field, end + pad - 8);
+    write_le64(field + 8, data_bytes);
+    write_le64(field + 16, data_bytes / block_align);
+    if (layout->ds64_offset == 0
+        || wav_write_at(file, layout->ds64_offset, field, 24) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+    break;
+  case WAV_CONTAINER_W64:
+    write_le64(field, end + pad);
+    write_le64(field + 8, 24 + data_bytes);
+    if (wav_write_at(file, 16, field, 8) != SOX_SUCCESS
+        || wav_write_at(file, layout->data_offset - 8, field + 8, 8) != SOX_SUCCESS)
+    {
+      return SOX_EOF;
+    }
+    break;
+  }
+  file_end.QuadPart = (LONGLONG)(end + pad);
+  if (!SetFilePointerEx(file, file_end, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+  {
+    return SOX_EOF;
+  }
+  return SOX_SUCCESS;
+}
+
+/* Can wav_pack_samples() reproduce this encoding? */
+int wav_can_pack(sox_encoding_t encoding, unsigned bits_per_sample)
+{
+  if (bits_per_sample == 8)
+  {
+    return encoding == SOX_ENCODING_UNSIGNED;
+  }
+  if (encoding == SOX_ENCODING_FLOAT)
+  {
+    return bits_per_sample == 32;
+  }
+  return encoding == SOX_ENCODING_SIGN2 && (bits_per_sample == 16
+    || bits_per_sample == 24 || bits_per_sample == 32);
+}
+
+/* Convert libSoX samples to little-endian PCM exactly as the libSoX WAV
+ * writer would. Returns the number of bytes stored, or 0 if the encoding
+ * is one we don't handle. */
+size_t wav_pack_samples(sox_sample_t const * samples, size_t count, sox_encoding_t encoding,
+  unsigned bits_per_sample, unsigned char * dest, sox_uint64_t * clips)
+{
+  SOX_SAMPLE_LOCALS;
+  size_t i;
+
+  if (encoding == SOX_ENCODING_FLOAT && bits_per_sample == 32)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      float value = SOX_SAMPLE_TO_FLOAT_32BIT(samples[i], *clips);
+      uint32_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      write_le32(dest + 4 * i, bits);
+    }
+    return count * 4;
+  }
+
+  switch (bits_per_sample)
+  {
+  case 8:
+    for (i = 0; i < count; ++i)
+    {
+      dest[i] = SOX_SAMPLE_TO_UNSIGNED_8BIT(samples[i], *clips);
+    }
+    return count;
+  case 16:
+    for (i = 0; i < count; ++i)
+    {
+      int16_t value = SOX_SAMPLE_TO_SIGNED_16BIT(samples[i], *clips);
+      dest[2 * i] = value & 0xff;
+      dest[2 * i + 1] = (value >> 8) & 0xff;
+    }
+    return count * 2;
+  case 24:
+    for (i = 0; i < count; ++i)
+    {
+      int32_t value = SOX_SAMPLE_TO_SIGNED_24BIT(samples[i], *clips);
+      dest[3 * i] = value & 0xff;
+      dest[3 * i + 1] = (value >> 8) & 0xff;
+      dest[3 * i + 2] = (value >> 16) & 0xff;
+    }
+    return count * 3;
+  case 32:
+    for (i = 0; i < count; ++i)
+    {
+      write_le32(dest + 4 * i, (uint32_t)samples[i]);
+    }
+    return count * 4;
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* wav-io.h
+ *
+ * (c) 2023 Michael Toulouse
+ *
+ * Definitions and function prototypes for raw WAV file access.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <windows.h>
+#include "sox.h"
+
+#define RIFF_MAX_DATA_BYTES ((uint64_t)0xFFFFFFFF - 1024) /* Leaves room for the header */
+#define WAV_HEADER_MAX_BYTES 128 /* Ours, in any container */
+
+/* The container the samples are wrapped in. Classic RIFF tops out at 4 GB;
+ * RF64 (EBU Tech 3306) and Sony Wave64 carry 64-bit sizes. */
+typedef enum {
+  WAV_CONTAINER_RIFF,
+  WAV_CONTAINER_RF64,
+  WAV_CONTAINER_W64
+} wav_container_t;
+
+/* Where the sample data lives inside a WAV file. */
+typedef struct {
+  wav_container_t container;
+  uint64_t data_offset;     /* Byte offset of the first sample */
+  uint64_t data_bytes;      /* Length of the data chunk, in bytes */
+  uint64_t ds64_offset;     /* RF64 only: where the 64-bit sizes live */
+  unsigned channels;
+  unsigned bits_per_sample;
+  sox_encoding_t encoding;
+  sox_rate_t rate;
+} wav_layout_t;
+
+HANDLE wav_open_raw(char const * path, int writable);
+HANDLE wav_create_raw(char const * path);
+int wav_read_at(HANDLE file, uint64_t offset, void * buffer, size_t length);
+int wav_write_at(HANDLE file, uint64_t offset, void const * buffer, size_t length);
+int wav_read_layout(HANDLE file, wav_layout_t * layout);
+int wav_write_header(HANDLE file, wav_layout_t * layout);
+int wav_update_sizes(HANDLE file, wav_layout_t const * layout, uint64_t data_bytes);
+uint64_t wav_file_bytes(wav_layout_t * layout, uint64_t data_bytes);
+int wav_preallocate(HANDLE file, uint64_t file_bytes);
+int wav_can_pack(sox_encoding_t encoding, unsigned bits_per_sample);
+size_t wav_pack_samples(sox_sample_t const * samples, size_t count, sox_encoding_t encoding,
+  unsigned bits_per_sample, unsigned char * dest, sox_uint64_t * clips);
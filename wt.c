@@ -23,10 +23,6 @@
 #include <stdio.h>
 #include <assert.h>
 
-static char *starting_directory[sizeof(TCHAR) * MAX_PATH + 1];
-static char *working_directory[sizeof(TCHAR) * MAX_PATH + 1];
-char ** filenames;
-
 /**
  * General Utilities
  *
@@ -34,7 +30,8 @@ char ** filenames;
 int compare_filenames(const void* a, const void* b)
 {
   size_t digits_to_compare = DEFAULT_TRACK_NUMER_WIDTH;
-  return strncmp(*(const char**)a, *(const char**)b, digits_to_compare);
+  return strncmp(job_base_name(*(const char**)a), job_base_name(*(const char**)b),
+    digits_to_compare);
 }
 
 int ends_with(const TCHAR *str, const TCHAR *suffix)
@@ -55,78 +52,48 @@ int is_wav_file(const TCHAR *str)
   return 0;
 }
 
-const char* convert_pwstr_to_const_char(PWSTR wideString)
+/* Find the audio files in the job's folder, in track order. */
+int load_filenames(job_t * job)
 {
-  int length = WideCharToMultiByte(CP_UTF8, 0, wideString, -1, NULL, 0, NULL, NULL);
-  char* buffer = (char*)malloc(length * sizeof(char) + 1);
-  if (buffer == NULL)
-  {
-    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-    cleanup();
-    exit(1);
-  }
-  if (WideCharToMultiByte(CP_UTF8, 0, wideString, -1, buffer, length, NULL, NULL) == 0)
-  {
-    report_error(NULL, ST_ERROR, __FILE__, __LINE__);
-    free(buffer);
-    cleanup();
-    exit(1);
-  }
-  return buffer;
-}
-
-size_t count_files()
-{
-  size_t count = 0;
-  char **current = filenames;
-
-  while (*current != NULL)
-  {
-    ++count;
-    ++current;
-  }
-  return count;
-}
-
-void load_filenames(PWSTR directory_path)
-{
-  STRSAFE_LPSTR wav_wildcard = L"*.wav";
+  TCHAR wildcard[MAX_PATH];
   WIN32_FIND_DATA fdFile;
   HANDLE hFind = NULL;
-  filenames = (char**)CoTaskMemAlloc(1 * sizeof(char*));
+  int result = SOX_SUCCESS;
 
-  int file_count = 0;
-  sox_format_t * current_sound_file;
-  PWSTR buffer = NULL;
-  if((hFind = FindFirstFile(wav_wildcard, &fdFile)) != INVALID_HANDLE_VALUE)
+  StringCchPrintfW(wildcard, MAX_PATH, L"%s\\*", job->directory);
+  if((hFind = FindFirstFile(wildcard, &fdFile)) != INVALID_HANDLE_VALUE)
   {
     do {
       /* FindFirstFile will always return "." and ".."
        * as the first two directories. */
-      if(strcmp(fdFile.cFileName, ".") != 0
-          && strcmp(fdFile.cFileName, "..") != 0)
+      if(wcscmp(fdFile.cFileName, L".") != 0
+          && wcscmp(fdFile.cFileName, L"..") != 0)
       {
-        file_count++;
-        filenames = (char**)CoTaskMemRealloc(filenames, file_count * sizeof(char *));
-        filenames[file_count - 1] = (char *)malloc(wcslen(fdFile.cFileName) + 1);
-        StringCbPrintfA(filenames[file_count - 1], (wcslen(fdFile.cFileName) + 1), 
-          "%s", convert_pwstr_to_const_char(fdFile.cFileName));
+        arena_mark_t mark = arena_mark(&job->arena);
+        char * path = job_path(job, fdFile.cFileName);
+
+        if (path == NULL)
+        {
+          result = SOX_EOF;
+        }
+        else if (decoder_accepts(path))
+        {
+          result = job_add_file(job, path);
+        } else {
+          arena_release(&job->arena, mark);
+        }
       }
     }
-    while(FindNextFile(hFind, &fdFile));
+    while(result == SOX_SUCCESS && FindNextFile(hFind, &fdFile));
     FindClose(hFind);
   }
 
-  size_t buffer_size = (wcslen(L"File Count: ") + 10) * sizeof(WCHAR);
-  PWSTR msgbuf = (PWSTR)CoTaskMemAlloc(buffer_size);
-  StringCbPrintfW(msgbuf, buffer_size, L"File Count: %d", file_count);
+  TCHAR msgbuf[40];
+  StringCchPrintfW(msgbuf, ARRAYSIZE(msgbuf), L"File Count: %d", (int)job->file_count);
   MessageBox(NULL, msgbuf, L"FILES SELECTED", MB_OK);
-  CoTaskMemFree(msgbuf);
 
-  qsort(filenames, file_count, sizeof(char *), compare_filenames);
-
-  /* Add a final null terminator so we can calculate the number of files */
-  filenames[file_count] = NULL;
+  qsort(job->filenames, job->file_count, sizeof(char *), compare_filenames);
+  return result;
 }
 
 /**
@@ -157,51 +124,73 @@ void restore_cursor()
   SetCursor(original_cursor);
 }
 
+/* These may be called from any job's thread, with no job to hand, so the
+ * messages are put together on the stack rather than allocated. */
 void report_error(HWND hwnd, int errcode, char * file, int line_number)
 {
-  PWSTR filenamebuf;
-
-  TCHAR *msg_template = L"ERROR %d at line %d in %s\n";
-  int filename_length = MultiByteToWideChar(CP_ACP, 0, file, -1, NULL, 0);
-  filenamebuf = (PWSTR)CoTaskMemAlloc(filename_length * sizeof(WCHAR));
-  MultiByteToWideChar(CP_ACP, 0, file, -1, filenamebuf, filename_length);
-  size_t buffer_size = (wcslen(msg_template) + 20 + filename_length) * sizeof(WCHAR);
-  PWSTR msgbuf = (PWSTR)CoTaskMemAlloc(buffer_size);
-  StringCbPrintfW(msgbuf, buffer_size, msg_template, errcode, line_number, filenamebuf);
+  TCHAR filenamebuf[MAX_PATH];
+  TCHAR msgbuf[MAX_PATH + 64];
+
+  if (MultiByteToWideChar(CP_ACP, 0, file, -1, filenamebuf, MAX_PATH) == 0)
+  {
+    filenamebuf[0] = L'\0';
+  }
+  StringCchPrintfW(msgbuf, ARRAYSIZE(msgbuf), L"ERROR %d at line %d in %s\n",
+    errcode, line_number, filenamebuf);
+  InterlockedIncrement(&errors_reported);
   MessageBox(hwnd, msgbuf, L"ERROR", MB_OK);
-  CoTaskMemFree(filenamebuf);
-  CoTaskMemFree(msgbuf);
 }
 
 void report_current_action(HWND hwnd, const char* message)
 {
-  PWSTR msgbuf;
-  int message_length = MultiByteToWideChar(CP_ACP, 0, message, -1, NULL, 0);
-  msgbuf = (PWSTR)CoTaskMemAlloc((message_length * sizeof(WCHAR) + 1));
-  MultiByteToWideChar(CP_ACP, 0, message, -1, msgbuf, message_length);
+  TCHAR msgbuf[1024];
+
+  /* Too long a message is cut short. */
+  msgbuf[0] = L'\0';
+  if (MultiByteToWideChar(CP_UTF8, 0, message, -1, msgbuf, ARRAYSIZE(msgbuf)) == 0)
+  {
+    msgbuf[ARRAYSIZE(msgbuf) - 1] = L'\0';
+  }
   MessageBox(hwnd, msgbuf, L"CURRENT ACTION", MB_OK);
-  CoTaskMemFree(msgbuf);
 }
 
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
-/* Add up duration of the audio files using SoX */
-DWORD WINAPI DurationThreadProc()
+/* Add up duration of the audio files using SoX: the splice's, as planned
+ * from the headers, or if the files couldn't be spliced together, just
+ * their lengths added up. The thread owns the job it is given. */
+DWORD WINAPI DurationThreadProc(LPVOID parameter)
 {
+  job_t * job = (job_t *)parameter;
   int const message_length = 200;
   TCHAR message[message_length];
   size_t cb_dest = message_length * sizeof(TCHAR);
   TCHAR *msg_template = TEXT("TOTAL DURATION ... %s\n");
-  int result;
+  TCHAR *size_template = TEXT("TOTAL DURATION ... %s\nSPLICED SIZE ... %.1f MB\n");
+  splice_plan_t plan;
+  int planned;
+  double result;
 
-  load_filenames(working_directory);
-  if (filenames != NULL)
+  if (load_filenames(job) == SOX_SUCCESS && job->file_count > 0)
   {
-    result = total_duration();
-    StringCbPrintf(message, cb_dest, msg_template, str_time(result));
+    planned = plan_splice(job, &plan) == SOX_SUCCESS && plan.samples != PLAN_UNKNOWN;
+    if (planned)
+    {
+      result = (double)(plan.samples / plan.signal.channels) / plan.signal.rate;
+    } else {
+      result = total_duration(job);
+    }
+    if (planned && plan.file_bytes != PLAN_UNKNOWN)
+    {
+      StringCbPrintf(message, cb_dest, size_template, str_time(job, result),
+        plan.file_bytes / 1048576.0);
+    } else {
+      StringCbPrintf(message, cb_dest, msg_template, str_time(job, result));
+    }
+    plan_free(&plan);
     MessageBox(NULL, message, L"RESULT", MB_OK);
   }
-  CoTaskMemFree(filenames);
+  job_free(job);
   return 0;
 }
 
@@ -211,8 +200,6 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 {
   const TCHAR CLASS_NAME[] = L"Audio File Timing";
 
-  filenames = NULL;
-
   WNDCLASS wc = { };
 
   wc.lpfnWndProc    = WindowProc;
@@ -284,7 +271,6 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
       CREATESTRUCT *pCreate = (CREATESTRUCT*)(lParam);
       sox_result = sox_init();
-      sox_quit_called = 0;
       if (sox_result != SOX_SUCCESS)
       {
         report_error(hwnd, sox_result, __FILE__, __LINE__);
@@ -304,7 +290,6 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             pFileOpenDialog->lpVtbl->GetOptions(pFileOpenDialog, &dwOptions);
             pFileOpenDialog->lpVtbl->SetOptions(pFileOpenDialog, dwOptions | FOS_PICKFOLDERS | FOS_FILEMUSTEXIST);
             pFileOpenDialog->lpVtbl->SetOkButtonLabel(pFileOpenDialog, L"Select Folder");
-            GetCurrentDirectory((sizeof(TCHAR) * MAX_PATH), starting_directory);
             hr = pFileOpenDialog->lpVtbl->Show(pFileOpenDialog, hwnd);
             if (SUCCEEDED(hr))
             {
@@ -317,24 +302,28 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 if (SUCCEEDED(hr))
                 {
                   int filePathLength = (wcslen(pszFolderPath) + 1) * sizeof(TCHAR);
-                  wcscpy_s(working_directory, filePathLength, pszFolderPath);
+                  job_t * job = NULL;
                   if (filePathLength < MAX_PATH)
                   {
-                    SetCurrentDirectory(working_directory);
+                    job = job_create(pszFolderPath);
+                  }
+                  if (job != NULL)
+                  {
                     DWORD dwThreadId;
                     set_wait_cursor();
-                    HANDLE hThread = CreateThread(NULL, 0, DurationThreadProc, NULL, 0, &dwThreadId);
+                    HANDLE hThread = CreateThread(NULL, 0, DurationThreadProc, job, 0, &dwThreadId);
                     if (hThread != NULL)
                     {
                       CloseHandle(hThread);
                     } else {
                       report_error(hwnd, ST_ERROR, __FILE__, __LINE__);
+                      job_free(job);
                     }
                     restore_cursor();
-                    CoTaskMemFree(pszFolderPath);
                   } else {
                     report_error(hwnd, filePathLength, __FILE__, __LINE__);
                   }
+                  CoTaskMemFree(pszFolderPath);
                 }
                 pSelectedItem->lpVtbl->Release(pSelectedItem);
               }
@@ -351,7 +340,6 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     break;
   case WM_CLOSE:
     {
-      SetCurrentDirectory(starting_directory);
       DestroyWindow(hwnd);
     }
     break;
@@ -11,6 +11,28 @@
 #include <math.h>
 #include <windows.h>
 #include "sox.h"
+#include "budget.h"
+#include "wav-io.h"
+#include "async-io.h"
+#include "native-pcm.h"
+#include "automation.h"
+#include "checksum.h"
+#include "manifest.h"
+#include "journal.h"
+#include "envelope.h"
+#include "arena.h"
+#include "flac-encode.h"
+#include "decode.h"
+#include "dither.h"
+#include "scratch.h"
+#include "trim-chain.h"
+#include "server.h"
+#include "split.h"
+#include "plan.h"
+#include "store.h"
+#include "fan-out.h"
+#include "job.h"
+#include "watch.h"
 
 /* Define the format specifier to use for uint64_t values. */
 #ifndef PRIu64 /* Maybe <inttypes.h> already defined this. */
@@ -23,6 +45,37 @@
 #endif
 #endif /* PRIu64 */
 
+/* ...and the matching scanf() specifier. */
+#ifndef SCNu64
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#define SCNu64 "I64u"
+#elif ULONG_MAX==0xffffffffffffffff
+#define SCNu64 "lu"
+#else
+#define SCNu64 "llu"
+#endif
+#endif /* SCNu64 */
+
+/* ...and both again in hex, for keys and hashes. */
+#ifndef PRIx64
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#define PRIx64 "I64x"
+#elif ULONG_MAX==0xffffffffffffffff
+#define PRIx64 "lx"
+#else
+#define PRIx64 "llx"
+#endif
+#endif /* PRIx64 */
+#ifndef SCNx64
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#define SCNx64 "I64x"
+#elif ULONG_MAX==0xffffffffffffffff
+#define SCNx64 "lx"
+#else
+#define SCNx64 "llx"
+#endif
+#endif /* SCNx64 */
+
 /* Define the format specifier to use for size_t values.
  * Example: printf("Sizeof(x) = %" PRIuPTR " bytes", sizeof(x)); */
 #ifndef PRIuPTR /* Maybe <inttypes.h> already defined this. */
@@ -39,7 +92,21 @@
 #define linear_to_dB(x) (log10(x) * 20)
 #define DEFAULT_SILENCE_THRESHOLD ".041"
 #define DEFAULT_NOISE_DURATION "00:00:00.2"
+#define DEFAULT_SPLIT_GAP "00:00:02" /* Quiet between tracks of a capture */
 #define DEFAULT_OUTPUT_FILENAME "spliced-audio.wav"
+#define FLAC_OUTPUT_FILENAME "spliced-audio.flac"
+#define CD_OUTPUT_FILENAME "spliced-audio-cd.wav" /* The 16-bit deliverable... */
+#define CD_OUTPUT_RATE 44100 /* ...and its rate */
+#define PREVIEW_OUTPUT_FILENAME "spliced-audio-preview.wav" /* Just the joins... */
+#define PREVIEW_SECONDS 3 /* ...this much either side of each... */
+#define PREVIEW_GAP_SECONDS 1 /* ...and this much silence between them */
+#define LARGE_OUTPUT_CONTAINER WAV_CONTAINER_RF64 /* ...or WAV_CONTAINER_W64 for Sony Wave64 */
+#define WRITE_PEAK_FILE 1 /* Write spliced-audio.wav.peaks, for drawing the waveform */
+#define OVERLAPPED_IO 1 /* Keep several raw reads and writes in flight; 0 does one at a time */
+#define SCRATCH_MEMORY_BUDGET ((size_t)64 * 1024 * 1024) /* Effect scratch kept in memory; the rest spills to disk */
+#define MEMORY_BUDGET ((uint64_t)512 * 1024 * 1024) /* For the buffers of all the jobs running at once */
+#define MEMORY_JOB_RESERVE ((size_t)16 * 1024 * 1024) /* Set aside for each, before it starts */
+#define DEFAULT_DITHER DITHER_SHAPED /* ...or DITHER_TPDF, when reducing to 16 bits */
 #define DEFAULT_SPLICE_OVERLAP ".1"
 #define MAXIMUM_SPLICES 50
 #define MAXIMUM_SAMPLES (size_t)2048 /* Typical operating system I/O buffer size */
@@ -54,15 +121,20 @@ static sox_signalinfo_t st_default_signalinfo = {
 };
 
 void show_stats(sox_format_t * in);
-void show_name_and_runtime(sox_format_t * in);
-TCHAR const * str_time(double seconds);
+void show_name_and_runtime(job_t * job, sox_format_t * in);
+TCHAR const * str_time(job_t * job, double seconds);
 void report_error(HWND hwnd, int errcode, char* file, int line_number);
 void report_current_action(HWND, const char*);
-const char* convert_pwstr_to_const_char(PWSTR wideString);
-void trim_silence(TCHAR * filename, char * duration, char * threshold);
-double total_duration();
-void splice();
-static int sox_quit_called;
-extern char * * filenames;
+void trim_silence(job_t * job, TCHAR * filename, char * duration, char * threshold);
+int parse_threshold(char const * text, double * threshold);
+int parse_duration(char const * text, sox_rate_t rate, uint64_t * frames);
+double total_duration(job_t * job);
+void splice(job_t * job);
+void splice_deliverables(job_t * job);
+void preview_joins(job_t * job);
+void resplice(job_t * job);
+void splice_track(job_t * job, size_t index, int added);
+void verify(job_t * job);
+int load_filenames(job_t * job);
+int compare_filenames(const void * a, const void * b);
 int cleanup();
-size_t count_files();